@@ -1,118 +1,196 @@
 #include "codec.h"
+#include "error.h"
+#include "common.h"
 #include "codecs/opus.h"
 #include "codecs/aac.h"
 #include "codecs/vorbis.h"
 #include "codecs/flac.h"
 #include "codecs/mp3.h"
 #include "codecs/mp2.h"
+#include "codecs/pcm.h"
 
 using namespace xetrov;
 
-int xe_codec::open(xe_codec** out, xe_codec_parameters& params, xe_codec_mode mode){
-	xe_codec* codec;
+/* Implementation details
+ * ==============================================================
+ * codecs and parsers are looked up in registries kept sorted by
+ * descending priority. the built in implementations are added the
+ * first time a registry is used, and a registration with the same
+ * priority as an existing one goes in front of it, so applications
+ * can replace any built in implementation
+ */
+
+struct xe_codec_entry{
+	xe_codec_id id;
+	xe_codec_mode mode;
+	xe_codec_factory factory;
+	int priority;
+};
+
+struct xe_codec_parser_entry{
+	xe_codec_id id;
+	xe_codec_parser_factory factory;
+	int priority;
+};
+
+static const xe_codec_entry builtin_codecs[] = {
+	{XE_CODEC_OPUS, XE_CODEC_DECODE, xe_opus::native_decoder, XE_CODEC_PRIORITY_NATIVE},
+	{XE_CODEC_OPUS, XE_CODEC_DECODE, xe_opus::decoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_AAC, XE_CODEC_DECODE, xe_aac::decoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_VORBIS, XE_CODEC_DECODE, xe_vorbis::decoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_FLAC, XE_CODEC_DECODE, xe_flac::decoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_MP3, XE_CODEC_DECODE, xe_mp3::decoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_MP2, XE_CODEC_DECODE, xe_mp2::decoder, XE_CODEC_PRIORITY_AV},
+
+	{XE_CODEC_OPUS, XE_CODEC_ENCODE, xe_opus::native_encoder, XE_CODEC_PRIORITY_NATIVE},
+	{XE_CODEC_OPUS, XE_CODEC_ENCODE, xe_opus::encoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_AAC, XE_CODEC_ENCODE, xe_aac::encoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_VORBIS, XE_CODEC_ENCODE, xe_vorbis::encoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_FLAC, XE_CODEC_ENCODE, xe_flac::encoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_MP3, XE_CODEC_ENCODE, xe_mp3::encoder, XE_CODEC_PRIORITY_AV},
+	{XE_CODEC_MP2, XE_CODEC_ENCODE, xe_mp2::encoder, XE_CODEC_PRIORITY_AV}
+};
+
+static const xe_codec_parser_entry builtin_parsers[] = {
+	{XE_CODEC_AAC, xe_aac::parser, XE_CODEC_PRIORITY_NATIVE},
+	{XE_CODEC_OPUS, xe_opus::parser, XE_CODEC_PRIORITY_NATIVE},
+	{XE_CODEC_VORBIS, xe_vorbis::parser, XE_CODEC_PRIORITY_NATIVE},
+	{XE_CODEC_FLAC, xe_flac::parser, XE_CODEC_PRIORITY_NATIVE}
+};
+
+static xe_vector<xe_codec_entry> codecs;
+static xe_vector<xe_codec_parser_entry> parsers;
+static bool codecs_registered;
+static bool parsers_registered;
+
+template<typename T>
+static int insert_entry(xe_vector<T>& list, const T& entry){
+	return xe_insert_by_priority(list, entry) ? 0 : XE_ENOMEM;
+}
 
-	if(mode == XE_CODEC_DECODE){
-		switch(params.id){
-			case XE_CODEC_OPUS:
-				codec = xe_opus::decoder();
+static int register_builtin_codecs(){
+	int err;
 
-				break;
-			case XE_CODEC_AAC:
-				codec = xe_aac::decoder();
+	if(codecs_registered)
+		return 0;
+	/* inserted last to first, so equal priorities keep the table's order.
+	 * cleared on failure so the next call starts over */
+	for(size_t i = xe_array_size(builtin_codecs); i > 0; i--){
+		if((err = insert_entry(codecs, builtin_codecs[i - 1]))){
+			codecs.resize(0);
 
-				break;
-			case XE_CODEC_VORBIS:
-				codec = xe_vorbis::decoder();
+			return err;
+		}
+	}
 
-				break;
-			case XE_CODEC_FLAC:
-				codec = xe_flac::decoder();
+	for(uint id = XE_CODEC_PCM_U8; id <= XE_CODEC_PCM_F64BE; id++){
+		if((err = insert_entry(codecs, {(xe_codec_id)id, XE_CODEC_DECODE, xe_pcm::decoder, XE_CODEC_PRIORITY_NATIVE}))){
+			codecs.resize(0);
 
-				break;
-			case XE_CODEC_MP3:
-				codec = xe_mp3::decoder();
+			return err;
+		}
+	}
 
-				break;
-			case XE_CODEC_MP2:
-				codec = xe_mp2::decoder();
+	codecs_registered = true;
 
-				break;
-			default:
-				return XE_ENOSYS;
-		}
-	}else{
-		switch(params.id){
-			case XE_CODEC_OPUS:
-				codec = xe_opus::encoder();
-
-				break;
-			case XE_CODEC_AAC:
-				codec = xe_aac::encoder();
-
-				break;
-			case XE_CODEC_VORBIS:
-				codec = xe_vorbis::encoder();
-
-				break;
-			case XE_CODEC_FLAC:
-				codec = xe_flac::encoder();
-
-				break;
-			case XE_CODEC_MP3:
-				codec = xe_mp3::encoder();
-
-				break;
-			case XE_CODEC_MP2:
-				codec = xe_mp2::encoder();
-
-				break;
-			default:
-				return XE_ENOSYS;
+	return 0;
+}
+
+static int register_builtin_parsers(){
+	int err;
+
+	if(parsers_registered)
+		return 0;
+	for(size_t i = xe_array_size(builtin_parsers); i > 0; i--){
+		if((err = insert_entry(parsers, builtin_parsers[i - 1]))){
+			parsers.resize(0);
+
+			return err;
 		}
 	}
 
-	if(!codec)
-		return XE_ENOMEM;
-	int err = codec -> init(params);
+	parsers_registered = true;
 
-	if(err){
-		xe_delete(codec);
+	return 0;
+}
 
+int xe_codec::open(xe_codec** out, xe_codec_parameters& params, xe_codec_mode mode){
+	xe_codec* codec;
+	int err;
+
+	if((err = register_builtin_codecs()))
 		return err;
+	err = XE_ENOSYS;
+
+	for(const xe_codec_entry& entry : codecs){
+		if(entry.id != params.id || entry.mode != mode)
+			continue;
+		codec = entry.factory();
+
+		if(!codec)
+			return XE_ENOMEM;
+		err = codec -> init(params);
+
+		if(!err){
+			*out = codec;
+
+			return 0;
+		}
+
+		xe_delete(codec);
+
+		/* unavailable, try the next implementation */
+		if(err != XE_ENOSYS)
+			return err;
 	}
 
-	*out = codec;
+	return err;
+}
 
-	return 0;
+int xe_codec::register_codec(xe_codec_id id, xe_codec_mode mode, xe_codec_factory factory, int priority){
+	int err;
+
+	if((err = register_builtin_codecs()))
+		return err;
+	return insert_entry(codecs, {id, mode, factory, priority});
 }
 
 int xe_codec_parser::open(xe_codec_parser** out, xe_codec_parameters& params){
 	xe_codec_parser* parser;
+	int err;
 
-	switch(params.id){
-		case XE_CODEC_OPUS:
-			parser = xe_opus::parser();
+	if((err = register_builtin_parsers()))
+		return err;
+	err = XE_ENOSYS;
 
-			break;
-		case XE_CODEC_VORBIS:
-			parser = xe_vorbis::parser();
+	for(const xe_codec_parser_entry& entry : parsers){
+		if(entry.id != params.id)
+			continue;
+		parser = entry.factory();
 
-			break;
-		default:
-			return XE_ENOSYS;
-	}
+		if(!parser)
+			return XE_ENOMEM;
+		err = parser -> init(params);
 
-	if(!parser)
-		return XE_ENOMEM;
-	int err = parser -> init(params);
+		if(!err){
+			*out = parser;
+
+			return 0;
+		}
 
-	if(err){
 		parser -> close();
 
-		return err;
+		if(err != XE_ENOSYS)
+			return err;
 	}
 
-	*out = parser;
+	return err;
+}
 
-	return 0;
-}
\ No newline at end of file
+int xe_codec_parser::register_parser(xe_codec_id id, xe_codec_parser_factory factory, int priority){
+	int err;
+
+	if((err = register_builtin_parsers()))
+		return err;
+	return insert_entry(parsers, {id, factory, priority});
+}
@@ -21,7 +21,21 @@ enum xe_codec_id{
 	XE_CODEC_FLAC,
 	XE_CODEC_VORBIS,
 	XE_CODEC_MP3,
-	XE_CODEC_MP2
+	XE_CODEC_MP2,
+
+	/* uncompressed, no decoding needed */
+	XE_CODEC_PCM_U8,
+	XE_CODEC_PCM_S8,
+	XE_CODEC_PCM_S16LE,
+	XE_CODEC_PCM_S16BE,
+	XE_CODEC_PCM_S24LE,
+	XE_CODEC_PCM_S24BE,
+	XE_CODEC_PCM_S32LE,
+	XE_CODEC_PCM_S32BE,
+	XE_CODEC_PCM_F32LE,
+	XE_CODEC_PCM_F32BE,
+	XE_CODEC_PCM_F64LE,
+	XE_CODEC_PCM_F64BE
 };
 
 enum xe_codec_mode{
@@ -29,6 +43,15 @@ enum xe_codec_mode{
 	XE_CODEC_ENCODE = 1
 };
 
+/* when several implementations are registered for a codec, the highest priority
+ * is tried first and ties go to the latest registration */
+enum xe_codec_priority{
+	/* backed by libavcodec */
+	XE_CODEC_PRIORITY_AV = 0,
+	/* implemented here, preferred over libavcodec */
+	XE_CODEC_PRIORITY_NATIVE = 100
+};
+
 enum xe_channels{
 	XE_CH_FRONT_LEFT = AV_CH_FRONT_LEFT,
 	XE_CH_FRONT_RIGHT = AV_CH_FRONT_RIGHT,
@@ -78,6 +101,14 @@ struct xe_codec_parameters{
 	uint bit_rate;
 	xe_audio_sample_fmt format;
 
+	/* in samples at the decoded sample rate. leading samples that only prime the
+	 * decoder (opus pre-skip), and samples to discard after a seek */
+	uint delay;
+	uint preroll;
+
+	/* codec specific encoder settings such as xe_opus_encoder_options, null for defaults */
+	xe_ptr options;
+
 	bool alloc_config(size_t size){
 		size_t total;
 
@@ -95,6 +126,12 @@ struct xe_codec_parameters{
 	}
 };
 
+class xe_codec;
+class xe_codec_parser;
+
+typedef xe_codec* (*xe_codec_factory)();
+typedef xe_codec_parser* (*xe_codec_parser_factory)();
+
 class xe_codec{
 protected:
 	xe_codec_id id_;
@@ -115,10 +152,18 @@ public:
 	virtual int receive_packet(xe_packet& packet) = 0;
 	virtual int drain() = 0;
 	virtual void flush() = 0;
+	/* after a flush, drop decoded samples before timestamp (in the packets'
+	 * timescale). xe_format seeks ahead of the target by the preroll so the
+	 * decoder converges before it. decoders that can't trim ignore it */
+	virtual void skip_to(ulong timestamp){}
 
 	virtual ~xe_codec(){}
 
 	static int open(xe_codec** codec, xe_codec_parameters& params, xe_codec_mode mode);
+
+	/* implementations failing init with XE_ENOSYS fall through to the next one.
+	 * not thread safe, register before opening any codecs */
+	static int register_codec(xe_codec_id id, xe_codec_mode mode, xe_codec_factory factory, int priority);
 };
 
 class xe_codec_parser{
@@ -136,9 +181,14 @@ public:
 	}
 
 	virtual int parse(xe_packet& packet) = 0;
+	/* forget the packets before a seek */
+	virtual void reset(){}
 	virtual void close(){}
 
 	static int open(xe_codec_parser** parser, xe_codec_parameters& params);
+
+	/* same rules as xe_codec::register_codec */
+	static int register_parser(xe_codec_id id, xe_codec_parser_factory factory, int priority);
 };
 
 }
\ No newline at end of file
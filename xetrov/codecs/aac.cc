@@ -43,6 +43,103 @@ int xe_aac::parse_config(xe_codec_parameters& context){
 	return reader.has_bits(0) ? 0 : XE_INVALID_DATA;
 }
 
+int xe_aac::parse_adts(xe_cbptr data, size_t size, xe_adts_header& header){
+	if(size < XE_ADTS_HEADER_SIZE)
+		return XE_INVALID_DATA;
+	xe_bit_reader reader(data, 0, XE_ADTS_HEADER_SIZE << 3);
+	uint protection_absent;
+
+	/* syncword and layer */
+	if(reader.read(12) != 0xfff)
+		return XE_INVALID_DATA;
+	reader.skip(1);
+
+	if(reader.read(2))
+		return XE_INVALID_DATA;
+	protection_absent = reader.read();
+	header.profile = reader.read(2);
+	header.sample_rate_index = reader.read(4);
+	reader.skip(1);
+	header.channel_config = reader.read(3);
+	/* original, home and copyright bits */
+	reader.skip(4);
+	header.size = reader.read(13);
+	/* buffer fullness */
+	reader.skip(11);
+	header.blocks = reader.read(2) + 1;
+	header.header_size = protection_absent ? XE_ADTS_HEADER_SIZE : XE_ADTS_HEADER_SIZE + 2;
+
+	if(header.sample_rate_index > 12 || header.size < header.header_size)
+		return XE_INVALID_DATA;
+	header.sample_rate = sample_rate_table[header.sample_rate_index];
+	header.channels = channel_table[header.channel_config];
+
+	return 0;
+}
+
+int xe_aac::adts_config(const xe_adts_header& header, xe_codec_parameters& params){
+	ushort config;
+
+	if(!params.alloc_config(2))
+		return XE_ENOMEM;
+	/* object type is the adts profile plus one */
+	config = ((header.profile + 1) << 11) | (header.sample_rate_index << 7) | (header.channel_config << 3);
+	params.config[0] = config >> 8;
+	params.config[1] = config;
+	params.sample_rate = header.sample_rate;
+	params.channels = header.channels;
+	params.frame_size = XE_AAC_FRAME_SIZE;
+
+	return 0;
+}
+
+class xe_aac_parser : public xe_codec_parser{
+public:
+	uint sample_rate;
+	uint frame_size;
+
+	xe_aac_parser(): xe_codec_parser(XE_CODEC_AAC){
+		sample_rate = 0;
+		frame_size = 0;
+	}
+
+	int init(xe_codec_parameters& params){
+		if(!params.sample_rate && params.config.size())
+			xe_aac::parse_config(params);
+		sample_rate = params.sample_rate;
+		frame_size = params.frame_size ? params.frame_size : (uint)XE_AAC_FRAME_SIZE;
+
+		return 0;
+	}
+
+	int parse(xe_packet& packet){
+		xe_adts_header header;
+
+		if(!packet.size())
+			return XE_INVALID_DATA;
+		if(packet.data()[0] == 0xff && !xe_aac::parse_adts(packet.data(), packet.size(), header)){
+			if(header.size > packet.size())
+				return XE_INVALID_DATA;
+			packet.timescale = header.sample_rate;
+			packet.duration = (ulong)header.blocks * XE_AAC_FRAME_SIZE;
+		}else{
+			/* raw access unit, one block per packet */
+			if(!sample_rate)
+				return XE_INVALID_DATA;
+			packet.timescale = sample_rate;
+			packet.duration = frame_size;
+		}
+
+		packet.flags |= XE_PACKET_FLAG_KEY;
+
+		return 0;
+	}
+
+	void close(){
+		xe_delete(this);
+	}
+};
+
 class xe_aac_encoder : public xe_av_codec{
 public:
 	xe_aac_encoder(): xe_av_codec(XE_CODEC_AAC){}
@@ -74,5 +171,5 @@ xe_codec* xe_aac::decoder(){
 }
 
 xe_codec_parser* xe_aac::parser(){
-	return null;
+	return xe_new<xe_aac_parser>();
 }
\ No newline at end of file
@@ -3,12 +3,37 @@
 
 namespace xetrov{
 
+enum{
+	XE_ADTS_HEADER_SIZE = 7,
+	XE_AAC_FRAME_SIZE = 1024
+};
+
+struct xe_adts_header{
+	/* whole frame, header included */
+	uint size;
+	/* 9 bytes when followed by a crc */
+	uint header_size;
+	uint profile;
+	uint sample_rate_index;
+	uint sample_rate;
+	uint channel_config;
+	uint channels;
+	uint blocks;
+};
+
 class xe_aac{
 public:
 	static int parse_config(xe_codec_parameters& context);
+
+	/* decode the fixed and variable adts header, data needs XE_ADTS_HEADER_SIZE bytes */
+	static int parse_adts(xe_cbptr data, size_t size, xe_adts_header& header);
+
+	/* fill in codec parameters and an AudioSpecificConfig from an adts header */
+	static int adts_config(const xe_adts_header& header, xe_codec_parameters& params);
+
 	static xe_codec* encoder();
 	static xe_codec* decoder();
 	static xe_codec_parser* parser();
 };
 
-}
\ No newline at end of file
+}
@@ -2,7 +2,10 @@
 
 using namespace xetrov;
 
-xe_av_codec::xe_av_codec(xe_codec_id id): xe_codec(id){}
+xe_av_codec::xe_av_codec(xe_codec_id id): xe_codec(id){
+	target = 0;
+	seeking = false;
+}
 
 int xe_av_codec::open(const AVCodec* codec, xe_codec_parameters& params){
 	int err;
@@ -124,17 +127,28 @@ int xe_av_codec::receive_frame(xe_frame& frame){
 
 	xe_zero(&avframe);
 
-	switch(avcodec_receive_frame(context, &avframe)){
-		case 0:
+	while(true){
+		switch(avcodec_receive_frame(context, &avframe)){
+			case 0:
+				break;
+			case AVERROR(EAGAIN):
+				return XE_EAGAIN;
+			case AVERROR_EOF:
+				return XE_EOF;
+			case AVERROR(EINVAL):
+				return XE_EINVAL;
+			default:
+				return XE_EXTERNAL;
+		}
+
+		/* whole frames are dropped, a frame without a duration ends where it starts */
+		if(!seeking || (ulong)avframe.best_effort_timestamp + avframe.pkt_duration > target){
+			seeking = false;
+
 			break;
-		case AVERROR(EAGAIN):
-			return XE_EAGAIN;
-		case AVERROR_EOF:
-			return XE_EOF;
-		case AVERROR(EINVAL):
-			return XE_EINVAL;
-		default:
-			return XE_EXTERNAL;
+		}
+
+		av_frame_unref(&avframe);
 	}
 
 	frame.samples = avframe.nb_samples;
@@ -212,6 +226,12 @@ int xe_av_codec::drain(){
 
 void xe_av_codec::flush(){
 	avcodec_flush_buffers(context);
+	seeking = false;
+}
+
+void xe_av_codec::skip_to(ulong timestamp){
+	target = timestamp;
+	seeking = true;
 }
 
 xe_av_codec::~xe_av_codec(){
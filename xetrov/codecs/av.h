@@ -11,6 +11,9 @@ namespace xetrov{
 class xe_av_codec : public xe_codec{
 protected:
 	AVCodecContext* context;
+	/* frames ending before target are dropped after a seek */
+	ulong target;
+	bool seeking;
 
 	xe_av_codec(xe_codec_id id);
 public:
@@ -24,6 +27,7 @@ public:
 
 	int drain();
 	void flush();
+	void skip_to(ulong timestamp);
 
 	~xe_av_codec();
 };
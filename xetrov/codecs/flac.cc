@@ -1,26 +1,232 @@
 #include "flac.h"
 #include "av.h"
 #include "../error.h"
+#include "xe/arch.h"
+#include "xe/mem.h"
 
 using namespace xetrov;
 
 static const AVCodec* flac_decoder = avcodec_find_decoder(AV_CODEC_ID_FLAC);
 static const AVCodec* flac_encoder = avcodec_find_encoder(AV_CODEC_ID_FLAC);
 
+enum{
+	FLAC_MIN_HEADER_SIZE = 6,
+	FLAC_MAX_HEADER_SIZE = 16,
+	FLAC_STREAMINFO_SIZE = 34
+};
+
+static const uint sample_rate_table[] = {
+	0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+	32000, 44100, 48000, 96000, 0, 0, 0, 0
+};
+
+static const uint sample_size_table[] = {
+	0, 8, 12, 0, 16, 20, 24, 32
+};
+
+static const struct xe_crc16_table{
+	ushort value[256];
+
+	constexpr xe_crc16_table(): value(){
+		for(uint i = 0; i < 256; i++){
+			uint crc = i << 8;
+
+			for(uint j = 0; j < 8; j++)
+				crc = crc & 0x8000 ? (crc << 1) ^ 0x8005 : crc << 1;
+			value[i] = crc;
+		}
+	}
+} crc16_table;
+
+static byte crc8(xe_cbptr data, size_t size){
+	uint crc = 0;
+
+	for(size_t i = 0; i < size; i++){
+		crc ^= data[i];
+
+		for(uint j = 0; j < 8; j++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+
+	return crc;
+}
+
+static ushort crc16(xe_cbptr data, size_t size, ushort crc = 0){
+	for(size_t i = 0; i < size; i++)
+		crc = (crc << 8) ^ crc16_table.value[(crc >> 8) ^ data[i]];
+	return crc;
+}
+
+int xe_flac::parse_header(xe_cbptr data, size_t size, xe_flac_frame& frame){
+	uint block_code, rate_code, channel_code, size_code, len, pos;
+	ulong number;
+
+	if(size < FLAC_MIN_HEADER_SIZE)
+		return XE_INVALID_DATA;
+	/* 14 bit sync code, reserved bit and blocking strategy */
+	if(data[0] != 0xff || (data[1] & 0xfe) != 0xf8)
+		return XE_INVALID_DATA;
+	frame.variable = data[1] & 0x1;
+	block_code = data[2] >> 4;
+	rate_code = data[2] & 0xf;
+	channel_code = data[3] >> 4;
+	size_code = (data[3] >> 1) & 0x7;
+
+	if(!block_code || rate_code == 0xf || channel_code > 10 || size_code == 3 || (data[3] & 0x1))
+		return XE_INVALID_DATA;
+	/* utf-8 style coded frame or sample number */
+	number = data[4];
+	pos = 5;
+
+	if(number & 0x80){
+		len = xe_arch_clzl(~number << 56);
+
+		if(len < 2 || len > 7 || (len == 7 && !frame.variable))
+			return XE_INVALID_DATA;
+		number &= 0x7f >> len;
+
+		for(uint i = 1; i < len; i++, pos++){
+			if(pos >= size || (data[pos] & 0xc0) != 0x80)
+				return XE_INVALID_DATA;
+			number = (number << 6) | (data[pos] & 0x3f);
+		}
+	}
+
+	frame.number = number;
+
+	if(block_code == 1)
+		frame.block_size = 192;
+	else if(block_code <= 5)
+		frame.block_size = 576 << (block_code - 2);
+	else if(block_code >= 8)
+		frame.block_size = 256 << (block_code - 8);
+	else if(block_code == 6){
+		if(pos + 1 > size)
+			return XE_INVALID_DATA;
+		frame.block_size = data[pos++] + 1;
+	}else{
+		if(pos + 2 > size)
+			return XE_INVALID_DATA;
+		frame.block_size = ((data[pos] << 8) | data[pos + 1]) + 1;
+		pos += 2;
+	}
+
+	if(rate_code < 12)
+		frame.sample_rate = sample_rate_table[rate_code];
+	else if(rate_code == 12){
+		if(pos + 1 > size)
+			return XE_INVALID_DATA;
+		frame.sample_rate = data[pos++] * 1000;
+	}else{
+		if(pos + 2 > size)
+			return XE_INVALID_DATA;
+		frame.sample_rate = (data[pos] << 8) | data[pos + 1];
+		pos += 2;
+
+		if(rate_code == 14)
+			frame.sample_rate *= 10;
+	}
+
+	frame.channels = channel_code < 8 ? channel_code + 1 : 2;
+	frame.bits_per_sample = sample_size_table[size_code];
+
+	if(pos >= size || crc8(data, pos) != data[pos])
+		return XE_INVALID_DATA;
+	frame.header_size = pos + 1;
+
+	return frame.header_size;
+}
+
+size_t xe_flac::find_frame(xe_cbptr data, size_t size, size_t offset){
+	xe_flac_frame frame;
+
+	for(; offset + 1 < size; offset++){
+		if(data[offset] != 0xff || (data[offset + 1] & 0xfe) != 0xf8)
+			continue;
+		if(parse_header(data + offset, size - offset, frame) > 0)
+			return offset;
+	}
+
+	return size;
+}
+
+int xe_flac::split(xe_cbptr data, size_t size, size_t& frame_size){
+	xe_flac_frame frame;
+	size_t next;
+	int len;
+
+	if((len = parse_header(data, size, frame)) < 0)
+		return len;
+	/* the frame crc-16 follows the subframes, so a
+	 * real boundary leaves a span whose crc-16 is zero */
+	next = len;
+
+	while(true){
+		next = find_frame(data, size, next + 1);
+
+		if(next + FLAC_MAX_HEADER_SIZE > size)
+			return XE_BUFFER_TOO_SMALL;
+		if(!crc16(data, next)){
+			frame_size = next;
+
+			return 0;
+		}
+	}
+}
+
 class xe_flac_parser : public xe_codec_parser{
 public:
-	xe_flac_parser(): xe_codec_parser(XE_CODEC_FLAC){}
+	uint sample_rate;
+
+	xe_flac_parser(): xe_codec_parser(XE_CODEC_FLAC){
+		sample_rate = 0;
+	}
 
 	int init(xe_codec_parameters& params){
+		xe_cbptr info = params.config.data();
+
+		sample_rate = params.sample_rate;
+
+		/* "fLaC" followed by the STREAMINFO block */
+		if(params.config.size() < 8 + FLAC_STREAMINFO_SIZE)
+			return 0;
+		if(info[0] != 'f' || info[1] != 'L' || info[2] != 'a' || info[3] != 'C' || (info[4] & 0x7f))
+			return 0;
+		info += 8;
+		sample_rate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+
 		return 0;
 	}
 
 	int parse(xe_packet& packet){
+		xe_flac_frame frame;
+		size_t offset;
+
+		if(xe_flac::parse_header(packet.data(), packet.size(), frame) < 0){
+			/* lost sync, drop everything before the next frame header */
+			offset = xe_flac::find_frame(packet.data(), packet.size(), 1);
+
+			if(offset >= packet.size())
+				return XE_INVALID_DATA;
+			packet.buffer = xe_array<byte>(packet.data() + offset, packet.size() - offset);
+			xe_flac::parse_header(packet.data(), packet.size(), frame);
+		}
+
+		if(frame.sample_rate)
+			sample_rate = frame.sample_rate;
+		if(!sample_rate)
+			return XE_INVALID_DATA;
+		packet.timescale = sample_rate;
+		packet.duration = frame.block_size;
+		packet.flags |= XE_PACKET_FLAG_KEY;
+
 		return 0;
 	}
-};
 
-static xe_flac_parser flac_parser;
+	void close(){
+		xe_delete(this);
+	}
+};
 
 class xe_flac_encoder : public xe_av_codec{
 public:
@@ -53,5 +259,5 @@ xe_codec* xe_flac::decoder(){
 }
 
 xe_codec_parser* xe_flac::parser(){
-	return &flac_parser;
+	return xe_new<xe_flac_parser>();
 }
\ No newline at end of file
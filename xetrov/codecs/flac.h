@@ -3,11 +3,34 @@
 
 namespace xetrov{
 
+struct xe_flac_frame{
+	/* frame number, or the first sample's number with a variable block size */
+	ulong number;
+	uint block_size;
+	/* 0 when the value comes from STREAMINFO */
+	uint sample_rate;
+	uint bits_per_sample;
+	uint channels;
+	uint header_size;
+	bool variable;
+};
+
 class xe_flac{
 public:
+	/* decode a frame header and check its crc-8, returns the header size */
+	static int parse_header(xe_cbptr data, size_t size, xe_flac_frame& frame);
+
+	/* offset of the first valid frame header at or after offset, or size if there is none */
+	static size_t find_frame(xe_cbptr data, size_t size, size_t offset = 0);
+
+	/* length of the frame at the start of data, found by locating the next valid
+	 * header that ends a span with a matching crc-16. returns XE_BUFFER_TOO_SMALL
+	 * if data doesn't hold a whole frame followed by the next header yet */
+	static int split(xe_cbptr data, size_t size, size_t& frame_size);
+
 	static xe_codec* encoder();
 	static xe_codec* decoder();
 	static xe_codec_parser* parser();
 };
 
-}
\ No newline at end of file
+}
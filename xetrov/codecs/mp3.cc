@@ -7,6 +7,75 @@ using namespace xetrov;
 static const AVCodec* mp3_decoder = avcodec_find_decoder(AV_CODEC_ID_MP3);
 static const AVCodec* mp3_encoder = avcodec_find_encoder(AV_CODEC_ID_MP3);
 
+/* kbps by [lsf][layer - 1][index] */
+static const ushort bit_rate_table[2][3][15] = {
+	{
+		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}
+	},
+	{
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
+	}
+};
+
+static const uint sample_rate_table[3] = {
+	44100, 48000, 32000
+};
+
+int xe_mp3::parse_header(uint header, xe_mpa_header& out){
+	uint version, layer, bit_rate, sample_rate, lsf, padding;
+
+	if((header & 0xffe00000) != 0xffe00000)
+		return XE_INVALID_DATA;
+	version = (header >> 19) & 0x3;
+	layer = (header >> 17) & 0x3;
+	bit_rate = (header >> 12) & 0xf;
+	sample_rate = (header >> 10) & 0x3;
+
+	/* reserved values, and emphasis */
+	if(version == 1 || !layer || !bit_rate || bit_rate == 0xf || sample_rate == 0x3 || (header & 0x3) == 0x2)
+		return XE_INVALID_DATA;
+	out.version = version == 3 ? 0 : version == 2 ? 1 : 2;
+	out.layer = 4 - layer;
+	lsf = out.version ? 1 : 0;
+	padding = (header >> 9) & 0x1;
+
+	out.sample_rate_index = sample_rate;
+	out.sample_rate = sample_rate_table[sample_rate] >> out.version;
+	out.bit_rate = bit_rate_table[lsf][out.layer - 1][bit_rate] * 1000;
+	out.channels = ((header >> 6) & 0x3) == 0x3 ? 1 : 2;
+	out.crc = !(header & 0x10000);
+
+	switch(out.layer){
+		case 1:
+			out.samples = 384;
+			out.size = (12 * out.bit_rate / out.sample_rate + padding) * 4;
+			out.side_info = 0;
+
+			break;
+		case 2:
+			out.samples = 1152;
+			out.size = 144 * out.bit_rate / out.sample_rate + padding;
+			out.side_info = 0;
+
+			break;
+		default:
+			out.samples = lsf ? 576 : 1152;
+			out.size = (lsf ? 72 : 144) * out.bit_rate / out.sample_rate + padding;
+
+			if(lsf)
+				out.side_info = out.channels == 1 ? 9 : 17;
+			else
+				out.side_info = out.channels == 1 ? 17 : 32;
+			break;
+	}
+
+	return 0;
+}
+
 class xe_mp3_parser : public xe_codec_parser{
 public:
 	xe_mp3_parser(): xe_codec_parser(XE_CODEC_MP3){}
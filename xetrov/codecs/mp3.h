@@ -3,11 +3,35 @@
 
 namespace xetrov{
 
+enum{
+	XE_MPA_HEADER_SIZE = 4
+};
+
+/* mpeg audio frame header, shared by layers I to III */
+struct xe_mpa_header{
+	/* whole frame, header included */
+	uint size;
+	uint layer;
+	/* 0 for mpeg 1, 1 for mpeg 2 and 2 for mpeg 2.5 */
+	uint version;
+	uint sample_rate_index;
+	uint sample_rate;
+	uint bit_rate;
+	uint channels;
+	uint samples;
+	/* bytes of layer III side info after the header and crc */
+	uint side_info;
+	bool crc;
+};
+
 class xe_mp3{
 public:
+	/* decode a big endian frame header, free format frames are rejected */
+	static int parse_header(uint header, xe_mpa_header& out);
+
 	static xe_codec* encoder();
 	static xe_codec* decoder();
 	static xe_codec_parser* parser();
 };
 
-}
\ No newline at end of file
+}
@@ -1,17 +1,105 @@
 #include <opus/opus.h>
+#include <opus/opus_multistream.h>
 #include "opus.h"
 #include "av.h"
 #include "../error.h"
+#include "../pool.h"
 
 using namespace xetrov;
 
-static const AVCodec* opus_decoder = avcodec_find_decoder(AV_CODEC_ID_OPUS);
-static const AVCodec* opus_encoder = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+/* Implementation details
+ * ==============================================================
+ * the native decoder drives libopus directly, decoding each packet
+ * as interleaved floats into a buffer from a frame pool owned by the
+ * decoder, so samples are never copied. each frame still allocates
+ * the small xe_buffer_ref that hands the pooled buffer to the caller
+ *
+ * pre-skip samples are trimmed from the start of the stream, also when
+ * a seek goes back to it. after a seek, xe_format starts the preroll
+ * early so the reset decoder converges, and everything before the target
+ * given to skip_to() is trimmed. trimming moves the frame's data pointer
+ * into the buffer instead of copying
+ *
+ * channels are reordered from vorbis order to the layout order by
+ * permuting the mapping table, so libopus writes them in place
+ *
+ * the native encoder gathers input in a fifo until a frame of the
+ * configured duration is ready, reordering surround input to vorbis
+ * order on the way in, and encodes straight into packet pool slabs.
+ * frames carry no timescale, so packets are timed in input samples
+ * from 0. the OpusHead it writes to the config is what the decoder
+ * needs for the mapping of more than two channels
+ */
 
 enum{
-	XE_OPUS_SAMPLE_RATE = 48000
+	OPUS_HEAD_SIZE = 19,
+	OPUS_HEAD_VERSION = 8,
+	OPUS_HEAD_CHANNELS = 9,
+	OPUS_HEAD_PRE_SKIP = 10,
+	OPUS_HEAD_SAMPLE_RATE = 12,
+	OPUS_HEAD_GAIN = 16,
+	OPUS_HEAD_FAMILY = 18,
+	OPUS_HEAD_STREAMS = 19,
+	OPUS_HEAD_MAPPING = 21,
+	OPUS_MAX_CHANNELS = 255,
+
+	/* 120 ms */
+	OPUS_MAX_FRAME_SAMPLES = 5760,
+	/* three frames of the maximum size and their framing */
+	OPUS_MAX_STREAM_PACKET = 1275 * 3 + 7
+};
+
+/* output channel to vorbis channel, for 1 to 8 channels */
+static const byte vorbis_order[8][8] = {
+	{0},
+	{0, 1},
+	{0, 2, 1},
+	{0, 1, 2, 3},
+	{0, 2, 1, 3, 4},
+	{0, 2, 1, 5, 3, 4},
+	{0, 2, 1, 6, 5, 3, 4},
+	{0, 2, 1, 7, 5, 6, 3, 4}
 };
 
+static const ulong vorbis_layouts[8] = {
+	XE_CH_FRONT_CENTER,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT | XE_CH_FRONT_CENTER,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT | XE_CH_BACK_LEFT | XE_CH_BACK_RIGHT,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT | XE_CH_FRONT_CENTER | XE_CH_BACK_LEFT | XE_CH_BACK_RIGHT,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT | XE_CH_FRONT_CENTER | XE_CH_LOW_FREQUENCY | XE_CH_BACK_LEFT | XE_CH_BACK_RIGHT,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT | XE_CH_FRONT_CENTER | XE_CH_LOW_FREQUENCY | XE_CH_BACK_CENTER | XE_CH_SIDE_LEFT | XE_CH_SIDE_RIGHT,
+	XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT | XE_CH_FRONT_CENTER | XE_CH_LOW_FREQUENCY | XE_CH_BACK_LEFT | XE_CH_BACK_RIGHT | XE_CH_SIDE_LEFT | XE_CH_SIDE_RIGHT
+};
+
+static int opus_error(int err){
+	switch(err){
+		case OPUS_BAD_ARG:
+			return XE_EINVAL;
+		case OPUS_INVALID_PACKET:
+			return XE_INVALID_DATA;
+		case OPUS_ALLOC_FAIL:
+			return XE_ENOMEM;
+		case OPUS_UNIMPLEMENTED:
+			return XE_ENOSYS;
+		default:
+			return XE_EXTERNAL;
+	}
+}
+
+static const AVCodec* opus_decoder = avcodec_find_decoder(AV_CODEC_ID_OPUS);
+static const AVCodec* opus_encoder = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+
+uint xe_opus::packet_samples(xe_cbptr data, size_t size){
+	int samples;
+
+	if(!size)
+		return 0;
+	samples = opus_packet_get_nb_samples(data, size, XE_OPUS_SAMPLE_RATE);
+
+	return samples > 0 ? samples : 0;
+}
+
 class xe_opus_parser : public xe_codec_parser{
 public:
 	xe_opus_parser(): xe_codec_parser(XE_CODEC_OPUS){}
@@ -60,6 +148,520 @@ public:
 	}
 };
 
+class xe_opus_native_decoder : public xe_codec{
+public:
+	OpusMSDecoder* decoder;
+	xe_frame_buffer_pool* pool;
+	xe_buffer_ref buffer;
+	xe_rational timescale;
+	ulong channel_layout;
+	ulong timestamp;
+	ulong duration;
+	/* of the first packet, where pre-skip applies */
+	ulong start;
+	/* samples before this are trimmed after a seek */
+	ulong target;
+	uint channels;
+	uint delay;
+	/* pre-skip samples left to trim */
+	uint skip;
+	uint samples;
+	bool has_frame;
+	bool draining;
+	bool started;
+	bool seeking;
+
+	xe_opus_native_decoder(): xe_codec(XE_CODEC_OPUS){
+		decoder = null;
+		pool = null;
+		has_frame = false;
+		draining = false;
+		started = false;
+		seeking = false;
+	}
+
+	int init(xe_codec_parameters& params){
+		byte mapping[OPUS_MAX_CHANNELS];
+		xe_cbptr head = params.config.data();
+		uint streams, coupled, family = 0;
+		int gain = 0, err;
+
+		channels = params.channels;
+		delay = params.delay;
+
+		if(params.config.size() >= OPUS_HEAD_SIZE){
+			channels = head[OPUS_HEAD_CHANNELS];
+			family = head[OPUS_HEAD_FAMILY];
+			gain = (short)(head[OPUS_HEAD_GAIN] | (head[OPUS_HEAD_GAIN + 1] << 8));
+
+			if(!delay)
+				delay = head[OPUS_HEAD_PRE_SKIP] | (head[OPUS_HEAD_PRE_SKIP + 1] << 8);
+		}
+
+		if(!channels)
+			return XE_INVALID_DATA;
+		if(!family){
+			if(channels > 2)
+				return XE_INVALID_DATA;
+			streams = 1;
+			coupled = channels - 1;
+			mapping[0] = 0;
+			mapping[1] = 1;
+		}else{
+			/* families other than 0 can't be guessed without a header */
+			if(params.config.size() < OPUS_HEAD_MAPPING + channels)
+				return params.config.size() ? (int)XE_INVALID_DATA : (int)XE_ENOSYS;
+			streams = head[OPUS_HEAD_STREAMS];
+			coupled = head[OPUS_HEAD_STREAMS + 1];
+
+			for(uint i = 0; i < channels; i++){
+				if(family == 1 && channels <= 8)
+					mapping[i] = head[OPUS_HEAD_MAPPING + vorbis_order[channels - 1][i]];
+				else
+					mapping[i] = head[OPUS_HEAD_MAPPING + i];
+			}
+		}
+
+		if(family <= 1 && channels <= 8)
+			channel_layout = vorbis_layouts[channels - 1];
+		else
+			channel_layout = params.channel_layout;
+		decoder = opus_multistream_decoder_create(XE_OPUS_SAMPLE_RATE, channels, streams, coupled, mapping, &err);
+
+		if(!decoder)
+			return opus_error(err);
+		if(gain && (err = opus_multistream_decoder_ctl(decoder, OPUS_SET_GAIN(gain))) != OPUS_OK)
+			return opus_error(err);
+		pool = xe_new<xe_frame_buffer_pool>(OPUS_MAX_FRAME_SAMPLES * channels * sizeof(float) + XE_BUFFER_PADDING);
+
+		if(!pool)
+			return XE_ENOMEM;
+		skip = delay;
+
+		return 0;
+	}
+
+	int send_packet(xe_packet& packet){
+		int decoded;
+
+		if(has_frame)
+			return XE_EAGAIN;
+		if(draining)
+			return XE_EOF;
+		if(!packet.size())
+			return XE_INVALID_DATA;
+		if(!pool -> get_buffer(buffer))
+			return XE_ENOMEM;
+		decoded = opus_multistream_decode_float(decoder, packet.data(), packet.size(),
+			(float*)buffer.data(), OPUS_MAX_FRAME_SAMPLES, 0);
+
+		if(decoded < 0){
+			buffer.unref();
+
+			return opus_error(decoded);
+		}
+
+		if(!started){
+			start = packet.timestamp;
+			started = true;
+		}else if(packet.timestamp <= start){
+			/* back at the start of the stream */
+			skip = delay;
+			seeking = false;
+		}
+
+		samples = decoded;
+		timestamp = packet.timestamp;
+		duration = packet.duration;
+		timescale = packet.timescale;
+		has_frame = true;
+
+		return 0;
+	}
+
+	int send_frame(xe_frame& frame){
+		return XE_ENOSYS;
+	}
+
+	int receive_frame(xe_frame& frame){
+		xe_buffer_ref* ref;
+		uint trim;
+
+		if(!has_frame)
+			return draining ? (int)XE_EOF : (int)XE_EAGAIN;
+		has_frame = false;
+		trim = xe_min(skip, samples);
+		skip -= trim;
+
+		if(seeking && timescale.num){
+			/* samples before the seek target */
+			ulong before = timestamp < target ? (target - timestamp) * timescale.num * XE_OPUS_SAMPLE_RATE / timescale.den : 0;
+
+			if(before < samples)
+				seeking = false;
+			trim = xe_max<ulong>(trim, xe_min<ulong>(before, samples));
+		}
+
+		if(trim == samples){
+			buffer.unref();
+
+			return draining ? (int)XE_EOF : (int)XE_EAGAIN;
+		}
+
+		ref = xe_new<xe_buffer_ref>();
+
+		if(!ref){
+			buffer.unref();
+
+			return XE_ENOMEM;
+		}
+
+		ref -> ref(buffer);
+		buffer.unref();
+
+		frame.internal.bufs[0] = ref;
+		frame.internal.data[0] = ref -> data() + trim * channels * sizeof(float);
+		frame.internal.linesize[0] = (samples - trim) * channels * sizeof(float);
+		frame.data = frame.internal.data;
+		frame.samples = samples - trim;
+		frame.channels = channels;
+		frame.sample_rate = XE_OPUS_SAMPLE_RATE;
+		frame.channel_layout = channel_layout;
+		frame.format = XE_SAMPLE_FMT_FLT;
+		frame.flags = 0;
+		frame.timestamp = timestamp;
+		frame.duration = duration;
+
+		if(trim && timescale.num){
+			/* trimmed samples, in the packet's timescale */
+			ulong offset = (ulong)trim * timescale.den / ((ulong)timescale.num * XE_OPUS_SAMPLE_RATE);
+
+			frame.timestamp += offset;
+			frame.duration -= xe_min(offset, frame.duration);
+		}
+
+		return 0;
+	}
+
+	int receive_packet(xe_packet& packet){
+		return XE_ENOSYS;
+	}
+
+	int drain(){
+		draining = true;
+
+		return 0;
+	}
+
+	void flush(){
+		opus_multistream_decoder_ctl(decoder, OPUS_RESET_STATE);
+		buffer.unref();
+		has_frame = false;
+		draining = false;
+		seeking = false;
+
+		/* pre-skip is only owed at the start, which send_packet() notices */
+		if(started)
+			skip = 0;
+	}
+
+	void skip_to(ulong timestamp){
+		target = timestamp;
+		seeking = true;
+	}
+
+	~xe_opus_native_decoder(){
+		buffer.unref();
+
+		if(decoder)
+			opus_multistream_decoder_destroy(decoder);
+		if(pool)
+			pool -> close();
+	}
+};
+
+class xe_opus_native_encoder : public xe_codec{
+public:
+	OpusMSEncoder* encoder;
+	xe_packet_buffer_pool* pool;
+	xe_packet_buffer buffer;
+	/* vorbis position of each input channel, null to keep the order */
+	const byte* order;
+	float* fifo;
+	size_t fifo_size;
+	size_t fifo_samples;
+	ulong timestamp;
+	uint frame_samples;
+	uint sample_rate;
+	uint channels;
+	uint streams;
+	bool draining;
+
+	xe_opus_native_encoder(): xe_codec(XE_CODEC_OPUS){
+		encoder = null;
+		order = null;
+		fifo = null;
+		fifo_samples = 0;
+		timestamp = 0;
+		draining = false;
+	}
+
+	int write_head(xe_codec_parameters& params, uint family, uint coupled, const byte* mapping){
+		size_t size = family ? OPUS_HEAD_MAPPING + channels : (size_t)OPUS_HEAD_SIZE;
+		xe_bptr head;
+
+		if(!params.alloc_config(size))
+			return XE_ENOMEM;
+		head = params.config.data();
+		xe_memcpy(head, "OpusHead", 8);
+		head[OPUS_HEAD_VERSION] = 1;
+		head[OPUS_HEAD_CHANNELS] = channels;
+		head[OPUS_HEAD_PRE_SKIP] = params.delay;
+		head[OPUS_HEAD_PRE_SKIP + 1] = params.delay >> 8;
+		head[OPUS_HEAD_SAMPLE_RATE] = sample_rate;
+		head[OPUS_HEAD_SAMPLE_RATE + 1] = sample_rate >> 8;
+		head[OPUS_HEAD_SAMPLE_RATE + 2] = sample_rate >> 16;
+		head[OPUS_HEAD_SAMPLE_RATE + 3] = sample_rate >> 24;
+		head[OPUS_HEAD_GAIN] = 0;
+		head[OPUS_HEAD_GAIN + 1] = 0;
+		head[OPUS_HEAD_FAMILY] = family;
+
+		if(family){
+			head[OPUS_HEAD_STREAMS] = streams;
+			head[OPUS_HEAD_STREAMS + 1] = coupled;
+			xe_memcpy(head + OPUS_HEAD_MAPPING, mapping, channels);
+		}
+
+		return 0;
+	}
+
+	int init(xe_codec_parameters& params){
+		xe_opus_encoder_options defaults;
+		const xe_opus_encoder_options& options = params.options ? *(xe_opus_encoder_options*)params.options : defaults;
+		byte mapping[OPUS_MAX_CHANNELS];
+		int application, coupled, streams_, lookahead, err;
+		uint family;
+
+		switch(params.sample_rate){
+			case 8000:
+			case 12000:
+			case 16000:
+			case 24000:
+			case 48000:
+				break;
+			default:
+				return XE_EINVAL;
+		}
+
+		switch(options.frame_duration){
+			case 2500:
+			case 5000:
+			case 10000:
+			case 20000:
+			case 40000:
+			case 60000:
+				break;
+			default:
+				return XE_EINVAL;
+		}
+
+		switch(options.application){
+			case XE_OPUS_APPLICATION_AUDIO:
+				application = OPUS_APPLICATION_AUDIO;
+
+				break;
+			case XE_OPUS_APPLICATION_VOIP:
+				application = OPUS_APPLICATION_VOIP;
+
+				break;
+			case XE_OPUS_APPLICATION_LOWDELAY:
+				application = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+
+				break;
+			default:
+				return XE_EINVAL;
+		}
+
+		/* other sample formats are left to libavcodec */
+		if(params.format != XE_SAMPLE_FMT_FLT)
+			return XE_ENOSYS;
+		if(!params.channels || params.channels > OPUS_MAX_CHANNELS)
+			return XE_EINVAL;
+		if(options.complexity > 10)
+			return XE_EINVAL;
+		channels = params.channels;
+		sample_rate = params.sample_rate;
+		pool = options.pool;
+		frame_samples = (ulong)sample_rate * options.frame_duration / 1'000'000;
+
+		if(channels <= 2){
+			mapping[0] = 0;
+			mapping[1] = 1;
+			streams = 1;
+			coupled = channels - 1;
+			family = 0;
+			encoder = opus_multistream_encoder_create(sample_rate, channels, 1, coupled, mapping, application, &err);
+		}else{
+			/* libopus picks the streams and expects vorbis order up to 8 channels */
+			family = channels <= 8 ? 1 : 255;
+			encoder = opus_multistream_surround_encoder_create(sample_rate, channels, family,
+				&streams_, &coupled, mapping, application, &err);
+			streams = streams_;
+
+			if(channels <= 8)
+				order = vorbis_order[channels - 1];
+		}
+
+		if(!encoder)
+			return opus_error(err);
+		err = opus_multistream_encoder_ctl(encoder, OPUS_SET_BITRATE(params.bit_rate ? (int)params.bit_rate : OPUS_AUTO));
+
+		if(!err && options.complexity >= 0)
+			err = opus_multistream_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(options.complexity));
+		if(!err)
+			err = opus_multistream_encoder_ctl(encoder, OPUS_SET_VBR(options.vbr));
+		if(!err && options.vbr)
+			err = opus_multistream_encoder_ctl(encoder, OPUS_SET_VBR_CONSTRAINT(options.constrained_vbr));
+		if(!err)
+			err = opus_multistream_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(options.fec));
+		if(!err && options.fec)
+			err = opus_multistream_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(options.packet_loss));
+		if(!err)
+			err = opus_multistream_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+		if(err)
+			return opus_error(err);
+		fifo_size = frame_samples;
+		fifo = xe_alloc<float>(fifo_size * channels);
+
+		if(!fifo)
+			return XE_ENOMEM;
+		/* pre-skip is always counted at 48 khz */
+		params.delay = lookahead * (XE_OPUS_SAMPLE_RATE / sample_rate);
+		params.frame_size = frame_samples;
+
+		return write_head(params, family, coupled, mapping);
+	}
+
+	int send_packet(xe_packet& packet){
+		return XE_ENOSYS;
+	}
+
+	int send_frame(xe_frame& frame){
+		const float* in;
+		float* out;
+		size_t needed;
+
+		if(draining)
+			return XE_EOF;
+		if(frame.format != XE_SAMPLE_FMT_FLT || frame.channels != channels || frame.sample_rate != sample_rate)
+			return XE_EINVAL;
+		/* packets must be taken out before more input is buffered */
+		if(fifo_samples >= frame_samples)
+			return XE_EAGAIN;
+		needed = fifo_samples + frame.samples;
+
+		if(needed > fifo_size){
+			out = xe_realloc<float>(fifo, needed * channels);
+
+			if(!out)
+				return XE_ENOMEM;
+			fifo = out;
+			fifo_size = needed;
+		}
+
+		in = (const float*)frame.data[0];
+		out = fifo + fifo_samples * channels;
+
+		if(order){
+			for(size_t i = 0; i < frame.samples; i++, in += channels, out += channels){
+				for(uint c = 0; c < channels; c++)
+					out[order[c]] = in[c];
+			}
+		}else{
+			xe_memcpy(out, in, (size_t)frame.samples * channels * sizeof(float));
+		}
+
+		fifo_samples = needed;
+
+		return 0;
+	}
+
+	int receive_frame(xe_frame& frame){
+		return XE_ENOSYS;
+	}
+
+	int receive_packet(xe_packet& packet){
+		size_t samples = xe_min<size_t>(fifo_samples, frame_samples), size = streams * OPUS_MAX_STREAM_PACKET;
+		xe_bptr data;
+		int encoded;
+
+		if(fifo_samples < frame_samples){
+			if(!draining || !fifo_samples)
+				return draining ? (int)XE_EOF : (int)XE_EAGAIN;
+			/* pad the last frame with silence */
+			xe_zero(fifo + fifo_samples * channels, (frame_samples - fifo_samples) * channels);
+		}
+
+		if(pool){
+			if(!buffer.has(size) && !pool -> get_buffer(buffer, size))
+				return XE_ENOMEM;
+			data = buffer.tail();
+		}else{
+			if(!packet.ref.create(size + XE_BUFFER_PADDING, null, null))
+				return XE_ENOMEM;
+			data = packet.ref.data();
+		}
+
+		encoded = opus_multistream_encode_float(encoder, fifo, frame_samples, data, size);
+
+		if(encoded < 0){
+			if(!pool)
+				packet.unref();
+			return opus_error(encoded);
+		}
+
+		if(pool){
+			buffer.alloc(packet, encoded);
+		}else{
+			xe_zero(data + encoded, XE_BUFFER_PADDING);
+
+			packet.buffer = xe_array<byte>(data, encoded);
+		}
+
+		packet.timestamp = timestamp;
+		packet.duration = samples;
+		packet.timescale = sample_rate;
+		packet.flags = XE_PACKET_FLAG_KEY;
+		timestamp += samples;
+		fifo_samples -= samples;
+
+		if(fifo_samples)
+			xe_memmove(fifo, fifo + frame_samples * channels, fifo_samples * channels * sizeof(float));
+		return 0;
+	}
+
+	int drain(){
+		draining = true;
+
+		return 0;
+	}
+
+	void flush(){
+		opus_multistream_encoder_ctl(encoder, OPUS_RESET_STATE);
+		fifo_samples = 0;
+		timestamp = 0;
+		draining = false;
+	}
+
+	~xe_opus_native_encoder(){
+		buffer.unref();
+
+		if(encoder)
+			opus_multistream_encoder_destroy(encoder);
+		xe_dealloc(fifo);
+	}
+};
+
 xe_codec* xe_opus::encoder(){
 	return xe_new<xe_opus_encoder>();
 }
@@ -68,6 +670,14 @@ xe_codec* xe_opus::decoder(){
 	return xe_new<xe_opus_decoder>();
 }
 
+xe_codec* xe_opus::native_encoder(){
+	return xe_new<xe_opus_native_encoder>();
+}
+
+xe_codec* xe_opus::native_decoder(){
+	return xe_new<xe_opus_native_decoder>();
+}
+
 xe_codec_parser* xe_opus::parser(){
 	return &opus_parser;
 }
\ No newline at end of file
@@ -3,10 +3,59 @@
 
 namespace xetrov{
 
+enum{
+	XE_OPUS_SAMPLE_RATE = 48000,
+	/* 80 ms, recommended by rfc 7845 when the container does not say */
+	XE_OPUS_DEFAULT_PREROLL = 3840
+};
+
+enum xe_opus_application{
+	XE_OPUS_APPLICATION_AUDIO = 0,
+	XE_OPUS_APPLICATION_VOIP,
+	XE_OPUS_APPLICATION_LOWDELAY
+};
+
+class xe_packet_buffer_pool;
+
+/* settings for the native encoder, passed through xe_codec_parameters::options */
+struct xe_opus_encoder_options{
+	xe_opus_application application;
+	/* 0 to 10, or -1 for the libopus default */
+	int complexity;
+	/* in microseconds, one of 2500, 5000, 10000, 20000, 40000 or 60000 */
+	uint frame_duration;
+	bool vbr;
+	/* only with vbr */
+	bool constrained_vbr;
+	/* in-band forward error correction, tuned for this packet loss percentage */
+	bool fec;
+	uint packet_loss;
+	/* packets come from this pool when set, it must outlive the packets */
+	xe_packet_buffer_pool* pool;
+
+	xe_opus_encoder_options(){
+		application = XE_OPUS_APPLICATION_AUDIO;
+		complexity = -1;
+		frame_duration = 20000;
+		vbr = true;
+		constrained_vbr = false;
+		fec = false;
+		packet_loss = 0;
+		pool = null;
+	}
+};
+
 class xe_opus{
 public:
+	/* samples at 48 khz in a packet, 0 if it is invalid */
+	static uint packet_samples(xe_cbptr data, size_t size);
+
 	static xe_codec* encoder();
+	/* encodes with libopus directly, configured by xe_opus_encoder_options */
+	static xe_codec* native_encoder();
 	static xe_codec* decoder();
+	/* decodes with libopus directly instead of through libavcodec */
+	static xe_codec* native_decoder();
 	static xe_codec_parser* parser();
 };
 
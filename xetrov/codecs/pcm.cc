@@ -0,0 +1,235 @@
+#include <byteswap.h>
+#include "pcm.h"
+#include "../error.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+uint xe_pcm::sample_size(xe_codec_id id){
+	switch(id){
+		case XE_CODEC_PCM_U8:
+		case XE_CODEC_PCM_S8:
+			return 1;
+		case XE_CODEC_PCM_S16LE:
+		case XE_CODEC_PCM_S16BE:
+			return 2;
+		case XE_CODEC_PCM_S24LE:
+		case XE_CODEC_PCM_S24BE:
+			return 3;
+		case XE_CODEC_PCM_S32LE:
+		case XE_CODEC_PCM_S32BE:
+		case XE_CODEC_PCM_F32LE:
+		case XE_CODEC_PCM_F32BE:
+			return 4;
+		case XE_CODEC_PCM_F64LE:
+		case XE_CODEC_PCM_F64BE:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+xe_audio_sample_fmt xe_pcm::sample_format(xe_codec_id id){
+	switch(id){
+		case XE_CODEC_PCM_U8:
+		case XE_CODEC_PCM_S8:
+			return XE_SAMPLE_FMT_U8;
+		case XE_CODEC_PCM_S16LE:
+		case XE_CODEC_PCM_S16BE:
+			return XE_SAMPLE_FMT_S16;
+		case XE_CODEC_PCM_S24LE:
+		case XE_CODEC_PCM_S24BE:
+		case XE_CODEC_PCM_S32LE:
+		case XE_CODEC_PCM_S32BE:
+			return XE_SAMPLE_FMT_S32;
+		case XE_CODEC_PCM_F32LE:
+		case XE_CODEC_PCM_F32BE:
+			return XE_SAMPLE_FMT_FLT;
+		case XE_CODEC_PCM_F64LE:
+		case XE_CODEC_PCM_F64BE:
+			return XE_SAMPLE_FMT_DBL;
+		default:
+			return XE_SAMPLE_FMT_NONE;
+	}
+}
+
+template<typename T, T (*swap)(T)>
+static void swap_samples(xe_bptr data, size_t count){
+	T value;
+
+	for(size_t i = 0; i < count; i++){
+		xe_memcpy(&value, data + i * sizeof(T), sizeof(T));
+
+		value = swap(value);
+
+		xe_memcpy(data + i * sizeof(T), &value, sizeof(T));
+	}
+}
+
+static ushort swap16(ushort value){
+	return bswap_16(value);
+}
+
+static uint swap32(uint value){
+	return bswap_32(value);
+}
+
+static ulong swap64(ulong value){
+	return bswap_64(value);
+}
+
+int xe_pcm::frame(xe_packet& packet, const xe_codec_parameters& params, xe_frame& frame){
+	uint size = sample_size(params.id), out_size = size;
+	size_t count, samples;
+	xe_buffer_ref* ref;
+	xe_cbptr in;
+	xe_bptr data;
+	uint* out;
+
+	if(!size || !params.channels)
+		return XE_EINVAL;
+	samples = packet.size() / (size * params.channels);
+	count = samples * params.channels;
+	data = packet.data();
+	ref = xe_new<xe_buffer_ref>();
+
+	if(!ref)
+		return XE_ENOMEM;
+	switch(params.id){
+		case XE_CODEC_PCM_S8:
+			for(size_t i = 0; i < count; i++)
+				data[i] ^= 0x80;
+			break;
+		case XE_CODEC_PCM_S16BE:
+			swap_samples<ushort, swap16>(data, count);
+
+			break;
+		case XE_CODEC_PCM_S32BE:
+		case XE_CODEC_PCM_F32BE:
+			swap_samples<uint, swap32>(data, count);
+
+			break;
+		case XE_CODEC_PCM_F64BE:
+			swap_samples<ulong, swap64>(data, count);
+
+			break;
+		case XE_CODEC_PCM_S24LE:
+		case XE_CODEC_PCM_S24BE:
+			/* widen into the top of 32 bit samples */
+			out_size = 4;
+
+			if(!ref -> create(count * out_size + XE_BUFFER_PADDING, null, null)){
+				xe_delete(ref);
+
+				return XE_ENOMEM;
+			}
+
+			in = data;
+			out = (uint*)ref -> data();
+
+			if(params.id == XE_CODEC_PCM_S24LE){
+				for(size_t i = 0; i < count; i++, in += 3)
+					out[i] = (in[0] << 8) | (in[1] << 16) | ((uint)in[2] << 24);
+			}else{
+				for(size_t i = 0; i < count; i++, in += 3)
+					out[i] = (in[2] << 8) | (in[1] << 16) | ((uint)in[0] << 24);
+			}
+
+			data = ref -> data();
+
+			break;
+		default:
+			break;
+	}
+
+	if(out_size == size)
+		ref -> ref(packet.ref);
+	frame.internal.bufs[0] = ref;
+	frame.internal.data[0] = data;
+	frame.internal.linesize[0] = count * out_size;
+	frame.data = frame.internal.data;
+	frame.samples = samples;
+	frame.channels = params.channels;
+	frame.sample_rate = params.sample_rate;
+	frame.channel_layout = params.channel_layout ? params.channel_layout : xe_default_channel_layout(params.channels);
+	frame.format = sample_format(params.id);
+	frame.timestamp = packet.timestamp;
+	frame.duration = packet.duration;
+	frame.flags = 0;
+
+	return 0;
+}
+
+class xe_pcm_decoder : public xe_codec{
+public:
+	xe_codec_parameters params;
+	xe_packet pending;
+	bool has_pending;
+	bool draining;
+
+	xe_pcm_decoder(): xe_codec(XE_CODEC_NONE){
+		has_pending = false;
+		draining = false;
+	}
+
+	int init(xe_codec_parameters& params_){
+		if(!xe_pcm::sample_size(params_.id) || !params_.channels)
+			return XE_EINVAL;
+		id_ = params_.id;
+		params = params_;
+		/* the config isn't needed, and isn't ours */
+		params.config = xe_array<byte>();
+
+		return 0;
+	}
+
+	int send_packet(xe_packet& packet){
+		if(has_pending)
+			return XE_EAGAIN;
+		if(draining)
+			return XE_EOF;
+		pending.ref.ref(packet.ref);
+		pending.buffer = packet.buffer;
+		pending.timestamp = packet.timestamp;
+		pending.duration = packet.duration;
+		has_pending = true;
+
+		return 0;
+	}
+
+	int send_frame(xe_frame& frame){
+		return XE_ENOSYS;
+	}
+
+	int receive_frame(xe_frame& frame){
+		int err;
+
+		if(!has_pending)
+			return draining ? (int)XE_EOF : (int)XE_EAGAIN;
+		err = xe_pcm::frame(pending, params, frame);
+		has_pending = false;
+		pending.unref();
+
+		return err;
+	}
+
+	int receive_packet(xe_packet& packet){
+		return XE_ENOSYS;
+	}
+
+	int drain(){
+		draining = true;
+
+		return 0;
+	}
+
+	void flush(){
+		pending.unref();
+		has_pending = false;
+		draining = false;
+	}
+};
+
+xe_codec* xe_pcm::decoder(){
+	return xe_new<xe_pcm_decoder>();
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "../codec.h"
+
+namespace xetrov{
+
+class xe_pcm{
+public:
+	/* bytes per sample as stored */
+	static uint sample_size(xe_codec_id id);
+	/* sample format of the frames made from packets */
+	static xe_audio_sample_fmt sample_format(xe_codec_id id);
+
+	/* make an interleaved frame that references the packet's buffer,
+	 * byte order and 8 bit signedness are converted in place and
+	 * only 24 bit samples are widened into a new buffer */
+	static int frame(xe_packet& packet, const xe_codec_parameters& params, xe_frame& frame);
+
+	static xe_codec* decoder();
+};
+
+}
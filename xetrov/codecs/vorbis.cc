@@ -4,23 +4,157 @@
 
 using namespace xetrov;
 
+/* Implementation details
+ * ==============================================================
+ * a packet's duration depends on its block size and the previous
+ * packet's, and the block size comes from the mode number in its
+ * first byte. the mode count is coded before the modes in the setup
+ * header, after codebooks whose size can only be known by decoding
+ * them, so the modes are found from the end of the header instead:
+ * each is 41 bits with zero window and transform types, and the
+ * mode count before the last candidate must match the number found
+ */
+
+enum{
+	VORBIS_ID_SIZE = 30,
+	VORBIS_ID_BLOCK_SIZES = 28,
+	VORBIS_HEADERS = 3,
+	/* block flag, window type, transform type and mapping */
+	MODE_BITS = 1 + 16 + 16 + 8
+};
+
 static const AVCodec* vorbis_decoder = avcodec_find_decoder(AV_CODEC_ID_VORBIS);
 static const AVCodec* vorbis_encoder = avcodec_find_encoder(AV_CODEC_ID_VORBIS);
 
+/* vorbis packs bits from the least significant */
+static uint read_bits(xe_cbptr data, size_t pos, uint len){
+	uint value = 0;
+
+	for(uint i = 0; i < len; i++)
+		value |= ((data[(pos + i) >> 3] >> ((pos + i) & 0x7)) & 0x1) << i;
+	return value;
+}
+
+static int parse_modes(xe_cbptr data, size_t size, xe_vorbis_info& info){
+	size_t end = size << 3, pos;
+	uint count = 0, modes = 0;
+
+	/* the framing bit is the last one set */
+	while(end && !read_bits(data, end - 1, 1))
+		end--;
+	if(!end)
+		return XE_INVALID_DATA;
+	end--;
+	pos = end;
+
+	while(pos >= MODE_BITS + 6 && count < XE_VORBIS_MAX_MODES){
+		pos -= MODE_BITS;
+
+		if(read_bits(data, pos + 1, 16) || read_bits(data, pos + 17, 16) || read_bits(data, pos + 33, 8) > 63)
+			break;
+		count++;
+
+		if(read_bits(data, pos - 6, 6) + 1 == count)
+			modes = count;
+	}
+
+	if(!modes)
+		return XE_INVALID_DATA;
+	pos = end - modes * MODE_BITS;
+
+	for(uint i = 0; i < modes; i++)
+		info.block_flags[i] = read_bits(data, pos + i * MODE_BITS, 1);
+	info.modes = modes;
+	info.mode_bits = 0;
+
+	while((1u << info.mode_bits) < modes)
+		info.mode_bits++;
+	return 0;
+}
+
+int xe_vorbis::parse_config(xe_cbptr data, size_t size, xe_vorbis_info& info){
+	size_t sizes[VORBIS_HEADERS - 1], offset = 1;
+	byte block_sizes;
+
+	info.modes = 0;
+
+	if(!size || data[0] != VORBIS_HEADERS - 1)
+		return XE_INVALID_DATA;
+	for(uint i = 0; i < VORBIS_HEADERS - 1; i++){
+		sizes[i] = 0;
+
+		while(offset < size && data[offset] == 255)
+			sizes[i] += data[offset++];
+		if(offset >= size)
+			return XE_INVALID_DATA;
+		sizes[i] += data[offset++];
+	}
+
+	if(sizes[0] < VORBIS_ID_SIZE || offset + sizes[0] + sizes[1] >= size)
+		return XE_INVALID_DATA;
+	block_sizes = data[offset + VORBIS_ID_BLOCK_SIZES];
+	info.block_sizes[0] = 1 << (block_sizes & 0xf);
+	info.block_sizes[1] = 1 << (block_sizes >> 4);
+	offset += sizes[0] + sizes[1];
+
+	return parse_modes(data + offset, size - offset, info);
+}
+
+uint xe_vorbis::block_size(const xe_vorbis_info& info, xe_cbptr data, size_t size){
+	uint mode;
+
+	/* header packets have the low bit set */
+	if(!info.modes || !size || (data[0] & 0x1))
+		return 0;
+	mode = (data[0] >> 1) & ((1 << info.mode_bits) - 1);
+
+	if(mode >= info.modes)
+		return 0;
+	return info.block_sizes[info.block_flags[mode]];
+}
+
 class xe_vorbis_parser : public xe_codec_parser{
 public:
-	xe_vorbis_parser(): xe_codec_parser(XE_CODEC_VORBIS){}
+	xe_vorbis_info info;
+	uint sample_rate;
+	uint last_size;
+
+	xe_vorbis_parser(): xe_codec_parser(XE_CODEC_VORBIS){
+		info.modes = 0;
+		sample_rate = 0;
+		last_size = 0;
+	}
 
 	int init(xe_codec_parameters& params){
+		sample_rate = params.sample_rate;
+
+		/* without the headers packets are passed through untimed */
+		xe_vorbis::parse_config(params.config.data(), params.config.size(), info);
+
 		return 0;
 	}
 
 	int parse(xe_packet& packet){
+		uint size = xe_vorbis::block_size(info, packet.data(), packet.size());
+
+		if(!size || !sample_rate)
+			return 0;
+		/* a packet completes the overlap with the one before it */
+		packet.timescale = sample_rate;
+		packet.duration = last_size ? last_size / 4 + size / 4 : 0;
+		last_size = size;
+
 		return 0;
 	}
-};
 
-static xe_vorbis_parser vorbis_parser;
+	void reset(){
+		last_size = 0;
+	}
+
+	void close(){
+		xe_delete(this);
+	}
+};
 
 class xe_vorbis_encoder : public xe_av_codec{
 public:
@@ -53,5 +187,5 @@ xe_codec* xe_vorbis::decoder(){
 }
 
 xe_codec_parser* xe_vorbis::parser(){
-	return &vorbis_parser;
+	return xe_new<xe_vorbis_parser>();
 }
\ No newline at end of file
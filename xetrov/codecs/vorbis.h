@@ -3,11 +3,30 @@
 
 namespace xetrov{
 
+enum{
+	XE_VORBIS_MAX_MODES = 64
+};
+
+/* what packet durations need from the identification and setup headers */
+struct xe_vorbis_info{
+	uint block_sizes[2];
+	byte block_flags[XE_VORBIS_MAX_MODES];
+	/* 0 if the headers couldn't be read */
+	uint modes;
+	uint mode_bits;
+};
+
 class xe_vorbis{
 public:
+	/* read the block sizes and mode flags from a xiph laced config */
+	static int parse_config(xe_cbptr data, size_t size, xe_vorbis_info& info);
+
+	/* block size of an audio packet, 0 for headers and unreadable packets */
+	static uint block_size(const xe_vorbis_info& info, xe_cbptr data, size_t size);
+
 	static xe_codec* encoder();
 	static xe_codec* decoder();
 	static xe_codec_parser* parser();
 };
 
-}
\ No newline at end of file
+}
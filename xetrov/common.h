@@ -1,5 +1,6 @@
 #pragma once
 #include "xe/common.h"
+#include "xe/container/vector.h"
 
 namespace xetrov{
 
@@ -12,4 +13,18 @@ static constexpr uint xe_log2(ulong value){
 	return value ? sizeof(ulong) * 8 - __builtin_clzl(value) - 1 : 0;
 }
 
+/* keeps list sorted by descending priority, placing entry in front of equal priorities */
+template<typename T>
+static bool xe_insert_by_priority(xe_vector<T>& list, const T& entry){
+	size_t i;
+
+	if(!list.push_back(entry))
+		return false;
+	for(i = list.size() - 1; i > 0 && list[i - 1].priority <= entry.priority; i--)
+		list[i] = list[i - 1];
+	list[i] = entry;
+
+	return true;
+}
+
 }
\ No newline at end of file
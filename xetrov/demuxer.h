@@ -31,12 +31,32 @@ public:
 	virtual ~xe_demuxer(){}
 };
 
+enum xe_probe_score{
+	XE_PROBE_SCORE_NONE = 0,
+	/* matches, but too little of the stream was in the window to verify */
+	XE_PROBE_SCORE_WEAK = 25,
+	XE_PROBE_SCORE_LIKELY = 75,
+	XE_PROBE_SCORE_MAX = 100
+};
+
+/* the start of the stream, peeked once and shared by every probe */
+struct xe_probe_data{
+	/* followed by XE_BUFFER_PADDING zeroed bytes */
+	xe_cbptr data;
+	size_t size;
+};
+
 class xe_demuxer_class{
 public:
 	xe_demuxer_class(){}
 
 	virtual xe_demuxer* create(xe_format::xe_context& context) const = 0;
-	virtual bool probe(xe_reader& reader) const = 0;
+	/* between XE_PROBE_SCORE_NONE and XE_PROBE_SCORE_MAX */
+	virtual uint probe(const xe_probe_data& probe) const = 0;
+
+	/* comma separated, matched against the hints given to xe_format */
+	virtual xe_cstr extensions() const = 0;
+	virtual xe_cstr mime_types() const = 0;
 
 	virtual ~xe_demuxer_class(){}
 };
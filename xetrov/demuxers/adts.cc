@@ -0,0 +1,217 @@
+#include "../format.h"
+#include "../demuxer.h"
+#include "../error.h"
+#include "../codecs/aac.h"
+#include "adts.h"
+#include "tags.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * a bare stream of adts frames, as served by most aac internet radio
+ *
+ * frames are handed out whole, header included, since the decoder
+ * understands adts. the first header decides the stream's parameters
+ * and later headers must agree with it, which keeps resyncing after
+ * corrupt data or a seek from locking onto a false sync word
+ *
+ * there is no index, so seeking estimates a byte offset from the
+ * average frame size seen so far and resyncs from there
+ */
+
+enum{
+	/* give up if no frame header is found in this many bytes */
+	RESYNC_LIMIT = 0x10000,
+	/* header bytes are decoded with the bit reader, which may load past them */
+	HEADER_BUFFER_SIZE = XE_ADTS_HEADER_SIZE + 16
+};
+
+static int read_id3(xe_reader& reader, ulong& size){
+	byte tag[XE_ID3_HEADER_SIZE];
+
+	size = 0;
+	reader.peek_mode(true);
+	reader.read(tag, sizeof(tag));
+	reader.peek_mode(false);
+
+	if(reader.error())
+		return reader.error();
+	if(xe_is_id3(tag))
+		size = xe_id3_size(tag);
+	return 0;
+}
+
+class xe_adts : public xe_demuxer{
+public:
+	xe_track* track;
+	xe_adts_header first;
+
+	ulong data_offset;
+	ulong sample_time;
+
+	/* totals for estimating seek offsets */
+	ulong frame_bytes;
+	ulong frame_samples;
+
+	byte header[HEADER_BUFFER_SIZE];
+
+	xe_adts(xe_format::xe_context& context): xe_demuxer(context){}
+
+	bool matches(const xe_adts_header& header){
+		return header.profile == first.profile && header.sample_rate_index == first.sample_rate_index &&
+			header.channel_config == first.channel_config;
+	}
+
+	int read_header(xe_adts_header& out, bool any = false);
+
+	int open();
+	int seek(uint stream, ulong pos);
+	int read_packet(xe_packet& packet);
+
+	void reset(){}
+
+	~xe_adts();
+};
+
+int xe_adts::read_header(xe_adts_header& out, bool any){
+	xe_reader& reader = context -> reader;
+	uint skipped = 0;
+
+	if(reader.read(header, XE_ADTS_HEADER_SIZE))
+		return reader.error();
+	while(xe_aac::parse_adts(header, XE_ADTS_HEADER_SIZE, out) || (!any && !matches(out))){
+		/* lost sync, slide forward a byte at a time */
+		if(++skipped > RESYNC_LIMIT)
+			return XE_INVALID_DATA;
+		xe_memmove(header, header + 1, XE_ADTS_HEADER_SIZE - 1);
+
+		header[XE_ADTS_HEADER_SIZE - 1] = reader.r8();
+
+		if(reader.error())
+			return reader.error();
+	}
+
+	return 0;
+}
+
+int xe_adts::open(){
+	xe_reader& reader = context -> reader;
+	ulong tag;
+	int err;
+
+	if((err = read_id3(reader, tag)) || (err = reader.skip(tag)))
+		return err;
+	track = xe_zalloc<xe_track>();
+
+	if(!track)
+		return XE_ENOMEM;
+	if(!context -> tracks.resize(1))
+		return XE_ENOMEM;
+	context -> tracks[0] = track;
+
+	/* the first frame is read again by read_packet */
+	reader.peek_mode(true);
+	err = read_header(first, true);
+	reader.peek_mode(false);
+
+	if(err)
+		return err;
+	data_offset = reader.offset();
+	track -> type = XE_TRACK_TYPE_AUDIO;
+	track -> codec.id = XE_CODEC_AAC;
+	track -> timescale = first.sample_rate;
+
+	return xe_aac::adts_config(first, track -> codec);
+}
+
+int xe_adts::seek(uint stream, ulong pos){
+	xe_reader& reader = context -> reader;
+	ulong offset;
+	int err;
+
+	if(stream)
+		return XE_EINVAL;
+	offset = data_offset;
+
+	if(pos){
+		if(frame_samples)
+			offset += (ulong)((double)pos * frame_bytes / frame_samples);
+		else
+			offset += (ulong)((double)pos * first.size / (first.blocks * XE_AAC_FRAME_SIZE));
+	}
+
+	if((err = reader.seek(offset)))
+		return err;
+	/* timestamps after an estimated seek are as good as the estimate */
+	sample_time = pos;
+
+	return 0;
+}
+
+int xe_adts::read_packet(xe_packet& packet){
+	xe_reader& reader = context -> reader;
+	xe_adts_header frame;
+	int err;
+
+	if((err = read_header(frame)))
+		return err;
+	if(!alloc_packet(packet, frame.size))
+		return XE_ENOMEM;
+	xe_memcpy(packet.data(), header, XE_ADTS_HEADER_SIZE);
+	reader.read(packet.data() + XE_ADTS_HEADER_SIZE, frame.size - XE_ADTS_HEADER_SIZE);
+
+	packet.timestamp = sample_time;
+	packet.duration = (ulong)frame.blocks * XE_AAC_FRAME_SIZE;
+	packet.timescale = frame.sample_rate;
+	packet.flags = XE_PACKET_FLAG_KEY;
+	packet.track = 0;
+	sample_time += packet.duration;
+	frame_bytes += frame.size;
+	frame_samples += packet.duration;
+
+	return reader.error();
+}
+
+xe_adts::~xe_adts(){
+	if(!track)
+		return;
+	xe_dealloc(track -> codec.config.data());
+	xe_dealloc(track);
+}
+
+xe_demuxer* xe_adts_class::create(xe_format::xe_context& context) const{
+	return xe_znew<xe_adts>(context);
+}
+
+uint xe_adts_class::probe(const xe_probe_data& probe) const{
+	xe_adts_header first, next;
+	ulong offset = 0;
+	uint frames = 0;
+
+	if(probe.size >= XE_ID3_HEADER_SIZE && xe_is_id3(probe.data))
+		offset = xe_id3_size(probe.data);
+	/* the window's padding covers the bit reader loading past the header */
+	while(offset + XE_ADTS_HEADER_SIZE <= probe.size){
+		if(xe_aac::parse_adts(probe.data + offset, XE_ADTS_HEADER_SIZE, next) || next.size < XE_ADTS_HEADER_SIZE)
+			break;
+		if(!frames)
+			first = next;
+		else if(next.sample_rate_index != first.sample_rate_index || next.channel_config != first.channel_config)
+			break;
+		frames++;
+		offset += next.size;
+	}
+
+	/* a single sync word is weak, each frame that follows adds confidence */
+	return xe_min(frames * XE_PROBE_SCORE_WEAK, (uint)XE_PROBE_SCORE_MAX);
+}
+
+xe_cstr xe_adts_class::extensions() const{
+	return "aac,adts";
+}
+
+xe_cstr xe_adts_class::mime_types() const{
+	return "audio/aac,audio/aacp,audio/x-aac";
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "../demuxer.h"
+
+namespace xetrov{
+
+class xe_adts_class : public xe_demuxer_class{
+public:
+	xe_adts_class(){}
+
+	xe_demuxer* create(xe_format::xe_context& context) const;
+	uint probe(const xe_probe_data& probe) const;
+
+	xe_cstr extensions() const;
+	xe_cstr mime_types() const;
+
+	~xe_adts_class(){}
+};
+
+}
@@ -5,6 +5,7 @@
 #include "isom.h"
 #include "xe/log.h"
 #include "xe/container/vector.h"
+#include <stdlib.h>
 
 using namespace xetrov;
 
@@ -39,12 +40,14 @@ enum xe_fourcc{
 	FOURCC_TRUN = xe_make_fourcc("trun"),
 	FOURCC_MOOF = xe_make_fourcc("moof"),
 	FOURCC_MDAT = xe_make_fourcc("mdat"),
+	FOURCC_MFRA = xe_make_fourcc("mfra"),
+	FOURCC_TFRA = xe_make_fourcc("tfra"),
 
 	/* unused top-level boxes */
 	FOURCC_FTYP = xe_make_fourcc("ftyp"),
 	FOURCC_PDIN = xe_make_fourcc("pdin"),
 	FOURCC_BLOC = xe_make_fourcc("bloc"),
-	FOURCC_MFRA = xe_make_fourcc("mfra"),
+	FOURCC_MFRO = xe_make_fourcc("mfro"),
 	FOURCC_FREE = xe_make_fourcc("free"),
 	FOURCC_SKIP = xe_make_fourcc("skip"),
 	FOURCC_META = xe_make_fourcc("meta"),
@@ -108,6 +111,75 @@ enum xe_sample_redundant{
 	SAMPLE_REDUNDANT_RESERVED = 0x3
 };
 
+/* Sample index
+ * ==============================================================
+ * built once per track right after its sample tables are read, after
+ * which the raw stts, stsc, stsz, stco and stss tables are freed
+ *
+ * - sample sizes are stored as a varint per sample, or not at all
+ *   if stsz has a constant size
+ * - chunk offsets are stored as a zigzag varint per chunk, relative
+ *   to the end of the previous chunk, so interleaved files mostly
+ *   need one or two bytes per chunk
+ * - timestamps stay run-length coded like stts, with the start time
+ *   and sample of every run for seeking
+ * - sync samples are a bitset, empty if every sample is a sync sample
+ * - every INDEX_INTERVAL samples a checkpoint of the cursor is stored
+ *   so a seek decodes at most INDEX_INTERVAL - 1 sizes
+ *
+ * memory bound: at most 5 bytes of size, 1 bit of sync flag and
+ * 32 / INDEX_INTERVAL bytes of checkpoint per sample, 10 bytes per
+ * chunk and 24 bytes per stts or stsc entry. a typical audio track
+ * costs under 3 bytes per sample
+ */
+enum{
+	INDEX_INTERVAL = 64
+};
+
+struct xe_isom_index{
+	struct time_run{
+		ulong time;
+		uint sample;
+		uint count;
+		uint delta;
+	};
+
+	struct chunk_run{
+		uint chunk;
+		uint sample;
+		uint count;
+	};
+
+	struct checkpoint{
+		ulong offset;
+		uint sizes;
+		uint offsets;
+		uint chunk;
+		uint chunk_left;
+		uint chunk_run;
+	};
+
+	xe_array<time_run> times;
+	xe_array<chunk_run> chunks;
+	xe_array<byte> sizes;
+	xe_array<byte> offsets;
+	xe_array<ulong> sync;
+	xe_array<checkpoint> checkpoints;
+
+	uint sample_count;
+	uint chunk_count;
+
+	void free(){
+		xe_dealloc(times.data());
+		xe_dealloc(chunks.data());
+		xe_dealloc(sizes.data());
+		xe_dealloc(offsets.data());
+		xe_dealloc(sync.data());
+		xe_dealloc(checkpoints.data());
+		xe_zero(this);
+	}
+};
+
 struct xe_isom_track : public xe_track{
 	uint id;
 	uint default_sample_duration;
@@ -136,15 +208,22 @@ struct xe_isom_track : public xe_track{
 	xe_array<ulong> chunk_offset;
 	xe_array<uint> sync_sample;
 
-	struct sample_index{
-		uint* sample_to_chunk;
-		uint* time_to_sample;
-		ulong* sample_to_time;
-	} index;
+	xe_isom_index index;
 
+	/* sequential read cursor over the index */
 	uint current_chunk;
 	uint current_sample;
 	uint sample_chunk_index;
+	uint chunk_samples_left;
+	uint sample_time_index;
+	uint sample_time_left;
+	uint size_pos;
+	uint offset_pos;
+	ulong sample_timestamp;
+	ulong sample_offset;
+
+	/* selected when the byte ranges were last planned */
+	bool planned;
 
 	struct moof_ref{
 		ulong byte;
@@ -152,8 +231,175 @@ struct xe_isom_track : public xe_track{
 	};
 
 	xe_vector<moof_ref> moof_refs;
+
+	void free_tables(){
+		xe_dealloc(sample_time.data());
+		xe_dealloc(sample_chunk.data());
+		xe_dealloc(sample_sizes.data());
+		xe_dealloc(chunk_offset.data());
+		xe_dealloc(sync_sample.data());
+
+		sample_time = xe_array<xe_stts>();
+		sample_chunk = xe_array<xe_stsc>();
+		sample_sizes = xe_array<uint>();
+		chunk_offset = xe_array<ulong>();
+		sync_sample = xe_array<uint>();
+	}
 };
 
+static uint put_varint(byte* out, ulong value){
+	uint len = 0;
+
+	while(value >= 0x80){
+		out[len++] = value | 0x80;
+		value >>= 7;
+	}
+
+	out[len++] = value;
+
+	return len;
+}
+
+static ulong get_varint(const byte* in, uint& pos){
+	ulong value = 0;
+	uint shift = 0;
+	byte b;
+
+	do{
+		b = in[pos++];
+		value |= (ulong)(b & 0x7f) << shift;
+		shift += 7;
+	}while(b & 0x80);
+
+	return value;
+}
+
+static int build_index_tables(xe_isom_track* track){
+	xe_isom_index& index = track -> index;
+	uint samples = track -> sample_sizes.size(), chunks = track -> chunk_offset.size();
+	uint sample, chunk, run, size_pos, offset_pos;
+	ulong time, offset, end;
+	long delta;
+
+	if(!samples || !chunks || !track -> sample_chunk.size() || !track -> sample_time.size())
+		return 0;
+	/* time runs, empty stts entries are dropped so every run has samples */
+	if(!index.times.resize(track -> sample_time.size()))
+		return XE_ENOMEM;
+	time = 0;
+	sample = 0;
+	run = 0;
+
+	for(auto& entry : track -> sample_time){
+		if(!entry.count)
+			continue;
+		index.times[run].time = time;
+		index.times[run].sample = sample;
+		index.times[run].count = entry.count;
+		index.times[run].delta = entry.delta;
+
+		time += (ulong)entry.count * entry.delta;
+		sample += entry.count;
+		run++;
+	}
+
+	if(!run)
+		return 0;
+	index.times.resize(run);
+
+	/* chunk runs, stsc chunk numbers are 1-based */
+	if(!index.chunks.resize(track -> sample_chunk.size()))
+		return XE_ENOMEM;
+	sample = 0;
+
+	for(uint i = 0; i < track -> sample_chunk.size(); i++){
+		auto& entry = track -> sample_chunk[i];
+
+		if(!entry.first || (i ? entry.first <= track -> sample_chunk[i - 1].first : entry.first != 1))
+			return XE_INVALID_DATA;
+		if(i)
+			sample += (entry.first - track -> sample_chunk[i - 1].first) * track -> sample_chunk[i - 1].count;
+		index.chunks[i].chunk = entry.first - 1;
+		index.chunks[i].sample = sample;
+		index.chunks[i].count = entry.count;
+	}
+
+	if(!track -> sample_size && !index.sizes.resize((size_t)samples * 5))
+		return XE_ENOMEM;
+	if(!index.offsets.resize((size_t)chunks * 10) || !index.checkpoints.resize((samples + INDEX_INTERVAL - 1) / INDEX_INTERVAL))
+		return XE_ENOMEM;
+	/* one pass over every chunk and sample */
+	sample = 0;
+	run = 0;
+	size_pos = 0;
+	offset_pos = 0;
+	end = 0;
+
+	for(chunk = 0; chunk < chunks && sample < samples; chunk++){
+		uint count;
+
+		if(run + 1 < index.chunks.size() && chunk >= index.chunks[run + 1].chunk)
+			run++;
+		count = index.chunks[run].count;
+		offset = track -> chunk_offset[chunk];
+		delta = offset - end;
+		offset_pos += put_varint(index.offsets.data() + offset_pos, ((ulong)delta << 1) ^ (delta >> 63));
+
+		for(uint i = 0; i < count && sample < samples; i++, sample++){
+			uint size = track -> sample_size ? track -> sample_size : track -> sample_sizes[sample];
+
+			if(!(sample % INDEX_INTERVAL)){
+				auto& cp = index.checkpoints[sample / INDEX_INTERVAL];
+
+				cp.offset = offset;
+				cp.sizes = size_pos;
+				cp.offsets = offset_pos;
+				cp.chunk = chunk;
+				cp.chunk_left = count - i;
+				cp.chunk_run = run;
+			}
+
+			if(!track -> sample_size)
+				size_pos += put_varint(index.sizes.data() + size_pos, size);
+			offset += size;
+		}
+
+		end = offset;
+	}
+
+	index.sample_count = sample;
+	index.chunk_count = chunk;
+	index.sizes.resize(size_pos);
+	index.offsets.resize(offset_pos);
+	index.checkpoints.resize((sample + INDEX_INTERVAL - 1) / INDEX_INTERVAL);
+
+	/* sync samples, stss is 1-based */
+	if(track -> sync_sample.size()){
+		uint words = (sample + 63) / 64;
+
+		if(!index.sync.resize(words))
+			return XE_ENOMEM;
+		xe_zero(index.sync.data(), words);
+
+		for(uint s : track -> sync_sample){
+			if(s && s <= sample)
+				index.sync[(s - 1) >> 6] |= 1ul << ((s - 1) & 63);
+		}
+	}
+
+	return 0;
+}
+
+static int build_index(xe_isom_track* track){
+	int err = build_index_tables(track);
+
+	track -> free_tables();
+
+	if(err || !track -> index.sample_count)
+		track -> index.free();
+	return err;
+}
+
 struct xe_sidx_entry{
 	ulong time;
 	ulong byte: 48;
@@ -208,6 +454,7 @@ struct xe_traf{
 
 	byte explicit_base_offset;
 	byte default_base_is_moof;
+	byte has_start_time;
 };
 
 enum xe_tfhd_flags{
@@ -285,6 +532,11 @@ public:
 	};
 };
 
+struct xe_isom_range{
+	ulong start;
+	ulong end;
+};
+
 class xe_isom : public xe_demuxer{
 public:
 	xe_vector<xe_isom_track*> tracks;
@@ -300,7 +552,11 @@ public:
 	bool found_moov;
 	bool found_moof;
 	bool found_mdat;
-	bool built_index;
+	bool moov_started;
+	bool moov_planned;
+
+	xe_vector<xe_isom_range> ranges;
+	ulong range_end;
 
 	xe_isom(xe_format::xe_context& context): xe_demuxer(context){}
 
@@ -315,8 +571,15 @@ public:
 	~xe_isom();
 
 	int next_run();
+	void moov_start();
+	int moov_seek_track(xe_isom_track* track, ulong time, bool sync, ulong& seek_time);
 	int moov_next_sample(xe_packet& packet);
 	int moov_next_chunk();
+	int moov_plan();
+	int moov_read_to(ulong offset);
+	int fragment_seek(xe_isom_track* track, ulong pos);
+	int read_mfra();
+	int add_moof_ref(xe_isom_track* track, ulong byte, ulong time);
 
 	xe_isom_track* alloc_track(){
 		xe_isom_track* track = xe_zalloc<xe_isom_track>();
@@ -353,13 +616,20 @@ public:
 	}
 
 	void free_moov(){
-		for(auto t : tracks)
+		for(auto t : tracks){
+			t -> free_tables();
+			t -> index.free();
+			t -> moof_refs.free();
+
 			xe_dealloc(t);
+		}
+
 		tracks.resize(0);
 
 		for(auto t : segments)
 			xe_dealloc(t.entries);
 		segments.resize(0);
+		ranges.free();
 	}
 
 	void free_moof(){
@@ -563,6 +833,9 @@ public:
 				BOX(FOURCC_TRUN, FOURCC_TRAF, read_trun)
 
 				BOX(FOURCC_MDAT, FOURCC_ROOT, read_mdat)
+
+				BOX(FOURCC_MFRA, FOURCC_ROOT, read_children)
+				BOX(FOURCC_TFRA, FOURCC_MFRA, read_tfra)
 			}
 
 			stack_pop(box);
@@ -643,7 +916,7 @@ public:
 			return XE_INVALID_DATA;
 		}
 
-		return 0;
+		return build_index(track);
 	}
 
 	int read_tkhd(xe_box& box){
@@ -1161,6 +1434,13 @@ public:
 
 		reader.skip(2); /* reserved */
 		length = reader.r16be();
+
+		for(auto& other : isom.segments){
+			/* already indexed this sidx before a seek brought us back here */
+			if(&other != sidx && other.track_id == sidx -> track_id && other.length && other.entries[0].byte == bytec)
+				goto popback;
+		}
+
 		entries = xe_alloc<xe_sidx_entry>(length + 1);
 
 		if(!entries)
@@ -1205,8 +1485,6 @@ public:
 end:
 		return 0;
 popback:
-		xe_dealloc(sidx);
-
 		isom.segments.pop_back();
 
 		goto end;
@@ -1293,6 +1571,7 @@ popback:
 
 		reader.skip(3); /* flags */
 		traf -> start_time = version ? reader.r64be() : reader.r32be();
+		traf -> has_start_time = true;
 
 		return 0;
 	}
@@ -1374,6 +1653,57 @@ popback:
 
 		return 0;
 	}
+
+	int read_tfra(xe_box& box){
+		xe_isom_track* track = null;
+		byte version;
+		uint id, lengths, entries;
+		uint traf_size, trun_size, sample_size, entry_size;
+		ulong time, offset;
+
+		version = reader.r8();
+		reader.skip(3); /* flags */
+		id = reader.r32be();
+		lengths = reader.r32be();
+		entries = reader.r32be();
+
+		for(auto t : isom.tracks){
+			if(t -> id == id){
+				track = t;
+
+				break;
+			}
+		}
+
+		if(!track)
+			return 0;
+		traf_size = ((lengths >> 4) & 0x3) + 1;
+		trun_size = ((lengths >> 2) & 0x3) + 1;
+		sample_size = (lengths & 0x3) + 1;
+		entry_size = (version ? 16 : 8) + traf_size + trun_size + sample_size;
+
+		/* the random access table is authoritative, drop refs collected while playing */
+		track -> moof_refs.resize(0);
+
+		for(uint i = 0; i < entries && box_has(box, entry_size); i++){
+			if(version){
+				time = reader.r64be();
+				offset = reader.r64be();
+			}else{
+				time = reader.r32be();
+				offset = reader.r32be();
+			}
+
+			reader.skip(traf_size + trun_size + sample_size);
+
+			if(reader.error())
+				break;
+			if(isom.add_moof_ref(track, offset, time))
+				return XE_ENOMEM;
+		}
+
+		return 0;
+	}
 };
 
 struct xe_isom_scan_reader_name_type{
@@ -1511,6 +1841,9 @@ int xe_isom::open(){
 
 	if((err = reader.read_root()))
 		return err;
+	/* without a sidx, the only index of a fragmented file is the tfra at its end */
+	if(found_moof && !segments.size() && (err = read_mfra()))
+		return err;
 	if(!context -> tracks.resize(tracks.size()))
 		return XE_ENOMEM;
 	for(uint i = 0; i < tracks.size(); i++)
@@ -1518,10 +1851,6 @@ int xe_isom::open(){
 	return 0;
 }
 
-int xe_isom::seek(uint stream, ulong pos){
-	return 0;
-}
-
 int xe_isom::next_run(){
 	xe_reader& reader = context -> reader;
 	ulong min_offset = ULONG_MAX;
@@ -1535,6 +1864,8 @@ int xe_isom::next_run(){
 			last_offset = moof.start;
 
 			for(auto traf : moof.tracks){
+				if(traf -> has_start_time && traf -> track_index < tracks.size() && add_moof_ref(tracks[traf -> track_index], moof.start, traf -> start_time))
+					return XE_ENOMEM;
 				if(!traf -> explicit_base_offset){
 					if(traf -> default_base_is_moof)
 						traf -> offset = moof.start;
@@ -1568,6 +1899,8 @@ int xe_isom::next_run(){
 
 			if(traf -> run_index >= traf -> runs.size())
 				continue;
+			if(traf -> track_index < tracks.size() && tracks[traf -> track_index] -> discard == XE_DISCARD_ALL)
+				continue;
 			auto& run = traf -> runs[traf -> run_index];
 
 			if(run.data_offset <= min_offset){
@@ -1597,127 +1930,332 @@ int xe_isom::next_run(){
 	return reader.error();
 }
 
-static int build_index(xe_vector<xe_isom_track*>& tracks){
+static void advance_chunk(xe_isom_track* track){
+	xe_isom_index& index = track -> index;
+	uint run = track -> sample_chunk_index;
+	ulong delta;
+
+	if(++track -> current_chunk >= index.chunk_count)
+		return;
+	if(run + 1 < index.chunks.size() && track -> current_chunk >= index.chunks[run + 1].chunk)
+		track -> sample_chunk_index = ++run;
+	delta = get_varint(index.offsets.data(), track -> offset_pos);
+
+	track -> chunk_samples_left = index.chunks[run].count;
+	track -> sample_offset += (delta >> 1) ^ -(delta & 1);
+}
+
+static uint next_size(xe_isom_track* track){
+	if(track -> sample_size)
+		return track -> sample_size;
+	return get_varint(track -> index.sizes.data(), track -> size_pos);
+}
+
+/* index of the last element whose key is not greater than value */
+template<typename T, typename K>
+static uint bsearch_floor(const T* array, uint size, K T::* key, K value){
+	uint low = 0;
+	uint high = size - 1;
+
+	while(low < high){
+		uint mid = (low + high + 1) >> 1;
+
+		if(array[mid].*key > value)
+			high = mid - 1;
+		else
+			low = mid;
+	}
+
+	return low;
+}
+
+/* last sync sample at or before sample */
+static uint sync_floor(const xe_isom_index& index, uint sample){
+	uint word = sample >> 6;
+	ulong bits;
+
+	if(!index.sync.size())
+		return sample;
+	bits = index.sync[word] & (~0ul >> (63 - (sample & 63)));
+
+	while(!bits && word)
+		bits = index.sync[--word];
+	if(!bits)
+		return 0;
+	return (word << 6) + 63 - xe_arch_clzl(bits);
+}
+
+/* restore the nearest checkpoint and decode forward to sample */
+static void seek_sample(xe_isom_track* track, uint sample){
+	xe_isom_index& index = track -> index;
+	auto& cp = index.checkpoints[sample / INDEX_INTERVAL];
+	uint run;
+
+	track -> current_sample = sample - sample % INDEX_INTERVAL;
+	track -> current_chunk = cp.chunk;
+	track -> sample_chunk_index = cp.chunk_run;
+	track -> chunk_samples_left = cp.chunk_left;
+	track -> sample_offset = cp.offset;
+	track -> size_pos = cp.sizes;
+	track -> offset_pos = cp.offsets;
+
+	/* chunks may be empty, hence the loops */
+	for(; track -> current_sample < sample; track -> current_sample++){
+		while(!track -> chunk_samples_left)
+			advance_chunk(track);
+		track -> sample_offset += next_size(track);
+		track -> chunk_samples_left--;
+	}
+
+	while(!track -> chunk_samples_left && track -> current_chunk < index.chunk_count)
+		advance_chunk(track);
+	run = bsearch_floor(index.times.data(), index.times.size(), &xe_isom_index::time_run::sample, sample);
+
+	auto& tr = index.times[run];
+
+	track -> sample_time_index = run;
+	track -> sample_time_left = sample < tr.sample + tr.count ? tr.sample + tr.count - sample : 0;
+	track -> sample_timestamp = tr.time + (ulong)(sample - tr.sample) * tr.delta;
+}
+
+void xe_isom::moov_start(){
 	for(auto track : tracks){
-		track -> index.sample_to_chunk = xe_alloc<uint>(track -> sample_chunk.size());
-		track -> index.sample_to_chunk[0] = 0;
+		if(track -> index.sample_count)
+			seek_sample(track, 0);
+		else
+			track -> current_chunk = track -> index.chunk_count;
+	}
 
-		for(uint i = 1; i < track -> sample_chunk.size(); i++)
-			track -> index.sample_to_chunk[i] = track -> index.sample_to_chunk[i - 1] + (track -> sample_chunk[i].first - track -> sample_chunk[i - 1].first) * track -> sample_chunk[i - 1].count;
-		track -> index.sample_to_time = xe_alloc<ulong>(track -> sample_time.size());
+	moov_started = true;
+}
 
-		ulong time = 0;
+/* append a span for every non-empty chunk of the track */
+static int plan_track(xe_isom_track* track, xe_vector<xe_isom_range>& spans){
+	xe_isom_index& index = track -> index;
+	uint size_pos = 0, offset_pos = 0, run = 0, sample = 0;
+	ulong start, end = 0, delta;
 
-		for(uint i = 0; i < track -> sample_time.size(); i++){
-			time += track -> sample_time[i].count * track -> sample_time[i].delta;
-			track -> index.sample_to_time[i] = time;
+	for(uint chunk = 0; chunk < index.chunk_count; chunk++){
+		uint count;
+
+		if(run + 1 < index.chunks.size() && chunk >= index.chunks[run + 1].chunk)
+			run++;
+		count = xe_min(index.chunks[run].count, index.sample_count - sample);
+		delta = get_varint(index.offsets.data(), offset_pos);
+		start = end + ((delta >> 1) ^ -(delta & 1));
+		end = start;
+
+		if(track -> sample_size)
+			end += (ulong)count * track -> sample_size;
+		else{
+			for(uint i = 0; i < count; i++)
+				end += get_varint(index.sizes.data(), size_pos);
 		}
 
-		track -> index.time_to_sample = xe_alloc<uint>(track -> sample_time.size());
-		track -> index.time_to_sample[0] = 0;
+		sample += count;
 
-		for(uint i = 1; i < track -> sample_time.size(); i++)
-			track -> index.time_to_sample[i] = track -> index.time_to_sample[i - 1] + track -> sample_time[i - 1].count;
+		if(end > start && !spans.push_back({start, end}))
+			return XE_ENOMEM;
 	}
 
 	return 0;
 }
 
-int xe_isom::moov_next_chunk(){
+static int compare_range(const void* a, const void* b){
+	ulong x = ((const xe_isom_range*)a) -> start, y = ((const xe_isom_range*)b) -> start;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Byte range planning
+ * every chunk of the selected tracks becomes a span, and spans closer
+ * than the context's range gap are merged. the reader is only asked
+ * for bytes inside these ranges, so a remote stream transfers the
+ * selected tracks plus the small gaps between them instead of the
+ * whole file. planning is redone when a track's discard changes
+ */
+int xe_isom::moov_plan(){
+	xe_vector<xe_isom_range> spans;
+	bool changed = !moov_planned;
+	int err = 0;
+
+	for(auto track : tracks)
+		changed |= track -> planned != (track -> discard != XE_DISCARD_ALL);
+	if(!changed)
+		return 0;
+	moov_planned = true;
+	range_end = 0;
+	ranges.resize(0);
+
+	for(auto track : tracks)
+		track -> planned = track -> discard != XE_DISCARD_ALL;
+	if(!context -> range_gap)
+		return 0;
+	for(auto track : tracks){
+		if(track -> planned && (err = plan_track(track, spans)))
+			break;
+	}
+
+	if(!err && spans.size()){
+		qsort(spans.data(), spans.size(), sizeof(xe_isom_range), compare_range);
+
+		xe_isom_range current = spans[0];
+
+		for(uint i = 1; i < spans.size() && !err; i++){
+			if(spans[i].start <= current.end + context -> range_gap){
+				current.end = xe_max(current.end, spans[i].end);
+
+				continue;
+			}
+
+			if(!ranges.push_back(current))
+				err = XE_ENOMEM;
+			current = spans[i];
+		}
+
+		if(!err && !ranges.push_back(current))
+			err = XE_ENOMEM;
+	}
+
+	spans.free();
+
+	if(err)
+		ranges.resize(0);
+	return err;
+}
+
+/* move the reader to offset, opening a new bounded range if it's outside the current one */
+int xe_isom::moov_read_to(ulong offset){
 	xe_reader& reader = context -> reader;
+	ulong position = reader.offset();
+	uint index;
+
+	if(offset >= position && (!ranges.size() || offset < range_end))
+		return reader.skip(offset - position);
+	if(!ranges.size())
+		return reader.seek(offset);
+	index = bsearch_floor(ranges.data(), ranges.size(), &xe_isom_range::start, offset);
+	range_end = 0;
+
+	if(ranges[index].start <= offset && offset < ranges[index].end)
+		range_end = ranges[index].end;
+	return reader.seek(offset, range_end);
+}
 
-	bool found = false;
+static constexpr double SCHEDULE_MAX_SKEW = 2; /* seconds */
 
-	ulong min_offset = ULONG_MAX;
+static double track_time(xe_isom_track* track){
+	return (double)track -> sample_timestamp * track -> timescale.num / track -> timescale.den;
+}
 
+/* chunks are read in file order as long as possible. a track whose next chunk
+ * is behind the read position only gets a backwards seek once it lags the
+ * track ahead by more than SCHEDULE_MAX_SKEW seconds, so a badly interleaved
+ * file costs one seek per SCHEDULE_MAX_SKEW instead of one per chunk. gaps
+ * between chunks ahead are skipped, which reads through them when small */
+int xe_isom::moov_next_chunk(){
+	xe_reader& reader = context -> reader;
+	ulong position = reader.offset();
+	int behind = -1, ahead = -1;
+	int err;
+
+	if((err = moov_plan()))
+		return err;
 	for(uint i = 0; i < tracks.size(); i++){
 		auto track = tracks[i];
 
-		if(track -> current_chunk >= track -> chunk_offset.size())
+		if(track -> discard == XE_DISCARD_ALL || track -> current_chunk >= track -> index.chunk_count)
 			continue;
-		ulong offset = track -> chunk_offset[track -> current_chunk];
-
-		if(offset <= min_offset){
-			min_offset = offset;
-			track_index = i;
-			found = true;
+		if(track -> sample_offset < position){
+			if(behind < 0 || track -> sample_offset < tracks[behind] -> sample_offset)
+				behind = i;
+		}else if(ahead < 0 || track -> sample_offset < tracks[ahead] -> sample_offset){
+			ahead = i;
 		}
 	}
 
-	if(!found)
+	if(behind < 0 && ahead < 0)
 		return XE_EOF;
-	if(min_offset < reader.offset()){
-		reader.seek(min_offset);
+	if(behind >= 0 && (ahead < 0 || track_time(tracks[ahead]) - track_time(tracks[behind]) > SCHEDULE_MAX_SKEW)){
+		track_index = behind;
 
-		return 0;
+		return moov_read_to(tracks[behind] -> sample_offset);
 	}
 
-	reader.skip(min_offset - reader.offset());
+	track_index = ahead;
 
-	return reader.error();
+	return moov_read_to(tracks[ahead] -> sample_offset);
 }
 
-static long bsearch(uint* array, uint size, uint value){
-	uint low = 0;
-	uint high = size - 1;
+int xe_isom::moov_seek_track(xe_isom_track* track, ulong time, bool sync, ulong& seek_time){
+	xe_isom_index& index = track -> index;
+	uint run, sample;
 
-	while(low < high){
-		uint mid = (low + high + 1) >> 1;
+	if(!index.sample_count){
+		track -> current_chunk = index.chunk_count;
 
-		if(array[mid] > value)
-			high = mid - 1;
-		else if(array[mid] > value)
-			low = mid;
+		return 0;
 	}
 
-	return low;
+	/* time -> sample */
+	run = bsearch_floor(index.times.data(), index.times.size(), &xe_isom_index::time_run::time, time);
+
+	auto& tr = index.times[run];
+
+	sample = tr.sample + xe_min<ulong>((time - tr.time) / tr.delta, tr.count - 1);
+	sample = xe_min(sample, index.sample_count - 1);
+
+	if(sync)
+		sample = sync_floor(index, sample);
+	seek_sample(track, sample);
+	seek_time = track -> sample_timestamp;
+
+	return 0;
 }
 
 int xe_isom::moov_next_sample(xe_packet& packet){
 	xe_reader& reader = context -> reader;
+	xe_isom_track* track;
+	uint size;
 
 	int err;
 
-	if(!built_index){
-		built_index = true;
-
-		build_index(tracks);
+	if(!moov_started){
+		moov_start();
 
 		if((err = moov_next_chunk()))
 			return err;
 	}
 
-	auto track = tracks[track_index];
-
-	if(track -> current_chunk >= track -> chunk_offset.size())
-		return XE_EOF;
-	uint sample_chunk_index = track -> sample_chunk_index;
-	uint samples_per_chunk = track -> sample_chunk[sample_chunk_index].count;
-	uint sample_start = (track -> current_chunk - track -> sample_chunk[sample_chunk_index].first + 1) * samples_per_chunk + track -> index.sample_to_chunk[sample_chunk_index];
-	uint sample_end = sample_start + samples_per_chunk;
-
-	if(track -> current_sample >= sample_end){
-		track -> current_chunk++;
+	while(true){
+		track = tracks[track_index];
 
-		if(sample_chunk_index + 1 < track -> sample_chunk.size() && track -> current_chunk + 1 >= track -> sample_chunk[sample_chunk_index + 1].first)
-			track -> sample_chunk_index++;
+		if(track -> discard == XE_DISCARD_ALL || track -> current_chunk >= track -> index.chunk_count)
+			; /* schedule another track */
+		else if(track -> current_sample >= track -> index.sample_count)
+			track -> current_chunk = track -> index.chunk_count;
+		else if(!track -> chunk_samples_left)
+			advance_chunk(track);
+		else
+			break;
 		if((err = moov_next_chunk()))
 			return err;
-		track = tracks[track_index];
-
-		sample_chunk_index = track -> sample_chunk_index;
-		samples_per_chunk = track -> sample_chunk[sample_chunk_index].count;
-		sample_start = (track -> current_chunk - track -> sample_chunk[sample_chunk_index].first) * samples_per_chunk + track -> index.sample_to_chunk[sample_chunk_index];
-		sample_end = sample_start + samples_per_chunk;
 	}
 
-	uint size = track -> sample_size ? track -> sample_size : track -> sample_sizes[track -> current_sample];
-	uint tts_index = bsearch(track -> index.time_to_sample, track -> sample_time.size(), track -> current_sample);
+	size = next_size(track);
+
+	packet.timestamp = track -> sample_timestamp;
+	packet.duration = track -> index.times[track -> sample_time_index].delta;
+	packet.track = track_index;
 
-	packet.timestamp = (track -> current_sample - track -> index.time_to_sample[tts_index]) * track -> sample_time[tts_index].delta + (tts_index > 0 ? track -> index.sample_to_time[tts_index - 1] : 0);
-	packet.duration = track -> sample_time[tts_index].delta;
 	track -> current_sample++;
+	track -> chunk_samples_left--;
+	track -> sample_offset += size;
+	track -> sample_timestamp += packet.duration;
 
+	/* past the last run its delta repeats */
+	if(track -> sample_time_left && !--track -> sample_time_left && track -> sample_time_index + 1 < track -> index.times.size())
+		track -> sample_time_left = track -> index.times[++track -> sample_time_index].count;
 	if(!alloc_packet(packet, size))
 		return XE_ENOMEM;
 	reader.read(packet.data(), size);
@@ -1725,6 +2263,180 @@ int xe_isom::moov_next_sample(xe_packet& packet){
 	return reader.error();
 }
 
+int xe_isom::seek(uint stream, ulong pos){
+	xe_isom_track* target;
+	ulong time, min_offset;
+	int err;
+
+	if(stream >= tracks.size())
+		return XE_EINVAL;
+	if(!moov_started)
+		moov_start();
+	target = tracks[stream];
+
+	if(!target -> index.chunk_count)
+		return fragment_seek(target, pos);
+	/* position the requested track on the sync sample at or before pos,
+	 * then line every other track up with the time we actually landed on */
+	if((err = moov_seek_track(target, pos, true, time)))
+		return err;
+	for(auto track : tracks){
+		ulong track_time, unused;
+
+		if(track == target)
+			continue;
+		track_time = (ulong)((double)time * target -> timescale.num * track -> timescale.den / ((double)target -> timescale.den * track -> timescale.num));
+
+		if((err = moov_seek_track(track, track_time, false, unused)))
+			return err;
+	}
+
+	/* start reading from the earliest sample any track needs,
+	 * so the whole seek costs a single range request */
+	min_offset = ULONG_MAX;
+
+	for(uint i = 0; i < tracks.size(); i++){
+		auto track = tracks[i];
+
+		if(track -> discard == XE_DISCARD_ALL)
+			continue;
+		if(track -> current_chunk < track -> index.chunk_count && track -> sample_offset < min_offset){
+			min_offset = track -> sample_offset;
+			track_index = i;
+		}
+	}
+
+	if(min_offset == ULONG_MAX)
+		return XE_EOF;
+	if((err = moov_plan()))
+		return err;
+	return moov_read_to(min_offset);
+}
+
+enum{
+	MFRO_SIZE = 16
+};
+
+/* find the mfra through the mfro that ends the file and load its tfra tables */
+int xe_isom::read_mfra(){
+	xe_reader& reader = context -> reader;
+	ulong length = reader.size(), resume = reader.offset();
+	xe_box box;
+	uint size;
+	int err;
+
+	if(length < MFRO_SIZE)
+		return 0;
+	if((err = reader.seek(length - MFRO_SIZE, length)))
+		return err;
+	size = reader.r32be();
+	box.type = (xe_fourcc)reader.r32le();
+	reader.skip(4); /* version + flags */
+	box.size = reader.r32be();
+
+	if(!reader.error() && size == MFRO_SIZE && box.type == FOURCC_MFRO && box.size >= 8 + MFRO_SIZE && box.size <= length){
+		box.offset = length - box.size;
+
+		if(!(err = reader.seek(box.offset, length))){
+			size = reader.r32be();
+			box.type = (xe_fourcc)reader.r32le();
+
+			if(!reader.error() && size == box.size && box.type == FOURCC_MFRA){
+				xe_isom_reader ireader(*this, reader);
+
+				ireader.stack_push(box);
+				err = ireader.read_children(box);
+				ireader.stack_pop(box);
+			}
+		}
+	}
+
+	/* the table only speeds up seeking, a broken one is ignored */
+	if(err == XE_ENOMEM)
+		return err;
+	return reader.seek(resume);
+}
+
+int xe_isom::add_moof_ref(xe_isom_track* track, ulong byte, ulong time){
+	size_t size = track -> moof_refs.size();
+
+	/* refs are kept sorted by time, fragments seen twice after a seek are ignored */
+	if(size && track -> moof_refs[size - 1].byte >= byte)
+		return 0;
+	if(!track -> moof_refs.push_back({byte, time}))
+		return XE_ENOMEM;
+	return 0;
+}
+
+int xe_isom::fragment_seek(xe_isom_track* track, ulong pos){
+	xe_reader& reader = context -> reader;
+	xe_sidx* sidx = null;
+	ulong offset = ULONG_MAX;
+	int err;
+
+	/* prefer a sidx for this track, the one starting closest before pos */
+	for(auto& segment : segments){
+		bool match = segment.track_id == track -> id;
+		bool matched = sidx && sidx -> track_id == track -> id;
+
+		if(!segment.length || (matched && !match))
+			continue;
+		ulong time = (ulong)((double)pos * segment.timescale * track -> timescale.num / track -> timescale.den);
+
+		if(!sidx || (match && !matched))
+			sidx = &segment;
+		else if(segment.entries[0].time <= time && segment.entries[0].time > sidx -> entries[0].time)
+			sidx = &segment;
+	}
+
+	if(sidx){
+		ulong time = (ulong)((double)pos * sidx -> timescale * track -> timescale.num / track -> timescale.den);
+		uint low = 0, high = sidx -> length - 1;
+
+		while(low < high){
+			uint mid = (low + high + 1) >> 1;
+
+			if(sidx -> entries[mid].time > time)
+				high = mid - 1;
+			else
+				low = mid;
+		}
+
+		/* back up to a subsegment we can start decoding from */
+		while(low > 0 && !sidx -> entries[low].starts_with_keyframe)
+			low--;
+		offset = sidx -> entries[low].byte;
+	}else if(track -> moof_refs.size()){
+		/* fall back to the tfra table or the fragments we have already visited */
+		uint low = 0, high = track -> moof_refs.size() - 1;
+
+		while(low < high){
+			uint mid = (low + high + 1) >> 1;
+
+			if(track -> moof_refs[mid].time > pos)
+				high = mid - 1;
+			else
+				low = mid;
+		}
+
+		offset = track -> moof_refs[low].byte;
+	}
+
+	if(offset == ULONG_MAX)
+		return XE_ENOSYS;
+	free_moof();
+
+	found_moof = false;
+	found_mdat = false;
+	traf_index = 0;
+
+	if((err = reader.seek(offset)))
+		return err;
+	xe_isom_reader ireader(*this, reader);
+
+	return ireader.read_root();
+}
+
 int xe_isom::read_packet(xe_packet& packet){
 	xe_reader& reader = context -> reader; // TODO ensure runs dont overlap
 
@@ -1781,20 +2493,69 @@ xe_demuxer* xe_isom_class::create(xe_format::xe_context& context) const{
 	return xe_znew<xe_isom>(context);
 }
 
-bool xe_isom_class::probe(xe_reader& reader) const{
+static uint probe_u32(xe_cbptr data){
+	return ((uint)data[0] << 24) | ((uint)data[1] << 16) | ((uint)data[2] << 8) | (uint)data[3];
+}
+
+/* one box could be chance, a chain of them is not */
+static uint probe_score(uint boxes){
+	return boxes > 1 ? XE_PROBE_SCORE_LIKELY : boxes ? XE_PROBE_SCORE_WEAK : XE_PROBE_SCORE_NONE;
+}
+
+uint xe_isom_class::probe(const xe_probe_data& probe) const{
+	xe_cbptr data;
 	xe_fourcc box;
+	ulong size, offset = 0;
+	uint boxes = 0;
+
+	/* walk the top level boxes in the window */
+	while(offset + 8 <= probe.size){
+		data = probe.data + offset;
+		size = probe_u32(data);
+		box = (xe_fourcc)(data[4] | (data[5] << 8) | (data[6] << 16) | ((uint)data[7] << 24));
+
+		switch(box){
+			case FOURCC_FTYP:
+			case FOURCC_STYP:
+				/* a leading file type box is definitive */
+				if(!offset)
+					return XE_PROBE_SCORE_MAX;
+				break;
+			case FOURCC_MOOV:
+			case FOURCC_MOOF:
+			case FOURCC_MDAT:
+			case FOURCC_SIDX:
+			case FOURCC_FREE:
+			case FOURCC_SKIP:
+				break;
+			default:
+				return probe_score(boxes);
+		}
 
-	reader.r32be();
-	box = (xe_fourcc)reader.r32le();
+		if(size == 1){
+			if(offset + 16 > probe.size)
+				size = 0;
+			else if((size = ((ulong)probe_u32(data + 8) << 32) | probe_u32(data + 12)) < 16)
+				return XE_PROBE_SCORE_NONE;
+		}else if(size && size < 8){
+			return XE_PROBE_SCORE_NONE;
+		}
 
-	switch(box){
-		case FOURCC_FTYP:
-		case FOURCC_MOOV:
-		case FOURCC_MOOF:
-		case FOURCC_MDAT:
-		case FOURCC_SIDX:
-			return true;
+		boxes++;
+
+		/* a size of 0 runs to the end of the stream */
+		if(!size || size > probe.size - offset)
+			break;
+		offset += size;
 	}
 
-	return false;
+	return probe_score(boxes);
+}
+
+xe_cstr xe_isom_class::extensions() const{
+	return "mp4,m4a,m4b,m4v,mov,3gp,3g2";
+}
+
+xe_cstr xe_isom_class::mime_types() const{
+	return "video/mp4,audio/mp4,audio/x-m4a,video/quicktime,video/3gpp,audio/3gpp";
 }
\ No newline at end of file
@@ -8,7 +8,10 @@ public:
 	xe_isom_class(){}
 
 	xe_demuxer* create(xe_format::xe_context& context) const;
-	bool probe(xe_reader& reader) const;
+	uint probe(const xe_probe_data& probe) const;
+
+	xe_cstr extensions() const;
+	xe_cstr mime_types() const;
 
 	~xe_isom_class(){}
 };
@@ -2,6 +2,7 @@
 #include "../demuxer.h"
 #include "../error.h"
 #include "../common.h"
+#include "../codecs/opus.h"
 #include "mkv.h"
 #include "xe/log.h"
 #include "xe/container/vector.h"
@@ -886,6 +887,9 @@ struct xe_seek{
 struct xe_matroska_track : public xe_track{
 	ulong number;
 	ulong default_duration;
+	/* in nanoseconds */
+	ulong codec_delay;
+	ulong seek_preroll;
 
 	bool has_content_encodings;
 	bool has_attachments;
@@ -921,6 +925,7 @@ public:
 	xe_reader& reader;
 
 	ulong segment_offset;
+	xe_ebml_element segment;
 	xe_ebml_element stack[16];
 	uint depth;
 
@@ -1225,14 +1230,19 @@ public:
 		return parse_element<parent_id, &xe_matroska_reader::handle_float<parse>>(element);
 	}
 
-	int read_children(){
+	int read_children(ulong end = 0){
 		int err;
 
 		xe_ebml_element element;
+		ulong start;
 
 		while(true){
 			while(depth && !element_has(stack_top(), 2))
 				stack_pop();
+			if(end && reader.offset() >= end)
+				break;
+			start = reader.offset();
+
 			if((err = read_id(element.id))){
 				if(depth){
 					xe_ebml_element& top = stack_top();
@@ -1338,6 +1348,14 @@ public:
 				case MKV_TRACK_CODEC_PRIVATE:
 					err = parse_element<MKV_TRACK, &xe_matroska_reader::read_track_codec_private>(element);
 
+					break;
+				case MKV_TRACK_CODEC_DELAY:
+					err = parse_uint<MKV_TRACK, &xe_matroska_reader::read_track_codec_delay>(element);
+
+					break;
+				case MKV_TRACK_SEEK_PREROLL:
+					err = parse_uint<MKV_TRACK, &xe_matroska_reader::read_track_seek_preroll>(element);
+
 					break;
 				case MKV_TRACK_AUDIO:
 					err = handle_master<MKV_TRACK>(element);
@@ -1384,6 +1402,8 @@ public:
 
 					break;
 				case MKV_CLUSTER:
+					if(!first_cluster())
+						first_cluster() = start;
 					err = handle_master<MKV_SEGMENT>(element);
 
 					break;
@@ -1394,7 +1414,15 @@ public:
 				case MKV_CLUSTER_SIMPLE_BLOCK:
 					err = parse_element<MKV_CLUSTER, &xe_matroska_reader::read_simple_block, false>(element);
 
-					return 0;
+					return err;
+				case MKV_CLUSTER_BLOCK_GROUP:
+					err = handle_master<MKV_CLUSTER>(element);
+
+					break;
+				case MKV_CLUSTER_BLOCK_GROUP_BLOCK:
+					err = parse_element<MKV_CLUSTER_BLOCK_GROUP, &xe_matroska_reader::read_block, false>(element);
+
+					return err;
 				default:
 					stack_push(element);
 					stack_pop();
@@ -1475,6 +1503,7 @@ public:
 
 	int read_segment(xe_ebml_element& element){
 		segment_offset = element.offset;
+		segment = element;
 
 		return 0;
 	}
@@ -1597,6 +1626,18 @@ public:
 		return 0;
 	}
 
+	int read_track_codec_delay(xe_ebml_element& element, ulong delay){
+		track -> codec_delay = delay;
+
+		return 0;
+	}
+
+	int read_track_seek_preroll(xe_ebml_element& element, ulong preroll){
+		track -> seek_preroll = preroll;
+
+		return 0;
+	}
+
 	int read_track_audio_sampling_frequency(xe_ebml_element& element, double frequency){
 		track -> codec.sample_rate = frequency;
 
@@ -1661,7 +1702,75 @@ public:
 		return read_uint(element, cluster_timecode());
 	}
 
-	int read_simple_block(xe_ebml_element& element){
+	int read_lace_sizes(byte lacing, ulong size){
+		uint* sizes = lace_sizes();
+		uint count = reader.r8() + 1;
+		ulong total = 0, frame, start;
+		long delta;
+		int err;
+
+		size--;
+
+		switch(lacing){
+			case 1: /* xiph */
+				for(uint i = 0; i < count - 1; i++){
+					byte b;
+
+					frame = 0;
+
+					do{
+						b = reader.r8();
+						frame += b;
+						size--;
+					}while(b == 255 && size);
+
+					sizes[i] = frame;
+					total += frame;
+				}
+
+				break;
+			case 2: /* fixed size */
+				if(size % count)
+					return XE_INVALID_DATA;
+				for(uint i = 0; i < count; i++)
+					sizes[i] = size / count;
+				lace_count() = count;
+
+				return reader.error();
+			case 3: /* ebml */
+				if(count == 1)
+					break;
+				start = reader.offset();
+
+				if((err = read_vint(total)))
+					return err;
+				sizes[0] = total;
+
+				for(uint i = 1; i < count - 1; i++){
+					if((err = read_vint<XE_VSINT>((ulong&)delta)))
+						return err;
+					if((long)sizes[i - 1] + delta < 0)
+						return XE_INVALID_DATA;
+					sizes[i] = sizes[i - 1] + delta;
+					total += sizes[i];
+				}
+
+				size -= reader.offset() - start;
+
+				break;
+		}
+
+		if((err = reader.error()))
+			return err;
+		if(total > size)
+			return XE_INVALID_DATA;
+		sizes[count - 1] = size - total;
+		lace_count() = count;
+
+		return 0;
+	}
+
+	int read_block_header(xe_ebml_element& element, bool& key){
 		int err;
 
 		ulong track;
@@ -1674,17 +1783,48 @@ public:
 		timecode = reader.r16be();
 		flags = reader.r8();
 
-		if(flags & 0x80)
-			; /* keyframe */
+		if((err = reader.error()))
+			return err;
+		sample_track() = find_track(track);
+		sample_time() = cluster_timecode() + timecode;
 		lacing = (flags & 0x6) >> 1;
+		key = flags & 0x80;
+		lace_count() = 0;
+		lace_index() = 0;
 
 		if(lacing){
-
-		}else{
-			sample_size() = element_left(element);
-			sample_time() = cluster_timecode() + timecode;
+			if(!element_has(element, 1))
+				return XE_INVALID_DATA;
+			if((err = read_lace_sizes(lacing, element_left(element))))
+				return err;
 		}
 
+		sample_size() = element_left(element);
+
+		return 0;
+	}
+
+	int read_simple_block(xe_ebml_element& element){
+		bool key;
+		int err;
+
+		if((err = read_block_header(element, key)))
+			return err;
+		sample_key() = key;
+
+		return 0;
+	}
+
+	int read_block(xe_ebml_element& element){
+		bool key;
+		int err;
+
+		if((err = read_block_header(element, key)))
+			return err;
+		/* a block group's reference blocks follow the block itself,
+		 * audio frames never reference others, so treat it as a keyframe */
+		sample_key() = true;
+
 		return 0;
 	}
 
@@ -1696,7 +1836,15 @@ public:
 	ulong& cluster_timecode();
 	ulong& sample_time();
 	ulong& sample_size();
+	uint& sample_track();
+	bool& sample_key();
+	uint* lace_sizes();
+	uint& lace_count();
+	uint& lace_index();
 	ulong& timecode_scale();
+	ulong& first_cluster();
+
+	uint find_track(ulong number);
 
 	xe_matroska_track* alloc_track();
 	xe_seek* alloc_seek();
@@ -1712,6 +1860,17 @@ public:
 	ulong sample_size;
 	ulong sample_time;
 	ulong cluster_timecode;
+	ulong first_cluster;
+	uint sample_track;
+	bool sample_key;
+	bool loaded_cues;
+
+	/* frames of the current laced block, read into one buffer and handed out as slices */
+	uint lace_sizes[256];
+	uint lace_count;
+	uint lace_index;
+	xe_buffer_ref lace_ref;
+	xe_bptr lace_data;
 	xe_ebml_element stack[16];
 	uint depth;
 
@@ -1763,11 +1922,10 @@ public:
 	}
 
 	int open();
+	int load_cues();
+	int seek(uint stream, ulong pos);
 
-	int seek(uint stream, ulong pos){
-		return 0;
-	}
-
+	int read_laced_packet(xe_packet& packet);
 	int read_packet(xe_packet& packet);
 
 	void reset(){
@@ -1793,10 +1951,43 @@ ulong& xe_matroska_reader::sample_size(){
 	return matroska.sample_size;
 }
 
+uint& xe_matroska_reader::sample_track(){
+	return matroska.sample_track;
+}
+
+bool& xe_matroska_reader::sample_key(){
+	return matroska.sample_key;
+}
+
+uint* xe_matroska_reader::lace_sizes(){
+	return matroska.lace_sizes;
+}
+
+uint& xe_matroska_reader::lace_count(){
+	return matroska.lace_count;
+}
+
+uint& xe_matroska_reader::lace_index(){
+	return matroska.lace_index;
+}
+
 ulong& xe_matroska_reader::timecode_scale(){
 	return matroska.timecode_scale;
 }
 
+ulong& xe_matroska_reader::first_cluster(){
+	return matroska.first_cluster;
+}
+
+uint xe_matroska_reader::find_track(ulong number){
+	for(uint i = 0; i < matroska.tracks.size(); i++){
+		if(matroska.tracks[i] -> number == number)
+			return i;
+	}
+
+	return matroska.tracks.size();
+}
+
 xe_matroska_track* xe_matroska_reader::alloc_track(){
 	return matroska.alloc_track();
 }
@@ -1812,6 +2003,7 @@ xe_matroska_cue* xe_matroska_reader::alloc_cue(){
 xe_matroska::xe_matroska(xe_format::xe_context& context):
 	xe_demuxer(context),
 	mkv_reader(*this, context.reader){
+	timecode_scale = 1'000'000;
 }
 
 int xe_matroska::open(){
@@ -1821,26 +2013,230 @@ int xe_matroska::open(){
 		return err;
 	if(!context -> tracks.resize(tracks.size()))
 		return XE_ENOMEM;
-	for(uint i = 0; i < tracks.size(); i++)
+	for(uint i = 0; i < tracks.size(); i++){
+		xe_matroska_track& track = *tracks[i];
+		/* opus always decodes at 48 khz, whatever the sampling frequency says */
+		ulong rate = track.codec.id == XE_CODEC_OPUS ? (uint)XE_OPUS_SAMPLE_RATE : track.codec.sample_rate;
+
+		track.codec.delay = track.codec_delay * rate / 1'000'000'000;
+		track.codec.preroll = track.seek_preroll * rate / 1'000'000'000;
 		context -> tracks[i] = tracks[i];
+	}
+
 	return 0;
 }
 
-int xe_matroska::read_packet(xe_packet& packet){
+int xe_matroska::load_cues(){
+	xe_reader& reader = context -> reader;
+	xe_ebml_element element;
+	ulong position = 0;
+	int err;
+
+	loaded_cues = true;
+
+	for(auto& entry : seek_head){
+		if(entry.id == MKV_CUES){
+			position = entry.position;
+
+			break;
+		}
+	}
+
+	if(!position)
+		return 0;
+	if((err = reader.seek(position)))
+		return err;
+	if((err = mkv_reader.read_id(element.id)) || (err = mkv_reader.read_size(element.size)))
+		return err;
+	if(element.id != MKV_CUES || element.size == EBML_UNKNOWN_LENGTH)
+		return XE_INVALID_DATA;
+	element.offset = reader.offset();
+	element.end = 0;
+
+	/* parse just the cues element as if it was reached from the segment */
+	mkv_reader.depth = 0;
+	mkv_reader.stack_push(mkv_reader.segment);
+
+	if((err = mkv_reader.handle_master<MKV_SEGMENT>(element)))
+		return err;
+	return mkv_reader.read_children(element.offset + element.size);
+}
+
+int xe_matroska::seek(uint stream, ulong pos){
 	xe_reader& reader = context -> reader;
+	xe_matroska_track* track;
+	ulong target, position = 0;
+	int err;
+
+	if(stream >= tracks.size())
+		return XE_EINVAL;
+	track = tracks[stream];
 
-	if(!sample_size){
-		int err = mkv_reader.read_children();
+	if(!loaded_cues && !cues.size() && (err = load_cues()))
+		return err;
+	/* cue times are in segment ticks */
+	target = (ulong)((double)pos * track -> timescale.num * 1'000'000'000 / ((double)track -> timescale.den * timecode_scale));
+
+	if(cues.size()){
+		uint low = 0, high = cues.size() - 1;
+
+		while(low < high){
+			uint mid = (low + high + 1) >> 1;
+
+			if(cues[mid].time > target)
+				high = mid - 1;
+			else
+				low = mid;
+		}
+
+		/* walk back to a cue point that indexes this track */
+		for(uint i = low + 1; i-- > 0 && !position;){
+			for(auto& tp : cues[i].track_positions){
+				if(tp.track == track -> number){
+					position = tp.position;
 
-		if(err)
+					break;
+				}
+			}
+		}
+
+		if(!position && cues[low].track_positions.size())
+			position = cues[low].track_positions[0].position;
+	}
+
+	/* without cues, the best we can do is a linear scan from the first cluster */
+	if(!position)
+		position = first_cluster;
+	if(!position)
+		return XE_ENOSYS;
+	if((err = reader.seek(position)))
+		return err;
+	mkv_reader.depth = 0;
+	mkv_reader.stack_push(mkv_reader.segment);
+	sample_size = 0;
+	cluster_timecode = 0;
+	lace_count = 0;
+	lace_ref.unref();
+
+	/* scan forward to the first block of the track at or after the target */
+	while(true){
+		if((err = mkv_reader.read_children()))
 			return err;
 		if(!sample_size)
 			return XE_EOF;
+		if(sample_track == stream && sample_time >= target)
+			break;
+		if((err = reader.skip(sample_size)))
+			return err;
+		sample_size = 0;
+		lace_count = 0;
 	}
 
+	return 0;
+}
+
+static ulong ns_to_ticks(ulong ns, ulong timecode_scale){
+	return (ns + timecode_scale / 2) / timecode_scale;
+}
+
+int xe_matroska::read_laced_packet(xe_packet& packet){
+	xe_reader& reader = context -> reader;
+	xe_matroska_track* track = tracks[sample_track];
+	uint size = lace_sizes[lace_index];
+	int err;
+
+	if(!lace_index){
+		xe_bptr data;
+
+		/* every frame but the last gets its own padding inside the shared buffer */
+		if(!alloc_packet(packet, sample_size + (lace_count - 1) * XE_BUFFER_PADDING))
+			return XE_ENOMEM;
+		data = packet.data();
+
+		for(uint i = 0; i < lace_count; i++){
+			reader.read(data, lace_sizes[i]);
+			data += lace_sizes[i];
+
+			if(i + 1 < lace_count){
+				xe_zero(data, XE_BUFFER_PADDING);
+
+				data += XE_BUFFER_PADDING;
+			}
+		}
+
+		if((err = reader.error()))
+			return err;
+		lace_ref.ref(packet.ref);
+		lace_data = packet.data();
+		sample_size = 0;
+	}else{
+		packet.unref();
+		packet.ref.ref(lace_ref);
+	}
+
+	packet.buffer = xe_array<byte>(lace_data, size);
+	packet.timestamp = sample_time;
+	packet.duration = 0;
+	packet.flags = sample_key ? XE_PACKET_FLAG_KEY : XE_PACKET_FLAG_NONE;
+	packet.track = sample_track;
+
+	if(track -> default_duration){
+		/* default duration is in nanoseconds, timestamps in segment ticks.
+		 * both ends are rounded from the block start so frames don't drift */
+		ulong start = ns_to_ticks(lace_index * track -> default_duration, timecode_scale);
+		ulong end = ns_to_ticks((lace_index + 1) * track -> default_duration, timecode_scale);
+
+		packet.timestamp += start;
+		packet.duration = end - start;
+	}else if(lace_index){
+		/* only the block is timed, a parser may know the frames' durations */
+		packet.flags |= XE_PACKET_FLAG_NO_TIMESTAMP;
+	}
+
+	lace_data += size + XE_BUFFER_PADDING;
+
+	if(++lace_index == lace_count){
+		lace_count = 0;
+		lace_ref.unref();
+	}
+
+	return 0;
+}
+
+int xe_matroska::read_packet(xe_packet& packet){
+	xe_reader& reader = context -> reader;
+	xe_matroska_track* track;
+	int err;
+
+	if(lace_count && lace_index)
+		return read_laced_packet(packet);
+	while(true){
+		if(!sample_size){
+			if((err = mkv_reader.read_children()))
+				return err;
+			if(!sample_size)
+				return XE_EOF;
+		}
+
+		if(sample_track < tracks.size())
+			break;
+		/* block for a track we don't know about */
+		if((err = reader.skip(sample_size)))
+			return err;
+		sample_size = 0;
+		lace_count = 0;
+	}
+
+	if(lace_count)
+		return read_laced_packet(packet);
+	track = tracks[sample_track];
+
 	if(!alloc_packet(packet, sample_size))
 		return XE_ENOMEM;
 	packet.timestamp = sample_time;
+	packet.duration = ns_to_ticks(track -> default_duration, timecode_scale);
+	packet.flags = sample_key ? XE_PACKET_FLAG_KEY : XE_PACKET_FLAG_NONE;
+	packet.track = sample_track;
 	reader.read(packet.data(), sample_size);
 	sample_size = 0;
 
@@ -1851,11 +2247,64 @@ xe_demuxer* xe_matroska_class::create(xe_format::xe_context& context) const{
 	return xe_znew<xe_matroska>(context);
 }
 
-bool xe_matroska_class::probe(xe_reader& reader) const{
-	xe_matroska_reader mkv(*(xe_matroska*)null, reader);
-	xe_matroska_id id;
+/* reads an ebml variable length integer from the probe window, returns its length or 0 */
+static uint probe_vint(xe_cbptr data, xe_cbptr end, ulong& value){
+	uint len;
+
+	if(data >= end || !data[0])
+		return 0;
+	len = __builtin_clz(data[0]) - 23;
+
+	if(data + len > end)
+		return 0;
+	value = data[0] & (0xff >> len);
+
+	for(uint i = 1; i < len; i++)
+		value = (value << 8) | data[i];
+	return len;
+}
+
+uint xe_matroska_class::probe(const xe_probe_data& probe) const{
+	xe_cbptr data = probe.data, end = probe.data + probe.size;
+	ulong id, size;
+	uint len;
+
+	if(!(len = probe_vint(data, end, id)) || id != EBML_HEADER)
+		return XE_PROBE_SCORE_NONE;
+	data += len;
+
+	if(!(len = probe_vint(data, end, size)))
+		return XE_PROBE_SCORE_WEAK;
+	data += len;
+
+	if(size < (ulong)(end - data))
+		end = data + size;
+	/* the doc type confirms the ebml stream is matroska */
+	while((len = probe_vint(data, end, id))){
+		data += len;
+
+		if(!(len = probe_vint(data, end, size)))
+			break;
+		data += len;
+
+		if(size > (ulong)(end - data))
+			break;
+		if(id == EBML_DOCTYPE){
+			if(xe_string((xe_cstr)data, size) == "matroska" || xe_string((xe_cstr)data, size) == "webm")
+				return XE_PROBE_SCORE_MAX;
+			return XE_PROBE_SCORE_NONE;
+		}
+
+		data += size;
+	}
+
+	return XE_PROBE_SCORE_LIKELY;
+}
+
+xe_cstr xe_matroska_class::extensions() const{
+	return "mkv,mka,mk3d,webm";
+}
 
-	if(mkv.read_id(id) || id != EBML_HEADER)
-		return false;
-	return true;
+xe_cstr xe_matroska_class::mime_types() const{
+	return "video/x-matroska,audio/x-matroska,video/webm,audio/webm";
 }
\ No newline at end of file
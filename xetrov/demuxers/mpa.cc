@@ -0,0 +1,430 @@
+#include "../format.h"
+#include "../demuxer.h"
+#include "../error.h"
+#include "../codecs/mp3.h"
+#include "mpa.h"
+#include "tags.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * bare mpeg audio (mp3 and mp2), optionally wrapped in id3v2 and ape tags
+ *
+ * like adts, frames are handed out whole and later headers must agree
+ * with the first one, so resyncing doesn't lock onto a false sync word
+ *
+ * vbr encoders put a xing (or "Info" for cbr) or vbri tag in an empty
+ * first frame. both carry the frame count, and a table of contents that
+ * maps time to an approximate byte offset in one step. without either,
+ * seeking walks frame headers from the start (or from the current
+ * position when seeking forward), which is exact and only touches
+ * four bytes per frame
+ */
+
+enum{
+	/* give up if no frame header is found in this many bytes */
+	RESYNC_LIMIT = 0x10000,
+
+	TAG_XING = 0x58696e67, /* "Xing" */
+	TAG_INFO = 0x496e666f, /* "Info" */
+	TAG_VBRI = 0x56425249, /* "VBRI" */
+
+	XING_FRAMES = 0x1,
+	XING_BYTES = 0x2,
+	XING_TOC = 0x4,
+	XING_TOC_SIZE = 100,
+
+	/* the vbri tag is at a fixed offset after the header */
+	VBRI_OFFSET = 32,
+	VBRI_SIZE = 26
+};
+
+class xe_mpa : public xe_demuxer{
+public:
+	xe_track* track;
+	xe_mpa_header first;
+
+	ulong data_offset;
+	/* end of the audio according to the info tag, 0 if unknown */
+	ulong data_end;
+	ulong sample_time;
+
+	/* xing and vbri tags */
+	ulong info_offset;
+	ulong info_bytes;
+	ulong info_frames;
+	byte toc[XING_TOC_SIZE];
+	bool has_toc;
+
+	/* byte offsets of each vbri table entry from data_offset */
+	ulong* vbri_offsets;
+	uint vbri_entries;
+	uint vbri_frames;
+
+	/* the last header read, still pending if a seek stopped on it */
+	uint header;
+	bool pending;
+
+	xe_mpa(xe_format::xe_context& context): xe_demuxer(context){}
+
+	bool matches(const xe_mpa_header& header){
+		return header.version == first.version && header.layer == first.layer &&
+			header.sample_rate_index == first.sample_rate_index;
+	}
+
+	int skip_tags();
+	int read_header(xe_mpa_header& out, bool any = false);
+	int read_xing(ulong left);
+	int read_vbri(ulong left);
+	int read_info();
+
+	int open();
+	int seek(uint stream, ulong pos);
+	int scan(ulong pos);
+	int read_packet(xe_packet& packet);
+
+	void reset(){}
+
+	~xe_mpa();
+};
+
+int xe_mpa::skip_tags(){
+	xe_reader& reader = context -> reader;
+	byte tag[XE_APE_HEADER_SIZE];
+	ulong size;
+	int err;
+
+	while(true){
+		reader.peek_mode(true);
+		reader.read(tag, XE_ID3_HEADER_SIZE);
+
+		if(!reader.error() && xe_is_ape(tag))
+			reader.read(tag + XE_ID3_HEADER_SIZE, XE_APE_HEADER_SIZE - XE_ID3_HEADER_SIZE);
+		reader.peek_mode(false);
+
+		if(reader.error())
+			return reader.error();
+		if(xe_is_id3(tag))
+			size = xe_id3_size(tag);
+		else if(xe_is_ape(tag))
+			size = xe_ape_size(tag);
+		else
+			return 0;
+		if((err = reader.skip(size)))
+			return err;
+	}
+}
+
+int xe_mpa::read_header(xe_mpa_header& out, bool any){
+	xe_reader& reader = context -> reader;
+	uint skipped = 0;
+
+	if(pending){
+		pending = false;
+
+		return xe_mp3::parse_header(header, out);
+	}
+
+	header = reader.r32be();
+
+	if(reader.error())
+		return reader.error();
+	while(xe_mp3::parse_header(header, out) || (!any && !matches(out))){
+		/* lost sync, or trailing tags past the end of the audio */
+		if(++skipped > RESYNC_LIMIT)
+			return data_end && reader.offset() > data_end ? XE_EOF : XE_INVALID_DATA;
+		header = (header << 8) | reader.r8();
+
+		if(reader.error())
+			return reader.error();
+	}
+
+	return 0;
+}
+
+int xe_mpa::read_xing(ulong left){
+	xe_reader& reader = context -> reader;
+	uint flags;
+
+	if(left < 4)
+		return 0;
+	flags = reader.r32be();
+	left -= 4;
+
+	if((flags & XING_FRAMES) && left >= 4){
+		info_frames = reader.r32be();
+		left -= 4;
+	}
+
+	if((flags & XING_BYTES) && left >= 4){
+		info_bytes = reader.r32be();
+		left -= 4;
+	}
+
+	if((flags & XING_TOC) && left >= XING_TOC_SIZE){
+		reader.read(toc, XING_TOC_SIZE);
+		has_toc = true;
+	}
+
+	return reader.error();
+}
+
+int xe_mpa::read_vbri(ulong left){
+	xe_reader& reader = context -> reader;
+	uint scale, entry_size, entries;
+	ulong entry;
+
+	if(left < VBRI_SIZE - 4)
+		return 0;
+	/* version, delay and quality */
+	reader.skip(6);
+	info_bytes = reader.r32be();
+	info_frames = reader.r32be();
+	entries = reader.r16be();
+	scale = reader.r16be();
+	entry_size = reader.r16be();
+	vbri_frames = reader.r16be();
+	left -= VBRI_SIZE - 4;
+
+	if(!entries || !vbri_frames || !entry_size || entry_size > 4 || (ulong)entries * entry_size > left)
+		return reader.error();
+	vbri_offsets = xe_alloc<ulong>(entries + 1);
+
+	if(!vbri_offsets)
+		return XE_ENOMEM;
+	vbri_offsets[0] = 0;
+
+	for(uint i = 0; i < entries; i++){
+		entry = 0;
+
+		for(uint j = 0; j < entry_size; j++)
+			entry = (entry << 8) | reader.r8();
+		vbri_offsets[i + 1] = vbri_offsets[i] + entry * scale;
+	}
+
+	vbri_entries = entries;
+
+	return reader.error();
+}
+
+int xe_mpa::read_info(){
+	xe_reader& reader = context -> reader;
+	ulong left;
+	uint tag, offset;
+	int err;
+
+	if((err = read_header(first, true)))
+		return err;
+	info_offset = reader.offset() - XE_MPA_HEADER_SIZE;
+
+	if(first.layer == 1)
+		return XE_ENOSYS;
+	if(first.layer != 3 || first.size < (uint)XE_MPA_HEADER_SIZE + VBRI_OFFSET + VBRI_SIZE)
+		return 0;
+	/* the xing tag follows the crc and side info, vbri is at a fixed offset */
+	offset = first.side_info + (first.crc ? 2 : 0);
+	reader.skip(offset);
+	tag = reader.r32be();
+	left = first.size - XE_MPA_HEADER_SIZE - offset - 4;
+
+	if(tag == TAG_XING || tag == TAG_INFO)
+		return read_xing(left);
+	if(offset < VBRI_OFFSET){
+		reader.skip(VBRI_OFFSET - offset - 4);
+		tag = reader.r32be();
+		left = first.size - XE_MPA_HEADER_SIZE - VBRI_OFFSET - 4;
+	}
+
+	if(tag == TAG_VBRI)
+		return read_vbri(left);
+	return reader.error();
+}
+
+int xe_mpa::open(){
+	xe_reader& reader = context -> reader;
+	bool info;
+	int err;
+
+	if((err = skip_tags()))
+		return err;
+	track = xe_zalloc<xe_track>();
+
+	if(!track)
+		return XE_ENOMEM;
+	if(!context -> tracks.resize(1))
+		return XE_ENOMEM;
+	context -> tracks[0] = track;
+
+	/* the first frame is only consumed if it holds a tag */
+	reader.peek_mode(true);
+	err = read_info();
+	reader.peek_mode(false);
+
+	if(err)
+		return err;
+	info = info_frames || has_toc || vbri_offsets;
+
+	if(info && (err = reader.skip(info_offset + first.size - reader.offset())))
+		return err;
+	data_offset = reader.offset();
+
+	if(info_bytes > first.size)
+		data_end = info_offset + info_bytes;
+	track -> type = XE_TRACK_TYPE_AUDIO;
+	track -> codec.id = first.layer == 3 ? XE_CODEC_MP3 : XE_CODEC_MP2;
+	track -> codec.sample_rate = first.sample_rate;
+	track -> codec.channels = first.channels;
+	track -> codec.frame_size = first.samples;
+	track -> codec.bit_rate = first.bit_rate;
+	track -> timescale = first.sample_rate;
+	track -> duration = info_frames * first.samples;
+
+	if(track -> duration && info_bytes)
+		track -> codec.bit_rate = (ulong)((double)info_bytes * 8 * first.sample_rate / track -> duration);
+	return 0;
+}
+
+int xe_mpa::scan(ulong pos){
+	xe_reader& reader = context -> reader;
+	xe_mpa_header frame;
+	int err;
+
+	if(pos < sample_time){
+		if((err = reader.seek(data_offset)))
+			return err;
+		sample_time = 0;
+		pending = false;
+	}
+
+	while(true){
+		if((err = read_header(frame)))
+			return err;
+		if(sample_time + frame.samples > pos){
+			/* hand this frame out next */
+			pending = true;
+
+			return 0;
+		}
+
+		sample_time += frame.samples;
+
+		if((err = reader.skip(frame.size - XE_MPA_HEADER_SIZE)))
+			return err;
+	}
+}
+
+int xe_mpa::seek(uint stream, ulong pos){
+	xe_reader& reader = context -> reader;
+	ulong offset, total, span;
+	double percent, a, b;
+	uint i;
+
+	if(stream)
+		return XE_EINVAL;
+	total = info_frames * first.samples;
+
+	if(has_toc && total && info_bytes){
+		/* toc entries are 1/256ths of the file at each percent of the duration */
+		percent = xe_min((double)pos * 100 / total, 99.999);
+		i = (uint)percent;
+		a = toc[i];
+		b = i < XING_TOC_SIZE - 1 ? toc[i + 1] : 256;
+		offset = info_offset + (ulong)((a + (b - a) * (percent - i)) * info_bytes / 256);
+		offset = xe_max(offset, data_offset);
+		sample_time = pos;
+	}else if(vbri_offsets){
+		span = (ulong)vbri_frames * first.samples;
+		i = xe_min<ulong>(pos / span, vbri_entries);
+		offset = data_offset + vbri_offsets[i];
+		sample_time = i * span;
+	}else{
+		return scan(pos);
+	}
+
+	pending = false;
+
+	return reader.seek(offset);
+}
+
+int xe_mpa::read_packet(xe_packet& packet){
+	xe_reader& reader = context -> reader;
+	xe_mpa_header frame;
+	int err;
+
+	if((err = read_header(frame)))
+		return err;
+	if(!alloc_packet(packet, frame.size))
+		return XE_ENOMEM;
+	packet.data()[0] = header >> 24;
+	packet.data()[1] = header >> 16;
+	packet.data()[2] = header >> 8;
+	packet.data()[3] = header;
+	reader.read(packet.data() + XE_MPA_HEADER_SIZE, frame.size - XE_MPA_HEADER_SIZE);
+
+	packet.timestamp = sample_time;
+	packet.duration = frame.samples;
+	packet.timescale = frame.sample_rate;
+	packet.flags = XE_PACKET_FLAG_KEY;
+	packet.track = 0;
+	sample_time += frame.samples;
+
+	return reader.error();
+}
+
+xe_mpa::~xe_mpa(){
+	xe_dealloc(vbri_offsets);
+	xe_dealloc(track);
+}
+
+xe_demuxer* xe_mpa_class::create(xe_format::xe_context& context) const{
+	return xe_znew<xe_mpa>(context);
+}
+
+uint xe_mpa_class::probe(const xe_probe_data& probe) const{
+	xe_mpa_header first, next;
+	xe_cbptr data;
+	ulong offset = 0;
+	uint frames = 0;
+
+	while(offset + XE_APE_HEADER_SIZE <= probe.size){
+		data = probe.data + offset;
+
+		if(xe_is_id3(data))
+			offset += xe_id3_size(data);
+		else if(xe_is_ape(data))
+			offset += xe_ape_size(data);
+		else
+			break;
+	}
+
+	/* a tag running past the window hides the stream, but usually fronts mp3 */
+	if(offset >= probe.size)
+		return offset > probe.size ? XE_PROBE_SCORE_WEAK : XE_PROBE_SCORE_NONE;
+	while(offset + XE_MPA_HEADER_SIZE <= probe.size){
+		data = probe.data + offset;
+
+		/* layer I has no decoder here */
+		if(xe_mp3::parse_header((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3], next) ||
+			next.layer == 1 || next.size < XE_MPA_HEADER_SIZE)
+			break;
+		if(!frames)
+			first = next;
+		else if(next.version != first.version || next.layer != first.layer || next.sample_rate_index != first.sample_rate_index)
+			break;
+		frames++;
+		offset += next.size;
+	}
+
+	/* a single sync word is weak, each frame that follows adds confidence */
+	return xe_min(frames * XE_PROBE_SCORE_WEAK, (uint)XE_PROBE_SCORE_MAX);
+}
+
+xe_cstr xe_mpa_class::extensions() const{
+	return "mp3,mp2,mpa,mpga";
+}
+
+xe_cstr xe_mpa_class::mime_types() const{
+	return "audio/mpeg,audio/mp3,audio/x-mpeg,audio/mpa";
+}
@@ -0,0 +1,899 @@
+#include "../format.h"
+#include "../demuxer.h"
+#include "../error.h"
+#include "../codecs/opus.h"
+#include "../codecs/flac.h"
+#include "../codecs/vorbis.h"
+#include "ogg.h"
+#include "xe/mem.h"
+#include "xe/container/vector.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * a page's packets are read straight from the reader into one pooled
+ * buffer, each followed by its own XE_BUFFER_PADDING, and handed out
+ * as slices that reference it. this lets the page crc be checked
+ * before any of its packets are returned
+ *
+ * the tail of a packet that continues on the next page is kept in a
+ * per stream buffer. once the packet completes it is copied once into
+ * a pooled buffer, and its last piece is read directly after it
+ *
+ * a page's granule position is the end time of its last completed
+ * packet. packet durations are known, so timestamps are exact even
+ * right after a seek. a vorbis packet's duration depends on the one
+ * before it, so the first packet of the stream or after a seek has none
+ *
+ * seeking bisects pages by granule. the stream size isn't known, so an
+ * upper bound is found by galloping forward from the first data page.
+ * each probe only requests a bounded byte range from the stream
+ *
+ * a chained stream (a new bos page after the headers, as sent by
+ * internet radio between songs) is followed when there is a single
+ * track. timestamps continue from the end of the previous link. the
+ * decoder isn't reopened, so a link whose headers configure it
+ * differently (other than opus pre-skip, or vorbis comments and
+ * bitrates) ends the stream with XE_ENOSYS. links aren't indexed, so
+ * once one has been followed the stream can't be seeked
+ */
+
+enum{
+	PAGE_HEADER_SIZE = 27,
+	PAGE_MAGIC = 0x4f676753, /* "OggS" */
+	PAGE_MAX_SEGMENTS = 255,
+	PAGE_MAX_SIZE = PAGE_HEADER_SIZE + PAGE_MAX_SEGMENTS + PAGE_MAX_SEGMENTS * 255,
+
+	PAGE_CONTINUED = 0x1,
+	PAGE_BOS = 0x2,
+
+	/* give up if no page is found in this many bytes */
+	RESYNC_LIMIT = 0x10000,
+	/* bytes searched for a page at each bisection step */
+	SEEK_WINDOW = 0x10000,
+
+	OPUS_HEAD_SIZE = 19,
+	OPUS_HEAD_PRE_SKIP = 10,
+	OPUS_HEAD_GAIN = 16,
+	VORBIS_ID_SIZE = 30,
+	VORBIS_ID_BITRATES = 16,
+	VORBIS_ID_BLOCKSIZES = 28,
+	VORBIS_HEADERS = 3,
+	/* 0x7f "FLAC", version, header count, then "fLaC" and STREAMINFO */
+	FLAC_HEAD_SIZE = 13 + 4 + 34
+};
+
+static constexpr ulong NO_GRANULE = ~0ul;
+
+static const struct xe_crc32_table{
+	uint value[256];
+
+	constexpr xe_crc32_table(): value(){
+		for(uint i = 0; i < 256; i++){
+			uint crc = i << 24;
+
+			for(uint j = 0; j < 8; j++)
+				crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+			value[i] = crc;
+		}
+	}
+} crc32_table;
+
+static uint crc32(xe_cbptr data, size_t size, uint crc){
+	for(size_t i = 0; i < size; i++)
+		crc = (crc << 8) ^ crc32_table.value[(crc >> 24) ^ data[i]];
+	return crc;
+}
+
+static uint le32(xe_cbptr data){
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint)data[3] << 24);
+}
+
+static ulong le64(xe_cbptr data){
+	return le32(data) | ((ulong)le32(data + 4) << 32);
+}
+
+static bool has_prefix(xe_cbptr data, size_t size, xe_cstr prefix, size_t len){
+	if(size < len)
+		return false;
+	for(size_t i = 0; i < len; i++){
+		if(data[i] != (byte)prefix[i])
+			return false;
+	}
+
+	return true;
+}
+
+static bool same_bytes(xe_cbptr a, xe_cbptr b, size_t size){
+	for(size_t i = 0; i < size; i++){
+		if(a[i] != b[i])
+			return false;
+	}
+
+	return true;
+}
+
+struct xe_ogg_stream : public xe_track{
+	uint serial;
+	uint index;
+	/* header packets still expected */
+	uint headers;
+	bool identified;
+
+	/* end of the last page, NO_GRANULE if unknown */
+	ulong granule;
+	/* added to timestamps after a chain boundary */
+	ulong time_offset;
+	/* end of the last packet, timestamps included */
+	ulong time_end;
+
+	/* start of a packet that continues on the next page */
+	xe_array<byte> partial;
+	size_t partial_size;
+
+	/* vorbis headers, kept until the config is built */
+	xe_array<byte> header_data;
+	uint header_sizes[VORBIS_HEADERS];
+	uint header_count;
+	/* block sizes of vorbis packets, and the last packet's */
+	xe_vorbis_info vorbis;
+	uint block_size;
+
+	bool reserve_partial(size_t size){
+		return size <= partial.size() || partial.resize(xe_max(size, partial.size() * 2));
+	}
+
+	void free(){
+		partial.free();
+		header_data.free();
+
+		xe_dealloc(codec.config.data());
+	}
+};
+
+struct xe_ogg_packet{
+	xe_bptr data;
+	uint size;
+	bool spanned;
+	ulong timestamp;
+	ulong duration;
+};
+
+class xe_ogg : public xe_demuxer{
+public:
+	xe_vector<xe_ogg_stream*> streams;
+	ulong data_offset;
+	bool opened;
+	/* a new link was followed */
+	bool chained;
+	/* a new link needs the decoder reconfigured */
+	bool changed;
+
+	struct{
+		ulong offset;
+		ulong granule;
+		uint serial;
+		uint crc;
+		uint segments;
+		uint body_size;
+		byte flags;
+	} page;
+
+	byte header[PAGE_HEADER_SIZE];
+	byte lacing[PAGE_MAX_SEGMENTS];
+
+	/* completed packets of the current page */
+	xe_ogg_packet packets[PAGE_MAX_SEGMENTS];
+	uint packet_count;
+	uint packet_index;
+	xe_ogg_stream* page_stream;
+	xe_buffer_ref page_ref;
+	xe_buffer_ref span_ref;
+
+	xe_ogg(xe_format::xe_context& context): xe_demuxer(context){}
+
+	xe_ogg_stream* find_stream(uint serial){
+		for(auto stream : streams){
+			if(stream -> serial == serial)
+				return stream;
+		}
+
+		return null;
+	}
+
+	bool headers_pending(){
+		for(auto stream : streams){
+			if(stream -> headers)
+				return true;
+		}
+
+		return false;
+	}
+
+	ulong page_end(){
+		return page.offset + PAGE_HEADER_SIZE + page.segments + page.body_size;
+	}
+
+	void clear_page(){
+		packet_count = 0;
+		packet_index = 0;
+		page_ref.unref();
+		span_ref.unref();
+	}
+
+	int begin_stream(xe_ogg_stream*& stream);
+	int identify(xe_ogg_stream& stream, xe_cbptr data, size_t size);
+	int read_header(xe_ogg_stream& stream, xe_cbptr data, size_t size);
+	int build_vorbis_config(xe_ogg_stream& stream);
+	int compare_config(xe_ogg_stream& stream, xe_cbptr data, size_t size);
+	int compare_vorbis_config(xe_ogg_stream& stream);
+	ulong packet_duration(xe_ogg_stream& stream, xe_cbptr data, size_t size);
+	void stamp_packets(xe_ogg_stream& stream, uint start);
+
+	int read_page_header();
+	int read_body(xe_ogg_stream& stream);
+	int read_page();
+	int probe_page(ulong offset, uint serial, ulong& found);
+
+	int open();
+	int seek(uint stream, ulong pos);
+	int read_packet(xe_packet& packet);
+
+	void reset(){}
+
+	~xe_ogg();
+};
+
+int xe_ogg::begin_stream(xe_ogg_stream*& stream){
+	if(opened){
+		/* a new link in a chained stream */
+		if(streams.size() != 1)
+			return 0;
+		chained = true;
+		stream = streams[0];
+		stream -> serial = page.serial;
+		stream -> identified = false;
+		stream -> headers = 1;
+		stream -> granule = NO_GRANULE;
+		stream -> time_offset = stream -> time_end;
+		stream -> partial_size = 0;
+		stream -> header_count = 0;
+
+		return 0;
+	}
+
+	stream = xe_zalloc<xe_ogg_stream>();
+
+	if(!stream)
+		return XE_ENOMEM;
+	if(!streams.push_back(stream)){
+		xe_dealloc(stream);
+
+		return XE_ENOMEM;
+	}
+
+	stream -> serial = page.serial;
+	stream -> index = streams.size() - 1;
+	stream -> headers = 1;
+	stream -> granule = NO_GRANULE;
+	stream -> parse = XE_PARSE_HEADER;
+
+	return 0;
+}
+
+int xe_ogg::identify(xe_ogg_stream& stream, xe_cbptr data, size_t size){
+	xe_codec_id id;
+	xe_cbptr info;
+	uint headers;
+
+	if(size >= OPUS_HEAD_SIZE && has_prefix(data, size, "OpusHead", 8)){
+		id = XE_CODEC_OPUS;
+		headers = 1;
+	}else if(size >= VORBIS_ID_SIZE && has_prefix(data, size, "\x01vorbis", 7)){
+		id = XE_CODEC_VORBIS;
+		headers = VORBIS_HEADERS - 1;
+	}else if(size >= FLAC_HEAD_SIZE && has_prefix(data, size, "\x7f" "FLAC", 5) && has_prefix(data + 9, size - 9, "fLaC", 4)){
+		id = XE_CODEC_FLAC;
+		/* an unknown count still has at least the vorbis comment */
+		headers = (data[7] << 8) | data[8];
+		headers = headers ? headers : 1;
+	}else{
+		id = XE_CODEC_NONE;
+		headers = 0;
+	}
+
+	stream.identified = true;
+	stream.headers = headers;
+
+	if(opened){
+		/* chained, the decoder keeps its configuration */
+		if(id == stream.codec.id)
+			return compare_config(stream, data, size);
+		changed = true;
+
+		return XE_ENOSYS;
+	}
+
+	stream.codec.id = id;
+
+	switch(id){
+		case XE_CODEC_OPUS:
+			stream.codec.channels = data[9];
+			stream.codec.sample_rate = XE_OPUS_SAMPLE_RATE;
+
+			if(!stream.codec.alloc_config(size))
+				return XE_ENOMEM;
+			xe_memcpy(stream.codec.config.data(), data, size);
+
+			break;
+		case XE_CODEC_VORBIS:
+			stream.codec.channels = data[11];
+			stream.codec.sample_rate = le32(data + 12);
+
+			return read_header(stream, data, size);
+		case XE_CODEC_FLAC:
+			info = data + 17;
+			stream.codec.sample_rate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+			stream.codec.channels = ((info[12] >> 1) & 0x7) + 1;
+			stream.codec.bits_per_sample = (((info[12] & 0x1) << 4) | (info[13] >> 4)) + 1;
+
+			/* the config is "fLaC" and the STREAMINFO block */
+			if(!stream.codec.alloc_config(size - 9))
+				return XE_ENOMEM;
+			xe_memcpy(stream.codec.config.data(), data + 9, size - 9);
+
+			break;
+		default:
+			stream.type = XE_TRACK_TYPE_OTHER;
+			stream.parse = XE_PARSE_NONE;
+			stream.discard = XE_DISCARD_ALL;
+
+			return 0;
+	}
+
+	if(!stream.codec.sample_rate)
+		return XE_INVALID_DATA;
+	stream.type = XE_TRACK_TYPE_AUDIO;
+	stream.timescale = stream.codec.sample_rate;
+
+	return 0;
+}
+
+int xe_ogg::read_header(xe_ogg_stream& stream, xe_cbptr data, size_t size){
+	size_t used = 0;
+
+	if(stream.codec.id != XE_CODEC_VORBIS)
+		return 0;
+	/* collect all three headers for the xiph laced config */
+	for(uint i = 0; i < stream.header_count; i++)
+		used += stream.header_sizes[i];
+	if(!stream.header_data.resize(used + size))
+		return XE_ENOMEM;
+	xe_memcpy(stream.header_data.data() + used, data, size);
+
+	stream.header_sizes[stream.header_count++] = size;
+
+	if(stream.header_count < VORBIS_HEADERS)
+		return 0;
+	return opened ? compare_vorbis_config(stream) : build_vorbis_config(stream);
+}
+
+int xe_ogg::build_vorbis_config(xe_ogg_stream& stream){
+	size_t size = 1 + stream.header_data.size();
+	xe_bptr out;
+
+	for(uint i = 0; i < VORBIS_HEADERS - 1; i++)
+		size += stream.header_sizes[i] / 255 + 1;
+	if(!stream.codec.alloc_config(size))
+		return XE_ENOMEM;
+	out = stream.codec.config.data();
+	*out++ = VORBIS_HEADERS - 1;
+
+	for(uint i = 0; i < VORBIS_HEADERS - 1; i++){
+		for(uint j = 0; j < stream.header_sizes[i] / 255; j++)
+			*out++ = 255;
+		*out++ = stream.header_sizes[i] % 255;
+	}
+
+	xe_memcpy(out, stream.header_data.data(), stream.header_data.size());
+
+	stream.header_data.free();
+	/* packets stay untimed if the setup header can't be read */
+	xe_vorbis::parse_config(stream.codec.config.data(), size, stream.vorbis);
+
+	return 0;
+}
+
+int xe_ogg::compare_config(xe_ogg_stream& stream, xe_cbptr data, size_t size){
+	xe_cbptr config = stream.codec.config.data(), info;
+	size_t config_size = stream.codec.config.size();
+	bool same;
+
+	switch(stream.codec.id){
+		case XE_CODEC_OPUS:
+			/* pre-skip only trims the start of the stream */
+			same = size >= OPUS_HEAD_SIZE && size == config_size &&
+				same_bytes(data, config, OPUS_HEAD_PRE_SKIP) &&
+				same_bytes(data + OPUS_HEAD_GAIN, config + OPUS_HEAD_GAIN, size - OPUS_HEAD_GAIN);
+
+			break;
+		case XE_CODEC_VORBIS:
+			/* compared once all three headers are in */
+			return read_header(stream, data, size);
+		case XE_CODEC_FLAC:
+			info = data + 17;
+			same = stream.codec.sample_rate == (uint)((info[10] << 12) | (info[11] << 4) | (info[12] >> 4)) &&
+				stream.codec.channels == ((info[12] >> 1) & 0x7) + 1u &&
+				stream.codec.bits_per_sample == (((info[12] & 0x1) << 4) | (info[13] >> 4)) + 1u;
+
+			break;
+		default:
+			/* not decoded */
+			same = true;
+
+			break;
+	}
+
+	if(same)
+		return 0;
+	changed = true;
+
+	return XE_ENOSYS;
+}
+
+int xe_ogg::compare_vorbis_config(xe_ogg_stream& stream){
+	xe_cbptr config = stream.codec.config.data(), data = stream.header_data.data();
+	size_t config_size = stream.codec.config.size(), sizes[VORBIS_HEADERS - 1], offset = 1, setup;
+	bool same = false;
+
+	/* split the xiph laced config into the identification and setup headers */
+	for(uint i = 0; i < VORBIS_HEADERS - 1; i++){
+		sizes[i] = 0;
+
+		while(offset < config_size && config[offset] == 255)
+			sizes[i] += config[offset++];
+		if(offset < config_size)
+			sizes[i] += config[offset++];
+	}
+
+	setup = offset + sizes[0] + sizes[1];
+
+	/* the bitrates are only hints, the rest of the identification header and
+	 * the codebooks in the setup header configure the decoder */
+	if(setup <= config_size && sizes[0] >= VORBIS_ID_SIZE){
+		same = same_bytes(data, config + offset, VORBIS_ID_BITRATES) &&
+			data[VORBIS_ID_BLOCKSIZES] == config[offset + VORBIS_ID_BLOCKSIZES] &&
+			stream.header_sizes[2] == config_size - setup &&
+			same_bytes(data + stream.header_sizes[0] + stream.header_sizes[1], config + setup, config_size - setup);
+	}
+
+	stream.header_data.free();
+
+	if(same)
+		return 0;
+	changed = true;
+
+	return XE_ENOSYS;
+}
+
+ulong xe_ogg::packet_duration(xe_ogg_stream& stream, xe_cbptr data, size_t size){
+	xe_flac_frame frame;
+	uint last;
+
+	switch(stream.codec.id){
+		case XE_CODEC_OPUS:
+			return xe_opus::packet_samples(data, size);
+		case XE_CODEC_FLAC:
+			return xe_flac::parse_header(data, size, frame) < 0 ? 0 : frame.block_size;
+		case XE_CODEC_VORBIS:
+			/* half of each window overlaps the next packet's */
+			last = stream.block_size;
+			stream.block_size = xe_vorbis::block_size(stream.vorbis, data, size);
+
+			return last && stream.block_size ? last / 4 + stream.block_size / 4 : 0;
+		default:
+			return 0;
+	}
+}
+
+void xe_ogg::stamp_packets(xe_ogg_stream& stream, uint start){
+	ulong total = 0, time;
+	bool known = true;
+
+	for(uint i = start; i < packet_count; i++){
+		packets[i].duration = packet_duration(stream, packets[i].data, packets[i].size);
+		total += packets[i].duration;
+
+		if(!packets[i].duration)
+			known = false;
+	}
+
+	if(stream.granule != NO_GRANULE)
+		time = stream.granule;
+	else if(page.granule == NO_GRANULE)
+		time = 0;
+	else if(known && page.granule >= total)
+		/* count back from the end of the page */
+		time = page.granule - total;
+	else
+		time = page.granule;
+	for(uint i = start; i < packet_count; i++){
+		packets[i].timestamp = time + stream.time_offset;
+		time += packets[i].duration;
+	}
+
+	if(page.granule != NO_GRANULE)
+		stream.granule = page.granule;
+	else if(known && stream.granule != NO_GRANULE)
+		stream.granule = time;
+	stream.time_end = time + stream.time_offset;
+}
+
+int xe_ogg::read_page_header(){
+	xe_reader& reader = context -> reader;
+	uint magic, skipped = 0;
+
+	magic = reader.r32be();
+
+	while(true){
+		while(magic != PAGE_MAGIC){
+			if(reader.error())
+				return reader.error();
+			if(++skipped > RESYNC_LIMIT)
+				return XE_INVALID_DATA;
+			magic = (magic << 8) | reader.r8();
+		}
+
+		header[0] = 'O';
+		header[1] = 'g';
+		header[2] = 'g';
+		header[3] = 'S';
+
+		if(reader.read(header + 4, PAGE_HEADER_SIZE - 4))
+			return reader.error();
+		/* only version 0 exists, anything else is a false capture pattern */
+		if(!header[4])
+			break;
+		magic = 0;
+	}
+
+	page.flags = header[5];
+	page.granule = le64(header + 6);
+	page.serial = le32(header + 14);
+	page.crc = le32(header + 22);
+	page.segments = header[26];
+	page.body_size = 0;
+
+	if(reader.read(lacing, page.segments))
+		return reader.error();
+	for(uint i = 0; i < page.segments; i++)
+		page.body_size += lacing[i];
+	page.offset = reader.offset() - PAGE_HEADER_SIZE - page.segments;
+
+	return 0;
+}
+
+int xe_ogg::read_body(xe_ogg_stream& stream){
+	xe_reader& reader = context -> reader;
+	uint sizes[PAGE_MAX_SEGMENTS];
+	uint count = 0, size = 0, start = 0, crc = 0;
+	size_t total = 0, pieces = 0;
+	xe_packet scratch;
+	xe_bptr data = null;
+	bool tail, continued, verify = context -> verify_checksums;
+	int err;
+
+	/* split the body into pieces, the last one may continue on the next page */
+	for(uint i = 0; i < page.segments; i++){
+		size += lacing[i];
+
+		if(lacing[i] < 255){
+			sizes[count++] = size;
+			size = 0;
+		}
+	}
+
+	tail = page.segments && lacing[page.segments - 1] == 255;
+	continued = page.flags & PAGE_CONTINUED;
+
+	if(tail)
+		sizes[count++] = size;
+	if(!continued)
+		/* the continuation was lost */
+		stream.partial_size = 0;
+	if(verify){
+		byte copy[PAGE_HEADER_SIZE];
+
+		xe_memcpy(copy, header, PAGE_HEADER_SIZE);
+		xe_zero(copy + 22, 4);
+
+		crc = crc32(copy, PAGE_HEADER_SIZE, 0);
+		crc = crc32(lacing, page.segments, crc);
+	}
+
+	/* pieces that are whole packets share one pooled buffer */
+	for(uint i = continued ? 1 : 0; i < count - (tail ? 1 : 0); i++){
+		total += sizes[i] + XE_BUFFER_PADDING;
+		pieces++;
+	}
+
+	if(pieces){
+		if(!alloc_packet(scratch, total - XE_BUFFER_PADDING))
+			return XE_ENOMEM;
+		page_ref.ref(scratch.ref);
+		data = scratch.data();
+	}
+
+	for(uint i = 0; i < count; i++){
+		bool first = i == 0 && continued, last = i == count - 1 && tail;
+
+		size = sizes[i];
+
+		if(first && !last && stream.partial_size){
+			/* the packet is complete, join it in a pooled buffer */
+			if(!alloc_packet(scratch, stream.partial_size + size))
+				return XE_ENOMEM;
+			span_ref.ref(scratch.ref);
+
+			xe_memcpy(scratch.data(), stream.partial.data(), stream.partial_size);
+
+			if(reader.read(scratch.data() + stream.partial_size, size))
+				return reader.error();
+			if(verify)
+				crc = crc32(scratch.data() + stream.partial_size, size, crc);
+			packets[packet_count++] = {scratch.data(), (uint)(stream.partial_size + size), true};
+			stream.partial_size = 0;
+
+			continue;
+		}
+
+		if(first || last){
+			/* pieces of a packet that continues on the next page. a continuation
+			 * with nothing before it (after a seek) is read and dropped */
+			start = first ? stream.partial_size : 0;
+
+			if(!stream.reserve_partial(start + size))
+				return XE_ENOMEM;
+			if(reader.read(stream.partial.data() + start, size))
+				return reader.error();
+			if(verify)
+				crc = crc32(stream.partial.data() + start, size, crc);
+			stream.partial_size = last && (start || !first) ? start + size : 0;
+
+			continue;
+		}
+
+		if(reader.read(data, size))
+			return reader.error();
+		if(verify)
+			crc = crc32(data, size, crc);
+		xe_zero(data + size, XE_BUFFER_PADDING);
+		packets[packet_count++] = {data, size, false};
+		data += size + XE_BUFFER_PADDING;
+	}
+
+	if(verify && crc != page.crc){
+		/* corrupt page, drop it along with anything spanning it */
+		clear_page();
+		stream.partial_size = 0;
+
+		return 0;
+	}
+
+	page_stream = &stream;
+	start = 0;
+
+	while(stream.headers && start < packet_count){
+		if(!stream.identified){
+			err = identify(stream, packets[start].data, packets[start].size);
+		}else{
+			stream.headers--;
+			err = read_header(stream, packets[start].data, packets[start].size);
+		}
+
+		if(err)
+			return err;
+		start++;
+	}
+
+	packet_index = start;
+
+	if(stream.discard == XE_DISCARD_ALL)
+		packet_index = packet_count;
+	else if(packet_index < packet_count)
+		stamp_packets(stream, packet_index);
+	else if(!stream.headers && stream.codec.id == XE_CODEC_VORBIS && page.granule != NO_GRANULE)
+		/* the first vorbis packet has no duration, start from the header page's granule */
+		stream.granule = page.granule;
+	return 0;
+}
+
+int xe_ogg::read_page(){
+	xe_reader& reader = context -> reader;
+	xe_ogg_stream* stream;
+	int err;
+
+	clear_page();
+
+	if((err = read_page_header()))
+		return err;
+	stream = find_stream(page.serial);
+
+	if(!stream && (page.flags & PAGE_BOS) && (err = begin_stream(stream)))
+		return err;
+	if(!stream || (!stream -> headers && stream -> discard == XE_DISCARD_ALL)){
+		if(stream)
+			stream -> partial_size = 0;
+		return reader.skip(page.body_size);
+	}
+
+	return read_body(*stream);
+}
+
+int xe_ogg::probe_page(ulong offset, uint serial, ulong& found){
+	xe_reader& reader = context -> reader;
+	int err;
+
+	if((err = reader.seek(offset, offset + SEEK_WINDOW + PAGE_MAX_SIZE)))
+		return err;
+	while(true){
+		if((err = read_page_header()))
+			return err;
+		if(page.offset >= offset + SEEK_WINDOW)
+			return XE_EOF;
+		if(page.serial == serial && page.granule != NO_GRANULE){
+			found = page.offset;
+
+			return 0;
+		}
+
+		if((err = reader.skip(page.body_size)))
+			return err;
+	}
+}
+
+int xe_ogg::open(){
+	int err;
+
+	do{
+		if((err = read_page()))
+			return err;
+		if(packet_index < packet_count)
+			break;
+	}while(!streams.size() || (page.flags & PAGE_BOS) || headers_pending());
+
+	data_offset = packet_index < packet_count ? page.offset : context -> reader.offset();
+
+	if(!context -> tracks.resize(streams.size()))
+		return XE_ENOMEM;
+	for(uint i = 0; i < streams.size(); i++)
+		context -> tracks[i] = streams[i];
+	opened = true;
+
+	return 0;
+}
+
+int xe_ogg::seek(uint index, ulong pos){
+	xe_reader& reader = context -> reader;
+	xe_ogg_stream* stream;
+	ulong low, high, mid, found, step, best, granule;
+	int err;
+
+	if(index >= streams.size())
+		return XE_EINVAL;
+	/* the pages from data_offset belong to the first link */
+	if(chained)
+		return XE_ENOSYS;
+	stream = streams[index];
+
+	/* low is always a page start at or before the target */
+	low = data_offset;
+	high = 0;
+	step = SEEK_WINDOW;
+
+	/* gallop forward for an upper bound, a failed probe
+	 * (usually past the end of the stream) bounds it too */
+	while(!high){
+		err = probe_page(low + step, stream -> serial, found);
+
+		if(err || page.granule > pos)
+			high = err ? low + step : found;
+		else{
+			low = found;
+			step <<= 1;
+		}
+	}
+
+	while(high - low > SEEK_WINDOW){
+		mid = low + (high - low) / 2;
+		err = probe_page(mid, stream -> serial, found);
+
+		if(!err && found < high && page.granule <= pos)
+			low = found;
+		else
+			high = mid;
+	}
+
+	/* walk the remaining pages for the last one that ends at or before the target */
+	best = low;
+	granule = NO_GRANULE;
+
+	if((err = reader.seek(low)))
+		return err;
+	while(!read_page_header() && page.offset <= high + SEEK_WINDOW){
+		if(page.serial == stream -> serial && page.granule != NO_GRANULE){
+			if(page.granule > pos)
+				break;
+			best = page_end();
+			granule = page.granule;
+		}
+
+		if(reader.skip(page.body_size))
+			break;
+	}
+
+	clear_page();
+
+	for(auto s : streams){
+		s -> granule = NO_GRANULE;
+		s -> partial_size = 0;
+		s -> block_size = 0;
+	}
+
+	/* the next page starts where the chosen one ended */
+	stream -> granule = granule;
+
+	return reader.seek(best);
+}
+
+int xe_ogg::read_packet(xe_packet& packet){
+	xe_ogg_packet* entry;
+	int err;
+
+	if(changed)
+		return XE_ENOSYS;
+	while(packet_index >= packet_count){
+		if((err = read_page()))
+			return err;
+	}
+
+	entry = &packets[packet_index++];
+	packet.unref();
+	packet.ref.ref(entry -> spanned ? span_ref : page_ref);
+	packet.buffer = xe_array<byte>(entry -> data, entry -> size);
+	packet.timestamp = entry -> timestamp;
+	packet.duration = entry -> duration;
+	packet.timescale = page_stream -> timescale;
+	packet.flags = XE_PACKET_FLAG_KEY;
+	packet.track = page_stream -> index;
+
+	return 0;
+}
+
+xe_ogg::~xe_ogg(){
+	for(auto stream : streams){
+		stream -> free();
+
+		xe_dealloc(stream);
+	}
+}
+
+xe_demuxer* xe_ogg_class::create(xe_format::xe_context& context) const{
+	return xe_znew<xe_ogg>(context);
+}
+
+uint xe_ogg_class::probe(const xe_probe_data& probe) const{
+	/* capture pattern, version 0 and a bos page */
+	if(has_prefix(probe.data, probe.size, "OggS", 4) && probe.size >= PAGE_HEADER_SIZE && !probe.data[4] && (probe.data[5] & PAGE_BOS))
+		return XE_PROBE_SCORE_MAX;
+	return XE_PROBE_SCORE_NONE;
+}
+
+xe_cstr xe_ogg_class::extensions() const{
+	return "ogg,oga,ogx,opus,spx";
+}
+
+xe_cstr xe_ogg_class::mime_types() const{
+	return "audio/ogg,application/ogg,audio/opus,audio/vorbis";
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "../types.h"
+
+namespace xetrov{
+
+/* metadata tags that prefix elementary streams, which demuxers skip over */
+
+enum{
+	XE_ID3_HEADER_SIZE = 10,
+	XE_APE_HEADER_SIZE = 32
+};
+
+static inline bool xe_is_id3(xe_cbptr header){
+	return header[0] == 'I' && header[1] == 'D' && header[2] == '3';
+}
+
+/* size of an id3v2 tag including its header and footer, needs XE_ID3_HEADER_SIZE bytes */
+static inline ulong xe_id3_size(xe_cbptr header){
+	ulong size = ((header[6] & 0x7f) << 21) | ((header[7] & 0x7f) << 14) | ((header[8] & 0x7f) << 7) | (header[9] & 0x7f);
+
+	if(header[5] & 0x10)
+		size += XE_ID3_HEADER_SIZE;
+	return size + XE_ID3_HEADER_SIZE;
+}
+
+static inline bool xe_is_ape(xe_cbptr header){
+	return header[0] == 'A' && header[1] == 'P' && header[2] == 'E' && header[3] == 'T' &&
+		header[4] == 'A' && header[5] == 'G' && header[6] == 'E' && header[7] == 'X';
+}
+
+/* size of an ape tag starting with its header, needs XE_APE_HEADER_SIZE bytes */
+static inline ulong xe_ape_size(xe_cbptr header){
+	/* the size field counts the items and the footer */
+	return (header[12] | (header[13] << 8) | (header[14] << 16) | ((ulong)header[15] << 24)) + XE_APE_HEADER_SIZE;
+}
+
+}
@@ -0,0 +1,420 @@
+#include <math.h>
+#include "../format.h"
+#include "../demuxer.h"
+#include "../error.h"
+#include "../pool.h"
+#include "../codecs/pcm.h"
+#include "wav.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * riff wave (with WAVE_FORMAT_EXTENSIBLE, rf64 and bw64) and aiff/aifc
+ *
+ * both are a header followed by one block of interleaved samples, so
+ * packets are cut at a fixed number of frames sized to fill a pooled
+ * packet buffer, and seeking is a multiplication
+ *
+ * the packets decode through xe_pcm, which turns them into frames that
+ * point into the packet buffer instead of going through libavcodec
+ */
+
+static constexpr uint make_tag(xe_cstr str){
+	return ((uint)str[0] << 24) | ((uint)str[1] << 16) | ((uint)str[2] << 8) | (uint)str[3];
+}
+
+enum{
+	TAG_RIFF = make_tag("RIFF"),
+	TAG_RF64 = make_tag("RF64"),
+	TAG_BW64 = make_tag("BW64"),
+	TAG_WAVE = make_tag("WAVE"),
+	TAG_FMT = make_tag("fmt "),
+	TAG_DS64 = make_tag("ds64"),
+	TAG_DATA = make_tag("data"),
+
+	TAG_FORM = make_tag("FORM"),
+	TAG_AIFF = make_tag("AIFF"),
+	TAG_AIFC = make_tag("AIFC"),
+	TAG_COMM = make_tag("COMM"),
+	TAG_SSND = make_tag("SSND"),
+	TAG_NONE = make_tag("NONE"),
+	TAG_TWOS = make_tag("twos"),
+	TAG_SOWT = make_tag("sowt"),
+	TAG_FL32 = make_tag("fl32"),
+	TAG_FL32_UPPER = make_tag("FL32"),
+	TAG_FL64 = make_tag("fl64"),
+	TAG_FL64_UPPER = make_tag("FL64"),
+
+	WAVE_FORMAT_PCM = 0x1,
+	WAVE_FORMAT_IEEE_FLOAT = 0x3,
+	WAVE_FORMAT_EXTENSIBLE = 0xfffe,
+
+	/* largest packet that still leaves room for padding in a pooled buffer */
+	PACKET_SIZE = xe_packet_buffer_pool::XE_BUFFER_SIZE - 2 * XE_BUFFER_PADDING
+};
+
+static const uint unknown_size = 0xffffffff;
+
+class xe_pcm_demuxer : public xe_demuxer{
+public:
+	xe_track* track;
+	ulong data_offset;
+	/* 0 if the data runs to the end of the stream */
+	ulong data_end;
+	ulong sample_time;
+	uint block_align;
+	uint packet_size;
+
+	xe_pcm_demuxer(xe_format::xe_context& context): xe_demuxer(context){}
+
+	int alloc_track(){
+		track = xe_zalloc<xe_track>();
+
+		if(!track)
+			return XE_ENOMEM;
+		if(!context -> tracks.resize(1))
+			return XE_ENOMEM;
+		context -> tracks[0] = track;
+
+		return 0;
+	}
+
+	int start(xe_codec_id id, uint channels, uint sample_rate, ulong data_size){
+		xe_codec_parameters& codec = track -> codec;
+
+		if(id == XE_CODEC_NONE)
+			return XE_ENOSYS;
+		if(!channels || !sample_rate)
+			return XE_INVALID_DATA;
+		block_align = xe_pcm::sample_size(id) * channels;
+		packet_size = xe_max(PACKET_SIZE / block_align, 1u) * block_align;
+		data_offset = context -> reader.offset();
+		data_end = data_size ? data_offset + data_size : 0;
+
+		track -> type = XE_TRACK_TYPE_AUDIO;
+		track -> timescale = sample_rate;
+		track -> duration = data_size / block_align;
+		codec.id = id;
+		codec.channels = channels;
+		codec.sample_rate = sample_rate;
+		codec.bits_per_sample = xe_pcm::sample_size(id) * 8;
+		codec.format = xe_pcm::sample_format(id);
+		codec.bit_rate = (ulong)block_align * sample_rate * 8;
+
+		if(!codec.channel_layout)
+			codec.channel_layout = xe_default_channel_layout(channels);
+		return 0;
+	}
+
+	int seek(uint stream, ulong pos){
+		ulong offset;
+
+		if(stream)
+			return XE_EINVAL;
+		offset = data_offset + pos * block_align;
+
+		if(data_end && offset > data_end){
+			pos = (data_end - data_offset) / block_align;
+			offset = data_offset + pos * block_align;
+		}
+
+		sample_time = pos;
+
+		return context -> reader.seek(offset);
+	}
+
+	int read_packet(xe_packet& packet){
+		xe_reader& reader = context -> reader;
+		ulong size = packet_size, offset = reader.offset();
+
+		if(data_end){
+			if(offset >= data_end)
+				return XE_EOF;
+			/* a trailing partial frame is dropped */
+			size = xe_min(size, (data_end - offset) / block_align * block_align);
+
+			if(!size)
+				return XE_EOF;
+		}
+
+		if(!alloc_packet(packet, size))
+			return XE_ENOMEM;
+		if(reader.read(packet.data(), size))
+			return reader.error();
+		packet.timestamp = sample_time;
+		packet.duration = size / block_align;
+		packet.timescale = track -> timescale;
+		packet.flags = XE_PACKET_FLAG_KEY;
+		packet.track = 0;
+		sample_time += packet.duration;
+
+		return 0;
+	}
+
+	void reset(){}
+
+	~xe_pcm_demuxer(){
+		xe_dealloc(track);
+	}
+};
+
+class xe_wav : public xe_pcm_demuxer{
+public:
+	xe_wav(xe_format::xe_context& context): xe_pcm_demuxer(context){}
+
+	static xe_codec_id codec_id(uint format, uint bits){
+		if(format == WAVE_FORMAT_IEEE_FLOAT){
+			if(bits == 32)
+				return XE_CODEC_PCM_F32LE;
+			if(bits == 64)
+				return XE_CODEC_PCM_F64LE;
+			return XE_CODEC_NONE;
+		}
+
+		if(format != WAVE_FORMAT_PCM)
+			return XE_CODEC_NONE;
+		switch(bits){
+			case 8:
+				return XE_CODEC_PCM_U8;
+			case 16:
+				return XE_CODEC_PCM_S16LE;
+			case 24:
+				return XE_CODEC_PCM_S24LE;
+			case 32:
+				return XE_CODEC_PCM_S32LE;
+			default:
+				return XE_CODEC_NONE;
+		}
+	}
+
+	int open(){
+		xe_reader& reader = context -> reader;
+		xe_codec_id id = XE_CODEC_NONE;
+		uint riff, tag, format, bits;
+		uint channels = 0, sample_rate = 0;
+		ulong size, ds64_data = 0;
+		int err;
+
+		riff = reader.r32be();
+		reader.r32le();
+
+		if(reader.r32be() != TAG_WAVE)
+			return XE_INVALID_DATA;
+		if((err = alloc_track()))
+			return err;
+		while(true){
+			tag = reader.r32be();
+			size = reader.r32le();
+
+			if(reader.error())
+				return reader.error();
+			switch(tag){
+				case TAG_DS64:
+					if(size < 24)
+						return XE_INVALID_DATA;
+					/* riff size, data size, sample count */
+					reader.r64le();
+					ds64_data = reader.r64le();
+					reader.r64le();
+					size -= 24;
+
+					break;
+				case TAG_FMT:
+					if(size < 16)
+						return XE_INVALID_DATA;
+					format = reader.r16le();
+					channels = reader.r16le();
+					sample_rate = reader.r32le();
+					reader.r32le();
+					reader.r16le();
+					bits = reader.r16le();
+					size -= 16;
+
+					if(format == WAVE_FORMAT_EXTENSIBLE && size >= 24){
+						/* extension size, valid bits, channel mask and the format at the start of the guid */
+						reader.r16le();
+						reader.r16le();
+						track -> codec.channel_layout = reader.r32le();
+						format = reader.r16le();
+						reader.skip(14);
+						size -= 24;
+					}
+
+					id = codec_id(format, bits);
+
+					break;
+				case TAG_DATA:
+					if(!channels)
+						return XE_INVALID_DATA;
+					/* rf64 keeps the real size in ds64, streamed files leave it unknown */
+					if(riff != TAG_RIFF || size == unknown_size)
+						size = ds64_data;
+					return start(id, channels, sample_rate, size);
+			}
+
+			/* chunks are padded to an even size */
+			if((err = reader.skip(size + (size & 1))))
+				return err;
+		}
+	}
+};
+
+class xe_aiff : public xe_pcm_demuxer{
+public:
+	xe_aiff(xe_format::xe_context& context): xe_pcm_demuxer(context){}
+
+	static double read_extended(xe_reader& reader){
+		int exponent = reader.r16be();
+		ulong mantissa = reader.r64be();
+		double value;
+
+		value = ldexp((double)mantissa, (exponent & 0x7fff) - 16383 - 63);
+
+		return exponent & 0x8000 ? -value : value;
+	}
+
+	static xe_codec_id codec_id(uint compression, uint bits){
+		switch(compression){
+			case TAG_NONE:
+			case TAG_TWOS:
+				switch(bits){
+					case 8:
+						return XE_CODEC_PCM_S8;
+					case 16:
+						return XE_CODEC_PCM_S16BE;
+					case 24:
+						return XE_CODEC_PCM_S24BE;
+					case 32:
+						return XE_CODEC_PCM_S32BE;
+					default:
+						return XE_CODEC_NONE;
+				}
+			case TAG_SOWT:
+				switch(bits){
+					case 16:
+						return XE_CODEC_PCM_S16LE;
+					case 24:
+						return XE_CODEC_PCM_S24LE;
+					case 32:
+						return XE_CODEC_PCM_S32LE;
+					default:
+						return XE_CODEC_NONE;
+				}
+			case TAG_FL32:
+			case TAG_FL32_UPPER:
+				return XE_CODEC_PCM_F32BE;
+			case TAG_FL64:
+			case TAG_FL64_UPPER:
+				return XE_CODEC_PCM_F64BE;
+			default:
+				return XE_CODEC_NONE;
+		}
+	}
+
+	int open(){
+		xe_reader& reader = context -> reader;
+		xe_codec_id id = XE_CODEC_NONE;
+		uint form, tag, bits, compression = TAG_NONE;
+		uint channels = 0, sample_rate = 0;
+		ulong size, offset;
+		int err;
+
+		reader.r32be();
+		reader.r32be();
+		form = reader.r32be();
+
+		if(form != TAG_AIFF && form != TAG_AIFC)
+			return XE_INVALID_DATA;
+		if((err = alloc_track()))
+			return err;
+		while(true){
+			tag = reader.r32be();
+			size = reader.r32be();
+
+			if(reader.error())
+				return reader.error();
+			switch(tag){
+				case TAG_COMM:
+					if(size < 18)
+						return XE_INVALID_DATA;
+					channels = reader.r16be();
+					/* frame count */
+					reader.r32be();
+					bits = reader.r16be();
+					sample_rate = (uint)read_extended(reader);
+					size -= 18;
+
+					if(form == TAG_AIFC && size >= 4){
+						compression = reader.r32be();
+						size -= 4;
+					}
+
+					/* round odd widths up to whole bytes */
+					id = codec_id(compression, (bits + 7) & ~7u);
+
+					break;
+				case TAG_SSND:
+					if(!channels || size < 8)
+						return XE_INVALID_DATA;
+					offset = reader.r32be();
+					/* block size */
+					reader.r32be();
+
+					if(offset > size - 8 || (err = reader.skip(offset)))
+						return err ? err : XE_INVALID_DATA;
+					return start(id, channels, sample_rate, size - 8 - offset);
+			}
+
+			if((err = reader.skip(size + (size & 1))))
+				return err;
+		}
+	}
+};
+
+xe_demuxer* xe_wav_class::create(xe_format::xe_context& context) const{
+	return xe_znew<xe_wav>(context);
+}
+
+uint xe_wav_class::probe(const xe_probe_data& probe) const{
+	uint riff;
+
+	if(probe.size < 12)
+		return XE_PROBE_SCORE_NONE;
+	riff = make_tag((xe_cstr)probe.data);
+
+	if((riff == TAG_RIFF || riff == TAG_RF64 || riff == TAG_BW64) && make_tag((xe_cstr)probe.data + 8) == TAG_WAVE)
+		return XE_PROBE_SCORE_MAX;
+	return XE_PROBE_SCORE_NONE;
+}
+
+xe_cstr xe_wav_class::extensions() const{
+	return "wav,wave,rf64,bw64";
+}
+
+xe_cstr xe_wav_class::mime_types() const{
+	return "audio/wav,audio/wave,audio/x-wav,audio/vnd.wave";
+}
+
+xe_demuxer* xe_aiff_class::create(xe_format::xe_context& context) const{
+	return xe_znew<xe_aiff>(context);
+}
+
+uint xe_aiff_class::probe(const xe_probe_data& probe) const{
+	uint form;
+
+	if(probe.size < 12 || make_tag((xe_cstr)probe.data) != TAG_FORM)
+		return XE_PROBE_SCORE_NONE;
+	form = make_tag((xe_cstr)probe.data + 8);
+
+	return form == TAG_AIFF || form == TAG_AIFC ? XE_PROBE_SCORE_MAX : XE_PROBE_SCORE_NONE;
+}
+
+xe_cstr xe_aiff_class::extensions() const{
+	return "aif,aiff,aifc";
+}
+
+xe_cstr xe_aiff_class::mime_types() const{
+	return "audio/aiff,audio/x-aiff";
+}
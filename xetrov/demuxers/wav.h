@@ -0,0 +1,32 @@
+#pragma once
+#include "../demuxer.h"
+
+namespace xetrov{
+
+class xe_wav_class : public xe_demuxer_class{
+public:
+	xe_wav_class(){}
+
+	xe_demuxer* create(xe_format::xe_context& context) const;
+	uint probe(const xe_probe_data& probe) const;
+
+	xe_cstr extensions() const;
+	xe_cstr mime_types() const;
+
+	~xe_wav_class(){}
+};
+
+class xe_aiff_class : public xe_demuxer_class{
+public:
+	xe_aiff_class(){}
+
+	xe_demuxer* create(xe_format::xe_context& context) const;
+	uint probe(const xe_probe_data& probe) const;
+
+	xe_cstr extensions() const;
+	xe_cstr mime_types() const;
+
+	~xe_aiff_class(){}
+};
+
+}
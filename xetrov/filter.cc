@@ -1,31 +1,528 @@
 #include "filter.h"
 #include "error.h"
+#include "codec.h"
+#include "pool.h"
+#include "filters/convert.h"
+#include "xe/mem.h"
 
 using namespace xetrov;
 
-xe_filter_chain::xe_filter_chain(){
+/* Implementation details
+ * ==============================================================
+ * configure() walks the filters in order, handing each the format the
+ * previous one produces. a filter that leaves the format unchanged runs
+ * in place on whatever buffer it is given, otherwise it writes into a
+ * buffer owned by its stage, sized for the largest chunk it is handed
+ *
+ * a filter that does not accept the sample format it would be given
+ * gets a conversion stage inserted in front of it, converting to an
+ * accepted format with the same layout where there is one
+ *
+ * a filter asking for fixed size blocks gets a stage fifo which input
+ * is gathered into, other out of place filters get their input split
+ * into chunks of at most XE_FILTER_MAX_BLOCK samples
+ *
+ * when every filter runs in place on any size, frames are filtered
+ * inside their own buffers and handed back as they are. otherwise the
+ * last stage's output is queued and received in frames of at most
+ * XE_FILTER_MAX_BLOCK samples from a frame pool. these frames are
+ * timed from the timestamp of the first frame sent after configure()
+ * or flush(), by the output samples received since converted to the
+ * input's timescale. each timestamp is converted from that start so
+ * rounding never accumulates, and durations are the difference
+ */
+
+static bool accepts(const xe_filter& filter, xe_audio_sample_fmt fmt){
+	const xe_array<xe_audio_sample_fmt>& formats = filter.input_formats();
+
+	if(!formats.size())
+		return true;
+	for(size_t i = 0; i < formats.size(); i++){
+		if(formats[i] == fmt)
+			return true;
+	}
+
+	return false;
+}
+
+static void set_planes(const xe_audio_format& format, xe_bptr* planes, xe_bptr buffer, size_t capacity){
+	size_t size = capacity * format.stride();
+
+	for(uint i = 0; i < format.planes(); i++)
+		planes[i] = buffer + i * size;
+}
+
+static xe_bptr alloc_planes(const xe_audio_format& format, xe_bptr* planes, size_t capacity){
+	xe_bptr buffer = xe_alloc<byte>(capacity * format.stride() * format.planes() + XE_BUFFER_PADDING);
 
+	if(buffer)
+		set_planes(format, planes, buffer, capacity);
+	return buffer;
+}
+
+xe_filter_chain::xe_filter_chain(){
+	input = {};
+	output = {};
+	queue = null;
+	queue_planes = null;
+	queue_offset = 0;
+	queue_samples = 0;
+	queue_capacity = 0;
+	pool = null;
+	timescale = {0, 0};
+	timestamp = 0;
+	emitted = 0;
+	configured = false;
+	passthrough = false;
+	started = false;
+	draining = false;
+	drained = false;
 }
 
 int xe_filter_chain::add_filter(xe_filter* filter){
-	if(filters.push_back(filter))
+	if(!filters.push_back(filter))
+		return XE_ENOMEM;
+	configured = false;
+
+	return 0;
+}
+
+void xe_filter_chain::free_stage(xe_filter_stage& stage){
+	xe_dealloc(stage.fifo);
+	xe_dealloc(stage.fifo_planes);
+	xe_dealloc(stage.out);
+	xe_dealloc(stage.out_planes);
+	xe_dealloc(stage.view);
+}
+
+void xe_filter_chain::free_stages(){
+	for(xe_filter_stage& stage : stages)
+		free_stage(stage);
+	stages.free();
+
+	for(xe_filter* converter : converters)
+		xe_delete(converter);
+	converters.free();
+
+	xe_dealloc(queue);
+	xe_dealloc(queue_planes);
+
+	queue = null;
+	queue_planes = null;
+	queue_offset = 0;
+	queue_samples = 0;
+	queue_capacity = 0;
+
+	if(pool)
+		pool -> close();
+	pool = null;
+	configured = false;
+}
+
+int xe_filter_chain::add_converter(const xe_filter& filter, xe_audio_format& format){
+	const xe_array<xe_audio_sample_fmt>& formats = filter.input_formats();
+	xe_audio_sample_fmt target = XE_SAMPLE_FMT_NONE;
+	xe_filter* converter;
+
+	if(!xe_convert_filter::supported(format.format))
+		return XE_ENOSYS;
+	for(size_t i = 0; i < formats.size(); i++){
+		if(!xe_convert_filter::supported(formats[i]))
+			continue;
+		if(target == XE_SAMPLE_FMT_NONE || xe_sample_fmt_planar(formats[i]) == xe_sample_fmt_planar(format.format))
+			target = formats[i];
+		if(xe_sample_fmt_planar(target) == xe_sample_fmt_planar(format.format))
+			break;
+	}
+
+	if(target == XE_SAMPLE_FMT_NONE)
+		return XE_ENOSYS;
+	converter = xe_new<xe_convert_filter>(target);
+
+	if(!converter)
+		return XE_ENOMEM;
+	if(!converters.push_back(converter)){
+		xe_delete(converter);
+
+		return XE_ENOMEM;
+	}
+
+	return add_stage(converter, format);
+}
+
+int xe_filter_chain::add_stage(xe_filter* filter, xe_audio_format& format){
+	xe_filter_stage stage;
+	int err;
+
+	if(!accepts(*filter, format.format) && (err = add_converter(*filter, format)))
+		return err;
+	xe_zero(&stage);
+
+	stage.filter = filter;
+	stage.input = format;
+	stage.output = format;
+
+	if((err = filter -> configure(stage.input, stage.output)))
+		return err;
+	stage.block = filter -> input_samples();
+	stage.max_input = stage.block ? stage.block : (uint)XE_FILTER_MAX_BLOCK;
+	stage.in_place = stage.output == stage.input;
+	stage.view = xe_alloc<xe_bptr>(stage.input.planes());
+
+	if(!stage.view)
+		return XE_ENOMEM;
+	if(stage.block){
+		stage.fifo_planes = xe_alloc<xe_bptr>(stage.input.planes());
+
+		if(!stage.fifo_planes || !(stage.fifo = alloc_planes(stage.input, stage.fifo_planes, stage.block))){
+			free_stage(stage);
+
+			return XE_ENOMEM;
+		}
+	}
+
+	if(!stage.in_place){
+		stage.out_planes = xe_alloc<xe_bptr>(stage.output.planes());
+
+		if(!stage.out_planes || !(stage.out = alloc_planes(stage.output, stage.out_planes, filter -> output_samples(stage.max_input)))){
+			free_stage(stage);
+
+			return XE_ENOMEM;
+		}
+	}
+
+	if(!stages.push_back(stage)){
+		free_stage(stage);
+
+		return XE_ENOMEM;
+	}
+
+	if(!stage.in_place || stage.block)
+		passthrough = false;
+	format = stage.output;
+
+	return 0;
+}
+
+int xe_filter_chain::configure(xe_audio_sample_fmt fmt, uint sample_rate, uint channels, ulong channel_layout){
+	xe_audio_format format;
+	int err;
+
+	flush();
+	free_stages();
+
+	if(!xe_sample_fmt_size(fmt) || !sample_rate || !channels)
+		return XE_EINVAL;
+	format.format = fmt;
+	format.sample_rate = sample_rate;
+	format.channels = channels;
+	format.channel_layout = channel_layout ? channel_layout : xe_default_channel_layout(channels);
+	input = format;
+	passthrough = true;
+
+	for(xe_filter* filter : filters){
+		if((err = add_stage(filter, format))){
+			free_stages();
+
+			return err;
+		}
+	}
+
+	output = format;
+	queue_planes = xe_alloc<xe_bptr>(output.planes());
+	pool = xe_new<xe_frame_buffer_pool>((size_t)XE_FILTER_MAX_BLOCK * output.stride() * output.planes() + XE_BUFFER_PADDING);
+
+	if(!queue_planes || !pool){
+		free_stages();
+
+		return XE_ENOMEM;
+	}
+
+	configured = true;
+
+	return 0;
+}
+
+int xe_filter_chain::enqueue(xe_bptr* data, uint samples){
+	uint planes = output.planes(), stride = output.stride();
+	size_t capacity;
+	xe_bptr buffer;
+
+	if(queue_offset + queue_samples + samples > queue_capacity){
+		if(queue_samples + samples <= queue_capacity){
+			/* room at the front, move the queue back */
+			for(uint i = 0; i < planes; i++)
+				xe_memmove(queue_planes[i], queue_planes[i] + queue_offset * stride, queue_samples * stride);
+		}else{
+			capacity = xe_max<size_t>(xe_max<size_t>(queue_capacity * 2, queue_samples + samples), XE_FILTER_MAX_BLOCK);
+			buffer = xe_alloc<byte>(capacity * stride * planes + XE_BUFFER_PADDING);
+
+			if(!buffer)
+				return XE_ENOMEM;
+			for(uint i = 0; i < planes; i++)
+				xe_memcpy(buffer + i * capacity * stride, queue_planes[i] + queue_offset * stride, queue_samples * stride);
+			xe_dealloc(queue);
+
+			queue = buffer;
+			queue_capacity = capacity;
+
+			set_planes(output, queue_planes, queue, queue_capacity);
+		}
+
+		queue_offset = 0;
+	}
+
+	for(uint i = 0; i < planes; i++)
+		xe_memcpy(queue_planes[i] + (queue_offset + queue_samples) * stride, data[i], (size_t)samples * stride);
+	queue_samples += samples;
+
+	return 0;
+}
+
+int xe_filter_chain::run(uint index, xe_bptr* data, uint samples){
+	xe_filter_stage& stage = stages[index];
+	uint written;
+	int err;
+
+	if(stage.in_place){
+		if((err = stage.filter -> filter(data, samples)))
+			return err;
+		return push(index + 1, data, samples);
+	}
+
+	if((err = stage.filter -> filter(data, samples, stage.out_planes, written)))
+		return err;
+	return written ? push(index + 1, stage.out_planes, written) : 0;
+}
+
+int xe_filter_chain::push(uint index, xe_bptr* data, uint samples){
+	uint planes, stride, count;
+	int err;
+
+	if(index == stages.size())
+		return enqueue(data, samples);
+	xe_filter_stage& stage = stages[index];
+
+	planes = stage.input.planes();
+	stride = stage.input.stride();
+
+	if(stage.block){
+		/* gather into whole blocks */
+		for(uint offset = 0; offset < samples; offset += count){
+			count = xe_min(stage.block - stage.fifo_samples, samples - offset);
+
+			for(uint i = 0; i < planes; i++)
+				xe_memcpy(stage.fifo_planes[i] + stage.fifo_samples * stride, data[i] + offset * stride, (size_t)count * stride);
+			stage.fifo_samples += count;
+
+			if(stage.fifo_samples < stage.block)
+				continue;
+			stage.fifo_samples = 0;
+
+			if((err = run(index, stage.fifo_planes, stage.block)))
+				return err;
+		}
+
 		return 0;
-	return XE_ENOMEM;
+	}
+
+	if(stage.in_place || samples <= stage.max_input)
+		return run(index, data, samples);
+	/* split so the output fits the stage's buffer */
+	for(uint offset = 0; offset < samples; offset += count){
+		count = xe_min(stage.max_input, samples - offset);
+
+		for(uint i = 0; i < planes; i++)
+			stage.view[i] = data[i] + offset * stride;
+		if((err = run(index, stage.view, count)))
+			return err;
+	}
+
+	return 0;
 }
 
-int xe_filter_chain::configure(xe_audio_sample_fmt fmt, uint sample_rate, uint channels, uint channel_layout){
+int xe_filter_chain::drain_stages(){
+	uint count, written;
+	int err;
+
+	/* in order, so each stage's leftovers reach the next before it drains */
+	for(uint index = 0; index < stages.size(); index++){
+		xe_filter_stage& stage = stages[index];
+
+		if(stage.fifo_samples){
+			count = stage.fifo_samples;
+			stage.fifo_samples = 0;
 
+			if((err = run(index, stage.fifo_planes, count)))
+				return err;
+		}
+
+		if(stage.in_place)
+			continue;
+		do{
+			if((err = stage.filter -> drain(stage.out_planes, written)))
+				return err;
+			if(written && (err = push(index + 1, stage.out_planes, written)))
+				return err;
+		}while(written);
+	}
+
+	return 0;
 }
 
 int xe_filter_chain::send_frame(xe_frame& frame){
-	if(!frame_queue.push_back(std::move(frame)))
-		return XE_ENOMEM;
+	int err;
+
+	if(!configured)
+		return XE_EINVAL;
+	if(draining)
+		return XE_EOF;
+	if(pending.samples)
+		return XE_EAGAIN;
+	if(frame.format != (uint)input.format || frame.channels != input.channels || frame.sample_rate != input.sample_rate)
+		return XE_EINVAL;
+	if(!frame.samples){
+		frame.unref();
+
+		return 0;
+	}
+
+	if(passthrough){
+		for(xe_filter_stage& stage : stages){
+			if((err = stage.filter -> filter(frame.data, frame.samples)))
+				return err;
+		}
+
+		frame.channel_layout = output.channel_layout;
+		pending = std::move(frame);
+
+		return 0;
+	}
+
+	if(!started){
+		timestamp = frame.timestamp;
+		emitted = 0;
+		started = true;
+	}
+
+	err = push(0, frame.data, frame.samples);
+	frame.unref();
+
+	return err;
+}
+
+void xe_filter_chain::set_timescale(xe_rational timescale_){
+	timescale = timescale_;
+}
+
+ulong xe_filter_chain::ticks(ulong samples) const{
+	/* without a timescale, timestamps count input samples */
+	if(!timescale.num || !timescale.den)
+		return (ulong)((double)samples * input.sample_rate / output.sample_rate);
+	return (ulong)((double)samples * timescale.den / ((double)timescale.num * output.sample_rate));
 }
 
 int xe_filter_chain::receive_frame(xe_frame& frame){
+	xe_buffer_ref* ref;
+	uint planes, stride, count;
+
+	if(pending.samples){
+		frame = std::move(pending);
+
+		return 0;
+	}
+
+	if(!queue_samples)
+		return drained ? (int)XE_EOF : (int)XE_EAGAIN;
+	planes = output.planes();
+	stride = output.stride();
+	count = xe_min<size_t>(queue_samples, XE_FILTER_MAX_BLOCK);
+	ref = xe_new<xe_buffer_ref>();
+
+	if(!ref)
+		return XE_ENOMEM;
+	if(!pool -> get_buffer(*ref)){
+		xe_delete(ref);
+
+		return XE_ENOMEM;
+	}
+
+	frame.unref();
+
+	if(planes > xe_array_size(frame.internal.data)){
+		frame.data = xe_alloc<xe_bptr>(planes);
+
+		if(!frame.data){
+			frame.data = frame.internal.data;
 
+			xe_delete(ref);
+
+			return XE_ENOMEM;
+		}
+	}
+
+	for(uint i = 0; i < planes; i++){
+		frame.data[i] = ref -> data() + i * count * stride;
+
+		xe_memcpy(frame.data[i], queue_planes[i] + queue_offset * stride, (size_t)count * stride);
+	}
+
+	if(frame.data != frame.internal.data)
+		xe_memcpy(frame.internal.data, frame.data, sizeof(frame.internal.data));
+	frame.internal.bufs[0] = ref;
+	frame.internal.linesize[0] = count * stride;
+	frame.samples = count;
+	frame.channels = output.channels;
+	frame.sample_rate = output.sample_rate;
+	frame.channel_layout = output.channel_layout;
+	frame.format = output.format;
+	frame.flags = 0;
+	frame.timestamp = timestamp + ticks(emitted);
+	emitted += count;
+	frame.duration = timestamp + ticks(emitted) - frame.timestamp;
+	queue_offset += count;
+	queue_samples -= count;
+
+	if(!queue_samples)
+		queue_offset = 0;
+	return 0;
+}
+
+int xe_filter_chain::drain(){
+	int err;
+
+	if(!configured)
+		return XE_EINVAL;
+	if(draining)
+		return 0;
+	draining = true;
+
+	if(!passthrough && (err = drain_stages()))
+		return err;
+	drained = true;
+
+	return 0;
+}
+
+void xe_filter_chain::flush(){
+	pending.unref();
+	pending.samples = 0;
+
+	for(xe_filter_stage& stage : stages){
+		stage.fifo_samples = 0;
+		stage.filter -> reset();
+	}
+
+	queue_offset = 0;
+	queue_samples = 0;
+	started = false;
+	draining = false;
+	drained = false;
 }
 
 xe_filter_chain::~xe_filter_chain(){
+	pending.unref();
 
-}
\ No newline at end of file
+	free_stages();
+	filters.free();
+}
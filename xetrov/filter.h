@@ -1,47 +1,157 @@
 #pragma once
 #include "types.h"
 #include "frame.h"
+#include "error.h"
+#include "rational.h"
 
 namespace xetrov{
 
+class xe_frame_buffer_pool;
+
 class xe_filter{
+protected:
 	xe_array<xe_audio_sample_fmt> formats;
-	uint out_samples;
 	uint in_samples;
-
-	int init(xe_audio_sample_fmt fmt);
 public:
-	xe_filter(){}
+	xe_filter(){
+		in_samples = 0;
+	}
 
+	/* sample formats accepted as input, any if empty */
 	const xe_array<xe_audio_sample_fmt>& input_formats() const{
 		return formats;
 	}
 
+	/* input arrives in blocks of exactly this many samples, except
+	 * for the last block when draining. any size if 0 */
 	uint input_samples() const{
 		return in_samples;
 	}
 
-	uint output_samples() const{
-		return out_samples;
+	/* most samples produced from the given number of input samples */
+	virtual uint output_samples(uint samples) const{
+		return samples;
 	}
 
-	virtual int filter(xe_ptr data, uint samples) = 0;
+	/* input is in one of input_formats(). output starts out as a copy
+	 * of input and is changed to the format the filter produces */
+	virtual int configure(const xe_audio_format& input, xe_audio_format& output) = 0;
+
+	/* called when configure left the format unchanged. data holds one pointer per plane */
+	virtual int filter(xe_bptr* data, uint samples){
+		return XE_ENOSYS;
+	}
+
+	/* called when the format changes. writes at most output_samples(samples) to out */
+	virtual int filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written){
+		return XE_ENOSYS;
+	}
+
+	/* writes out samples held back inside the filter at the end of the stream, at most
+	 * output_samples() of the largest block. called until nothing is written. out of place filters only */
+	virtual int drain(xe_bptr* out, uint& written){
+		written = 0;
+
+		return 0;
+	}
+
+	/* discards buffered state, such as after a seek */
+	virtual void reset(){}
+
+	virtual ~xe_filter(){}
 };
 
 class xe_filter_chain{
 private:
+	struct xe_filter_stage{
+		xe_filter* filter;
+		xe_audio_format input;
+		xe_audio_format output;
+		uint block;
+		uint max_input;
+		bool in_place;
+
+		/* partial block when re-chunking */
+		xe_bptr fifo;
+		xe_bptr* fifo_planes;
+		uint fifo_samples;
+
+		/* output when out of place */
+		xe_bptr out;
+		xe_bptr* out_planes;
+
+		xe_bptr* view;
+	};
+
 	xe_vector<xe_filter*> filters;
-	xe_vector<xe_frame> frame_queue;
+	xe_vector<xe_filter_stage> stages;
+	/* inserted by configure, owned by the chain */
+	xe_vector<xe_filter*> converters;
+
+	xe_audio_format input;
+	xe_audio_format output;
+
+	/* samples waiting to be received, in the output format */
+	xe_bptr queue;
+	xe_bptr* queue_planes;
+	size_t queue_offset;
+	size_t queue_samples;
+	size_t queue_capacity;
+
+	xe_frame pending;
+	xe_frame_buffer_pool* pool;
+	xe_rational timescale;
+	/* of the first frame, and output samples received since */
+	ulong timestamp;
+	ulong emitted;
+
+	bool configured;
+	bool passthrough;
+	bool started;
+	bool draining;
+	bool drained;
+
+	static void free_stage(xe_filter_stage& stage);
+	void free_stages();
+	int add_stage(xe_filter* filter, xe_audio_format& format);
+	int add_converter(const xe_filter& filter, xe_audio_format& format);
+
+	int push(uint index, xe_bptr* data, uint samples);
+	int run(uint index, xe_bptr* data, uint samples);
+	int enqueue(xe_bptr* data, uint samples);
+	/* output samples to timestamp units */
+	ulong ticks(ulong samples) const;
+	int drain_stages();
 public:
+	enum{
+		XE_FILTER_MAX_BLOCK = 4096
+	};
+
 	xe_filter_chain();
 
+	/* filters are owned by the caller and must outlive the chain */
 	int add_filter(xe_filter* filter);
-	int configure(xe_audio_sample_fmt fmt, uint sample_rate, uint channels, uint channel_layout);
+	int configure(xe_audio_sample_fmt fmt, uint sample_rate, uint channels, ulong channel_layout);
+	/* seconds per tick of frame timestamps, input samples when not set.
+	 * received frames are timed in the same units */
+	void set_timescale(xe_rational timescale);
 
+	/* format of received frames, valid after configure */
+	const xe_audio_format& output_format() const{
+		return output;
+	}
+
+	/* takes the frame. XE_EAGAIN until receive_frame is called */
 	int send_frame(xe_frame& frame);
+	/* XE_EAGAIN if more input is needed, XE_EOF once drained */
 	int receive_frame(xe_frame& frame);
 
+	/* pushes out everything held back, for the end of the stream */
+	int drain();
+	/* discards everything held back, such as after a seek */
+	void flush();
+
 	~xe_filter_chain();
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,710 @@
+#include <math.h>
+#include <stdint.h>
+#include <type_traits>
+#include "convert.h"
+#include "../error.h"
+#include "xe/mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XE_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * a conversion is split into a type conversion over contiguous runs of
+ * samples, and an interleave or deinterleave when the layout changes.
+ * interleaving converts each plane into a scratch chunk first and
+ * deinterleaving splits into the scratch chunk first, so the type
+ * conversion always sees contiguous samples
+ *
+ * integers are converted between each other by shifting, and to and
+ * from floats scaled by a power of two, rounding to nearest and
+ * clipping. the common float and 16 / 32 bit conversions and stereo
+ * (de)interleaving have sse4.1 / avx2 versions, picked at configure()
+ * from what the cpu supports and matching the scalar results exactly
+ *
+ * TPDF dither adds the sum of two uniform values, one lsb wide each,
+ * before rounding, from an lcg per simd lane
+ */
+
+enum{
+	CHUNK = 1024
+};
+
+enum xe_sample_type{
+	TYPE_U8 = 0,
+	TYPE_S16,
+	TYPE_S32,
+	TYPE_FLT,
+	TYPE_DBL
+};
+
+static int sample_type(xe_audio_sample_fmt format){
+	switch(format){
+		case XE_SAMPLE_FMT_U8:
+		case XE_SAMPLE_FMT_U8P:
+			return TYPE_U8;
+		case XE_SAMPLE_FMT_S16:
+		case XE_SAMPLE_FMT_S16P:
+			return TYPE_S16;
+		case XE_SAMPLE_FMT_S32:
+		case XE_SAMPLE_FMT_S32P:
+			return TYPE_S32;
+		case XE_SAMPLE_FMT_FLT:
+		case XE_SAMPLE_FMT_FLTP:
+			return TYPE_FLT;
+		case XE_SAMPLE_FMT_DBL:
+		case XE_SAMPLE_FMT_DBLP:
+			return TYPE_DBL;
+		default:
+			return -1;
+	}
+}
+
+template<typename T>
+static constexpr bool is_float = std::is_floating_point_v<T>;
+
+static inline int to_s32(uint8_t x){
+	return (x - 128) * (1 << 24);
+}
+
+static inline int to_s32(int16_t x){
+	return x * (1 << 16);
+}
+
+static inline int to_s32(int32_t x){
+	return x;
+}
+
+template<typename T>
+static inline T from_s32(int x){
+	if constexpr(sizeof(T) == 1)
+		return (x >> 24) + 128;
+	else if constexpr(sizeof(T) == 2)
+		return x >> 16;
+	else
+		return x;
+}
+
+template<typename F, typename T>
+static inline F to_float(T x){
+	if constexpr(is_float<T>)
+		return (F)x;
+	else
+		return (F)to_s32(x) * (F)(1.0 / 2147483648.0);
+}
+
+/* 8 and 16 bit from float, with noise in lsbs added before rounding */
+template<typename T>
+static inline T from_float_narrow(float x, float noise){
+	constexpr float scale = sizeof(T) == 1 ? 128.0f : 32768.0f;
+	float value = x * scale + noise;
+	int sample;
+
+	value = xe_min(xe_max(value, -scale), scale - 1);
+	sample = lrintf(value);
+
+	if constexpr(sizeof(T) == 1)
+		return sample + 128;
+	else
+		return sample;
+}
+
+template<typename T, typename F>
+static inline T from_float(F x){
+	double value;
+
+	if constexpr(sizeof(T) < 4)
+		return from_float_narrow<T>(x, 0);
+	else{
+		value = (double)x * 2147483648.0;
+
+		if(value >= 2147483647.0)
+			return INT32_MAX;
+		if(value <= -2147483648.0)
+			return INT32_MIN;
+		return (int32_t)lrint(value);
+	}
+}
+
+/* triangular between -1 and 1 */
+static inline float tpdf(uint& state){
+	uint a, b;
+
+	state = state * 1664525 + 1013904223;
+	a = state >> 8;
+	state = state * 1664525 + 1013904223;
+	b = state >> 8;
+
+	return ((float)a + (float)b) * (1.0f / 16777216.0f) - 1.0f;
+}
+
+template<typename In, typename Out, bool dithered>
+static inline Out cast(In x, uint* dither){
+	if constexpr(dithered)
+		return from_float_narrow<Out>(to_float<float>(x), tpdf(dither[0]));
+	else if constexpr(is_float<In> && is_float<Out>)
+		return (Out)x;
+	else if constexpr(is_float<Out>)
+		return to_float<Out>(x);
+	else if constexpr(is_float<In>)
+		return from_float<Out>(x);
+	else
+		return from_s32<Out>(to_s32(x));
+}
+
+template<typename In, typename Out, bool dithered>
+static void convert_scalar(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const In* in = (const In*)in_;
+	Out* out = (Out*)out_;
+
+	for(size_t i = 0; i < count; i++)
+		out[i] = cast<In, Out, dithered>(in[i], dither);
+}
+
+template<typename T>
+static void interleave_scalar(const xe_bptr* in, xe_bptr out_, size_t count, uint channels){
+	T* out = (T*)out_;
+
+	for(uint c = 0; c < channels; c++){
+		const T* plane = (const T*)in[c];
+
+		for(size_t i = 0; i < count; i++)
+			out[i * channels + c] = plane[i];
+	}
+}
+
+template<typename T>
+static void deinterleave_scalar(xe_cptr in_, xe_bptr* out, size_t count, uint channels){
+	const T* in = (const T*)in_;
+
+	for(uint c = 0; c < channels; c++){
+		T* plane = (T*)out[c];
+
+		for(size_t i = 0; i < count; i++)
+			plane[i] = in[i * channels + c];
+	}
+}
+
+#ifdef XE_CONVERT_X86
+__attribute__((target("sse2")))
+static void interleave_s16_stereo_sse2(const xe_bptr* in, xe_bptr out_, size_t count, uint channels){
+	const int16_t* left = (const int16_t*)in[0], *right = (const int16_t*)in[1];
+	int16_t* out = (int16_t*)out_;
+	__m128i l, r;
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8){
+		l = _mm_loadu_si128((const __m128i*)(left + i));
+		r = _mm_loadu_si128((const __m128i*)(right + i));
+
+		_mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi16(l, r));
+		_mm_storeu_si128((__m128i*)(out + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+	}
+
+	for(; i < count; i++){
+		out[i * 2] = left[i];
+		out[i * 2 + 1] = right[i];
+	}
+}
+
+__attribute__((target("sse2")))
+static void interleave_32_stereo_sse2(const xe_bptr* in, xe_bptr out_, size_t count, uint channels){
+	const int32_t* left = (const int32_t*)in[0], *right = (const int32_t*)in[1];
+	int32_t* out = (int32_t*)out_;
+	__m128i l, r;
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4){
+		l = _mm_loadu_si128((const __m128i*)(left + i));
+		r = _mm_loadu_si128((const __m128i*)(right + i));
+
+		_mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128((__m128i*)(out + i * 2 + 4), _mm_unpackhi_epi32(l, r));
+	}
+
+	for(; i < count; i++){
+		out[i * 2] = left[i];
+		out[i * 2 + 1] = right[i];
+	}
+}
+
+__attribute__((target("sse2")))
+static void deinterleave_s16_stereo_sse2(xe_cptr in_, xe_bptr* out, size_t count, uint channels){
+	const int16_t* in = (const int16_t*)in_;
+	int16_t* left = (int16_t*)out[0], *right = (int16_t*)out[1];
+	__m128i a, b;
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8){
+		a = _mm_loadu_si128((const __m128i*)(in + i * 2));
+		b = _mm_loadu_si128((const __m128i*)(in + i * 2 + 8));
+
+		/* sign extended halves fit, so packing is exact */
+		_mm_storeu_si128((__m128i*)(left + i), _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16)));
+		_mm_storeu_si128((__m128i*)(right + i), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+	}
+
+	for(; i < count; i++){
+		left[i] = in[i * 2];
+		right[i] = in[i * 2 + 1];
+	}
+}
+
+__attribute__((target("sse2")))
+static void deinterleave_32_stereo_sse2(xe_cptr in_, xe_bptr* out, size_t count, uint channels){
+	const float* in = (const float*)in_;
+	float* left = (float*)out[0], *right = (float*)out[1];
+	__m128 a, b;
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4){
+		a = _mm_loadu_ps(in + i * 2);
+		b = _mm_loadu_ps(in + i * 2 + 4);
+
+		_mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+
+	for(; i < count; i++){
+		left[i] = in[i * 2];
+		right[i] = in[i * 2 + 1];
+	}
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 tpdf_sse4(__m128i& state){
+	__m128i mul = _mm_set1_epi32(1664525), add = _mm_set1_epi32(1013904223), a, b;
+
+	state = _mm_add_epi32(_mm_mullo_epi32(state, mul), add);
+	a = _mm_srli_epi32(state, 8);
+	state = _mm_add_epi32(_mm_mullo_epi32(state, mul), add);
+	b = _mm_srli_epi32(state, 8);
+
+	return _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b)), _mm_set1_ps(1.0f / 16777216.0f)), _mm_set1_ps(1.0f));
+}
+
+template<bool dithered>
+__attribute__((target("sse4.1")))
+static void flt_to_s16_sse4(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const float* in = (const float*)in_;
+	int16_t* out = (int16_t*)out_;
+	__m128 scale = _mm_set1_ps(32768.0f), lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f), a, b;
+	__m128i state = _mm_loadu_si128((const __m128i*)dither);
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8){
+		a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+		b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+
+		if constexpr(dithered){
+			a = _mm_add_ps(a, tpdf_sse4(state));
+			b = _mm_add_ps(b, tpdf_sse4(state));
+		}
+
+		a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+		b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+
+	_mm_storeu_si128((__m128i*)dither, state);
+	convert_scalar<float, int16_t, dithered>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("sse4.1")))
+static void s16_to_flt_sse4(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const int16_t* in = (const int16_t*)in_;
+	float* out = (float*)out_;
+	__m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	__m128i v;
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8){
+		v = _mm_loadu_si128((const __m128i*)(in + i));
+
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(v)), scale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(v, 8))), scale));
+	}
+
+	convert_scalar<int16_t, float, false>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("sse4.1")))
+static void flt_to_s32_sse4(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const float* in = (const float*)in_;
+	int32_t* out = (int32_t*)out_;
+	__m128 scale = _mm_set1_ps(2147483648.0f), v;
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4){
+		v = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+
+		/* overflow converts to INT32_MIN, flipped to INT32_MAX when positive */
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(_mm_cvtps_epi32(v), _mm_castps_si128(_mm_cmpge_ps(v, scale))));
+	}
+
+	convert_scalar<float, int32_t, false>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("sse4.1")))
+static void s32_to_flt_sse4(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const int32_t* in = (const int32_t*)in_;
+	float* out = (float*)out_;
+	__m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i))), scale));
+	convert_scalar<int32_t, float, false>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 tpdf_avx2(__m256i& state){
+	__m256i mul = _mm256_set1_epi32(1664525), add = _mm256_set1_epi32(1013904223), a, b;
+
+	state = _mm256_add_epi32(_mm256_mullo_epi32(state, mul), add);
+	a = _mm256_srli_epi32(state, 8);
+	state = _mm256_add_epi32(_mm256_mullo_epi32(state, mul), add);
+	b = _mm256_srli_epi32(state, 8);
+
+	return _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(a), _mm256_cvtepi32_ps(b)), _mm256_set1_ps(1.0f / 16777216.0f)), _mm256_set1_ps(1.0f));
+}
+
+template<bool dithered>
+__attribute__((target("avx2")))
+static void flt_to_s16_avx2(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const float* in = (const float*)in_;
+	int16_t* out = (int16_t*)out_;
+	__m256 scale = _mm256_set1_ps(32768.0f), lo = _mm256_set1_ps(-32768.0f), hi = _mm256_set1_ps(32767.0f), a, b;
+	__m256i state = _mm256_loadu_si256((const __m256i*)dither);
+	size_t i = 0;
+
+	for(; i + 16 <= count; i += 16){
+		a = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+		b = _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale);
+
+		if constexpr(dithered){
+			a = _mm256_add_ps(a, tpdf_avx2(state));
+			b = _mm256_add_ps(b, tpdf_avx2(state));
+		}
+
+		a = _mm256_min_ps(_mm256_max_ps(a, lo), hi);
+		b = _mm256_min_ps(_mm256_max_ps(b, lo), hi);
+
+		/* packing works within 128 bit lanes, put the quarters back in order */
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b)), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	_mm256_storeu_si256((__m256i*)dither, state);
+	convert_scalar<float, int16_t, dithered>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_flt_avx2(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const int16_t* in = (const int16_t*)in_;
+	float* out = (float*)out_;
+	__m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)))), scale));
+	convert_scalar<int16_t, float, false>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("avx2")))
+static void flt_to_s32_avx2(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const float* in = (const float*)in_;
+	int32_t* out = (int32_t*)out_;
+	__m256 scale = _mm256_set1_ps(2147483648.0f), v;
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8){
+		v = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(_mm256_cvtps_epi32(v), _mm256_castps_si256(_mm256_cmp_ps(v, scale, _CMP_GE_OQ))));
+	}
+
+	convert_scalar<float, int32_t, false>(in + i, out + i, count - i, dither);
+}
+
+__attribute__((target("avx2")))
+static void s32_to_flt_avx2(xe_cptr in_, xe_ptr out_, size_t count, uint* dither){
+	const int32_t* in = (const int32_t*)in_;
+	float* out = (float*)out_;
+	__m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(in + i))), scale));
+	convert_scalar<int32_t, float, false>(in + i, out + i, count - i, dither);
+}
+
+static xe_convert_fn select_simd(int in, int out, bool dithered){
+	bool avx2 = __builtin_cpu_supports("avx2"),
+		sse4 = __builtin_cpu_supports("sse4.1");
+
+	if(in == TYPE_FLT && out == TYPE_S16){
+		if(avx2)
+			return dithered ? flt_to_s16_avx2<true> : flt_to_s16_avx2<false>;
+		if(sse4)
+			return dithered ? flt_to_s16_sse4<true> : flt_to_s16_sse4<false>;
+	}else if(in == TYPE_S16 && out == TYPE_FLT){
+		if(avx2)
+			return s16_to_flt_avx2;
+		if(sse4)
+			return s16_to_flt_sse4;
+	}else if(in == TYPE_FLT && out == TYPE_S32){
+		if(avx2)
+			return flt_to_s32_avx2;
+		if(sse4)
+			return flt_to_s32_sse4;
+	}else if(in == TYPE_S32 && out == TYPE_FLT){
+		if(avx2)
+			return s32_to_flt_avx2;
+		if(sse4)
+			return s32_to_flt_sse4;
+	}
+
+	return null;
+}
+#endif
+
+template<typename In, typename Out>
+static xe_convert_fn select_scalar(bool dithered){
+	constexpr bool narrowing = !is_float<Out> && sizeof(Out) < 4 && (is_float<In> || sizeof(In) > sizeof(Out));
+
+	if constexpr(std::is_same_v<In, Out>)
+		return null;
+	if constexpr(narrowing){
+		if(dithered)
+			return convert_scalar<In, Out, true>;
+	}
+
+	return convert_scalar<In, Out, false>;
+}
+
+template<typename In>
+static xe_convert_fn select_scalar(int out, bool dithered){
+	switch(out){
+		case TYPE_U8:
+			return select_scalar<In, uint8_t>(dithered);
+		case TYPE_S16:
+			return select_scalar<In, int16_t>(dithered);
+		case TYPE_S32:
+			return select_scalar<In, int32_t>(dithered);
+		case TYPE_FLT:
+			return select_scalar<In, float>(dithered);
+		default:
+			return select_scalar<In, double>(dithered);
+	}
+}
+
+static xe_convert_fn select_convert(int in, int out, bool dithered){
+	xe_convert_fn fn = null;
+
+#ifdef XE_CONVERT_X86
+	fn = select_simd(in, out, dithered);
+#endif
+
+	if(fn)
+		return fn;
+	switch(in){
+		case TYPE_U8:
+			return select_scalar<uint8_t>(out, dithered);
+		case TYPE_S16:
+			return select_scalar<int16_t>(out, dithered);
+		case TYPE_S32:
+			return select_scalar<int32_t>(out, dithered);
+		case TYPE_FLT:
+			return select_scalar<float>(out, dithered);
+		default:
+			return select_scalar<double>(out, dithered);
+	}
+}
+
+static xe_interleave_fn select_interleave(uint size, uint channels){
+#ifdef XE_CONVERT_X86
+	if(channels == 2 && __builtin_cpu_supports("sse2")){
+		if(size == 2)
+			return interleave_s16_stereo_sse2;
+		if(size == 4)
+			return interleave_32_stereo_sse2;
+	}
+#endif
+
+	switch(size){
+		case 1:
+			return interleave_scalar<uint8_t>;
+		case 2:
+			return interleave_scalar<uint16_t>;
+		case 4:
+			return interleave_scalar<uint32_t>;
+		default:
+			return interleave_scalar<uint64_t>;
+	}
+}
+
+static xe_deinterleave_fn select_deinterleave(uint size, uint channels){
+#ifdef XE_CONVERT_X86
+	if(channels == 2 && __builtin_cpu_supports("sse2")){
+		if(size == 2)
+			return deinterleave_s16_stereo_sse2;
+		if(size == 4)
+			return deinterleave_32_stereo_sse2;
+	}
+#endif
+
+	switch(size){
+		case 1:
+			return deinterleave_scalar<uint8_t>;
+		case 2:
+			return deinterleave_scalar<uint16_t>;
+		case 4:
+			return deinterleave_scalar<uint32_t>;
+		default:
+			return deinterleave_scalar<uint64_t>;
+	}
+}
+
+xe_convert_filter::xe_convert_filter(xe_audio_sample_fmt format, bool dither_){
+	target = format;
+	dither = dither_;
+	convert = null;
+	interleave = null;
+	deinterleave = null;
+	scratch = null;
+	planes = null;
+
+	for(uint i = 0; i < xe_array_size(state); i++)
+		state[i] = 0x9e3779b9 * (i + 1);
+}
+
+bool xe_convert_filter::supported(xe_audio_sample_fmt format){
+	return sample_type(format) >= 0;
+}
+
+void xe_convert_filter::free(){
+	xe_dealloc(scratch);
+	xe_dealloc(planes);
+
+	scratch = null;
+	planes = null;
+	convert = null;
+	interleave = null;
+	deinterleave = null;
+}
+
+int xe_convert_filter::configure(const xe_audio_format& input, xe_audio_format& output){
+	int in_type = sample_type(input.format), out_type = sample_type(target);
+
+	if(in_type < 0 || out_type < 0)
+		return XE_ENOSYS;
+	free();
+
+	output.format = target;
+
+	if(input.format == target)
+		return 0;
+	channels = input.channels;
+	in_size = xe_sample_fmt_size(input.format);
+	out_size = xe_sample_fmt_size(target);
+	/* a single channel is laid out the same either way */
+	in_planar = xe_sample_fmt_planar(input.format) && channels > 1;
+	out_planar = xe_sample_fmt_planar(target) && channels > 1;
+	convert = select_convert(in_type, out_type, dither);
+
+	if(in_planar == out_planar)
+		return 0;
+	planes = xe_alloc<xe_bptr>(channels);
+
+	if(!planes)
+		return XE_ENOMEM;
+	if(in_planar)
+		interleave = select_interleave(out_size, channels);
+	else
+		deinterleave = select_deinterleave(in_size, channels);
+	if(!convert)
+		return 0;
+	scratch = xe_alloc<byte>((size_t)CHUNK * channels * (in_planar ? out_size : in_size));
+
+	if(!scratch){
+		free();
+
+		return XE_ENOMEM;
+	}
+
+	return 0;
+}
+
+int xe_convert_filter::filter(xe_bptr* data, uint samples){
+	/* same format in and out */
+	return 0;
+}
+
+int xe_convert_filter::filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written){
+	size_t count;
+
+	written = samples;
+
+	if(interleave){
+		if(!convert){
+			interleave(in, out[0], samples, channels);
+
+			return 0;
+		}
+
+		for(uint offset = 0; offset < samples; offset += count){
+			count = xe_min<uint>(CHUNK, samples - offset);
+
+			for(uint c = 0; c < channels; c++){
+				planes[c] = scratch + c * CHUNK * out_size;
+				convert(in[c] + offset * in_size, planes[c], count, state);
+			}
+
+			interleave(planes, out[0] + (size_t)offset * channels * out_size, count, channels);
+		}
+
+		return 0;
+	}
+
+	if(deinterleave){
+		if(!convert){
+			deinterleave(in[0], out, samples, channels);
+
+			return 0;
+		}
+
+		for(uint offset = 0; offset < samples; offset += count){
+			count = xe_min<uint>(CHUNK, samples - offset);
+
+			for(uint c = 0; c < channels; c++)
+				planes[c] = scratch + c * CHUNK * in_size;
+			deinterleave(in[0] + (size_t)offset * channels * in_size, planes, count, channels);
+
+			for(uint c = 0; c < channels; c++)
+				convert(planes[c], out[c] + offset * out_size, count, state);
+		}
+
+		return 0;
+	}
+
+	/* same layout, planes convert as they are */
+	count = in_planar ? samples : (size_t)samples * channels;
+
+	for(uint p = 0; p < (in_planar ? channels : 1); p++){
+		if(convert)
+			convert(in[p], out[p], count, state);
+		else
+			xe_memcpy(out[p], in[p], count * in_size);
+	}
+
+	return 0;
+}
+
+xe_convert_filter::~xe_convert_filter(){
+	free();
+}
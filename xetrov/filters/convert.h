@@ -0,0 +1,46 @@
+#pragma once
+#include "../filter.h"
+
+namespace xetrov{
+
+typedef void (*xe_convert_fn)(xe_cptr in, xe_ptr out, size_t count, uint* dither);
+typedef void (*xe_interleave_fn)(const xe_bptr* in, xe_bptr out, size_t count, uint channels);
+typedef void (*xe_deinterleave_fn)(xe_cptr in, xe_bptr* out, size_t count, uint channels);
+
+/* converts between U8, S16, S32, FLT and DBL, packed or planar.
+ * TPDF dither can be added when narrowing to U8 or S16 */
+class xe_convert_filter : public xe_filter{
+private:
+	xe_audio_sample_fmt target;
+	bool dither;
+
+	xe_convert_fn convert;
+	xe_interleave_fn interleave;
+	xe_deinterleave_fn deinterleave;
+
+	uint channels;
+	uint in_size;
+	uint out_size;
+	bool in_planar;
+	bool out_planar;
+
+	xe_bptr scratch;
+	xe_bptr* planes;
+	uint state[8];
+
+	void free();
+public:
+	xe_convert_filter(xe_audio_sample_fmt format, bool dither = false);
+
+	/* whether the format can be converted from or to */
+	static bool supported(xe_audio_sample_fmt format);
+
+	int configure(const xe_audio_format& input, xe_audio_format& output);
+
+	int filter(xe_bptr* data, uint samples);
+	int filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written);
+
+	~xe_convert_filter();
+};
+
+}
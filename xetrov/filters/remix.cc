@@ -0,0 +1,399 @@
+#include "remix.h"
+#include "../codec.h"
+#include "../error.h"
+#include "xe/mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XE_REMIX_X86
+#include <immintrin.h>
+#endif
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * a channel present in both layouts is passed through, the rest are
+ * folded into their nearest neighbours at -3 dB, as in ITU-R BS.775:
+ * center into left and right, surrounds into the fronts, back center
+ * into the surround pair and so on. lfe is dropped when there is no
+ * lfe to take it. mono is spread to both sides at unity. the matrix is
+ * then scaled down so no output can exceed full scale
+ *
+ * each output row keeps the list of inputs with a nonzero gain. a row
+ * with a single unity gain is a copy and a row without gains is
+ * silence, and a layout mapping onto itself is left as it is. mixing
+ * goes through chunks small enough that an output row stays in cache
+ * while its inputs are added, using sse / avx2 picked at configure()
+ */
+
+enum{
+	CHUNK = 256
+};
+
+static constexpr float SQRT1_2 = 0.70710678f;
+
+static const ulong left_channels = XE_CH_TOP_FRONT_LEFT | XE_CH_TOP_BACK_LEFT | XE_CH_WIDE_LEFT |
+	XE_CH_SURROUND_DIRECT_LEFT | XE_CH_TOP_SIDE_LEFT | XE_CH_BOTTOM_FRONT_LEFT;
+static const ulong right_channels = XE_CH_TOP_FRONT_RIGHT | XE_CH_TOP_BACK_RIGHT | XE_CH_WIDE_RIGHT |
+	XE_CH_SURROUND_DIRECT_RIGHT | XE_CH_TOP_SIDE_RIGHT | XE_CH_BOTTOM_FRONT_RIGHT;
+
+static void scale_scalar(float* out, const float* in, float gain, size_t count){
+	for(size_t i = 0; i < count; i++)
+		out[i] = in[i] * gain;
+}
+
+static void madd_scalar(float* out, const float* in, float gain, size_t count){
+	for(size_t i = 0; i < count; i++)
+		out[i] += in[i] * gain;
+}
+
+#ifdef XE_REMIX_X86
+__attribute__((target("sse2")))
+static void scale_sse(float* out, const float* in, float gain, size_t count){
+	__m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+	scale_scalar(out + i, in + i, gain, count - i);
+}
+
+__attribute__((target("sse2")))
+static void madd_sse(float* out, const float* in, float gain, size_t count){
+	__m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+	madd_scalar(out + i, in + i, gain, count - i);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(float* out, const float* in, float gain, size_t count){
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), g));
+	scale_scalar(out + i, in + i, gain, count - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void madd_avx2(float* out, const float* in, float gain, size_t count){
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(out + i)));
+	madd_scalar(out + i, in + i, gain, count - i);
+}
+#endif
+
+static uint channel_index(ulong layout, ulong channel){
+	return __builtin_popcountl(layout & (channel - 1));
+}
+
+/* adds the input to an output channel, if there is one */
+static bool route(float* matrix, ulong out_layout, uint in_channels, uint input, ulong channel, float gain){
+	if(!(out_layout & channel))
+		return false;
+	matrix[channel_index(out_layout, channel) * in_channels + input] += gain;
+
+	return true;
+}
+
+static bool route_pair(float* matrix, ulong out_layout, uint in_channels, uint input, ulong left, ulong right, float gain){
+	if((out_layout & (left | right)) != (left | right))
+		return false;
+	route(matrix, out_layout, in_channels, input, left, gain);
+	route(matrix, out_layout, in_channels, input, right, gain);
+
+	return true;
+}
+
+xe_remix_filter::xe_remix_filter(ulong channel_layout){
+	format = XE_SAMPLE_FMT_FLTP;
+	formats = xe_array<xe_audio_sample_fmt>(&format, 1);
+	layout = channel_layout;
+	in_channels = 0;
+	out_channels = __builtin_popcountl(channel_layout);
+	matrix = null;
+	custom = false;
+	identity = false;
+	inputs = null;
+	counts = null;
+	scale = scale_scalar;
+	madd = madd_scalar;
+	scratch = null;
+	rows = null;
+}
+
+int xe_remix_filter::set_matrix(const float* matrix_, uint channels){
+	float* copy;
+
+	if(!channels || !out_channels)
+		return XE_EINVAL;
+	copy = xe_alloc<float>((size_t)out_channels * channels);
+
+	if(!copy)
+		return XE_ENOMEM;
+	xe_memcpy(copy, matrix_, (size_t)out_channels * channels * sizeof(float));
+	xe_dealloc(matrix);
+
+	matrix = copy;
+	in_channels = channels;
+	custom = true;
+
+	return 0;
+}
+
+int xe_remix_filter::build(ulong in_layout){
+	ulong channel, out = layout;
+	float max = 0, sum;
+	uint i = 0;
+	float* m;
+
+	xe_dealloc(matrix);
+
+	in_channels = __builtin_popcountl(in_layout);
+	matrix = m = xe_zalloc<float>((size_t)out_channels * in_channels);
+
+	if(!m)
+		return XE_ENOMEM;
+	for(ulong rest = in_layout; rest; rest &= rest - 1, i++){
+		channel = rest & -rest;
+
+		if(route(m, out, in_channels, i, channel, 1))
+			continue;
+		switch(channel){
+			case XE_CH_FRONT_CENTER:
+				/* mono goes to both sides as it is */
+				if(!(in_layout & (XE_CH_FRONT_LEFT | XE_CH_FRONT_RIGHT)))
+					route_pair(m, out, in_channels, i, XE_CH_FRONT_LEFT, XE_CH_FRONT_RIGHT, 1);
+				else
+					route_pair(m, out, in_channels, i, XE_CH_FRONT_LEFT, XE_CH_FRONT_RIGHT, SQRT1_2);
+				break;
+			case XE_CH_FRONT_LEFT:
+			case XE_CH_FRONT_LEFT_OF_CENTER:
+			case XE_CH_STEREO_LEFT:
+				route(m, out, in_channels, i, XE_CH_FRONT_LEFT, 1) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, SQRT1_2);
+				break;
+			case XE_CH_FRONT_RIGHT:
+			case XE_CH_FRONT_RIGHT_OF_CENTER:
+			case XE_CH_STEREO_RIGHT:
+				route(m, out, in_channels, i, XE_CH_FRONT_RIGHT, 1) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, SQRT1_2);
+				break;
+			case XE_CH_BACK_LEFT:
+				route(m, out, in_channels, i, XE_CH_SIDE_LEFT, 1) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_LEFT, SQRT1_2) ||
+				route(m, out, in_channels, i, XE_CH_BACK_CENTER, SQRT1_2) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, 0.5f);
+				break;
+			case XE_CH_BACK_RIGHT:
+				route(m, out, in_channels, i, XE_CH_SIDE_RIGHT, 1) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_RIGHT, SQRT1_2) ||
+				route(m, out, in_channels, i, XE_CH_BACK_CENTER, SQRT1_2) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, 0.5f);
+				break;
+			case XE_CH_SIDE_LEFT:
+				route(m, out, in_channels, i, XE_CH_BACK_LEFT, 1) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_LEFT, SQRT1_2) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, 0.5f);
+				break;
+			case XE_CH_SIDE_RIGHT:
+				route(m, out, in_channels, i, XE_CH_BACK_RIGHT, 1) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_RIGHT, SQRT1_2) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, 0.5f);
+				break;
+			case XE_CH_BACK_CENTER:
+				route_pair(m, out, in_channels, i, XE_CH_BACK_LEFT, XE_CH_BACK_RIGHT, SQRT1_2) ||
+				route_pair(m, out, in_channels, i, XE_CH_SIDE_LEFT, XE_CH_SIDE_RIGHT, SQRT1_2) ||
+				route_pair(m, out, in_channels, i, XE_CH_FRONT_LEFT, XE_CH_FRONT_RIGHT, 0.5f) ||
+				route(m, out, in_channels, i, XE_CH_FRONT_CENTER, SQRT1_2);
+				break;
+			case XE_CH_LOW_FREQUENCY:
+				route(m, out, in_channels, i, XE_CH_LOW_FREQUENCY_2, 1);
+				break;
+			case XE_CH_LOW_FREQUENCY_2:
+				route(m, out, in_channels, i, XE_CH_LOW_FREQUENCY, 1);
+				break;
+			default:
+				if(channel & left_channels){
+					route(m, out, in_channels, i, XE_CH_FRONT_LEFT, SQRT1_2) ||
+					route(m, out, in_channels, i, XE_CH_FRONT_CENTER, 0.5f);
+				}else if(channel & right_channels){
+					route(m, out, in_channels, i, XE_CH_FRONT_RIGHT, SQRT1_2) ||
+					route(m, out, in_channels, i, XE_CH_FRONT_CENTER, 0.5f);
+				}else{
+					route_pair(m, out, in_channels, i, XE_CH_FRONT_LEFT, XE_CH_FRONT_RIGHT, 0.5f) ||
+					route(m, out, in_channels, i, XE_CH_FRONT_CENTER, SQRT1_2);
+				}
+
+				break;
+		}
+	}
+
+	/* keep every output within full scale */
+	for(uint o = 0; o < out_channels; o++){
+		sum = 0;
+
+		for(uint c = 0; c < in_channels; c++)
+			sum += xe_max(m[o * in_channels + c], -m[o * in_channels + c]);
+		max = xe_max(max, sum);
+	}
+
+	if(max > 1){
+		for(size_t k = 0; k < (size_t)out_channels * in_channels; k++)
+			m[k] /= max;
+	}
+
+	return 0;
+}
+
+int xe_remix_filter::configure(const xe_audio_format& input, xe_audio_format& output){
+	ulong in_layout = input.channel_layout ? input.channel_layout : xe_default_channel_layout(input.channels);
+	int err;
+
+	if(!out_channels)
+		return XE_EINVAL;
+	output.channels = out_channels;
+	output.channel_layout = layout;
+
+	xe_dealloc(inputs);
+	xe_dealloc(counts);
+	xe_dealloc(scratch);
+	xe_dealloc(rows);
+
+	inputs = null;
+	counts = null;
+	scratch = null;
+	rows = null;
+	identity = false;
+
+	if(custom){
+		if(input.channels != in_channels)
+			return XE_EINVAL;
+	}else{
+		if(in_layout == layout){
+			identity = true;
+
+			return 0;
+		}
+
+		if(__builtin_popcountl(in_layout) != input.channels)
+			return XE_EINVAL;
+		if((err = build(in_layout)))
+			return err;
+	}
+
+	inputs = xe_alloc<uint>((size_t)out_channels * in_channels);
+	counts = xe_alloc<uint>(out_channels);
+	rows = xe_alloc<float*>(out_channels);
+
+	if(!inputs || !counts || !rows)
+		return XE_ENOMEM;
+	identity = in_channels == out_channels;
+
+	for(uint o = 0; o < out_channels; o++){
+		counts[o] = 0;
+
+		for(uint c = 0; c < in_channels; c++){
+			if(matrix[o * in_channels + c] != 0)
+				inputs[o * in_channels + counts[o]++] = c;
+			if(matrix[o * in_channels + c] != (o == c ? 1 : 0))
+				identity = false;
+		}
+	}
+
+	/* a custom matrix on the same layout is applied in place through a scratch chunk */
+	if(!identity && output == input){
+		scratch = xe_alloc<float>((size_t)out_channels * CHUNK);
+
+		if(!scratch)
+			return XE_ENOMEM;
+	}
+
+	scale = scale_scalar;
+	madd = madd_scalar;
+
+#ifdef XE_REMIX_X86
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+		scale = scale_avx2;
+		madd = madd_avx2;
+	}else if(__builtin_cpu_supports("sse2")){
+		scale = scale_sse;
+		madd = madd_sse;
+	}
+#endif
+
+	return 0;
+}
+
+void xe_remix_filter::mix(xe_bptr* in, uint offset, uint samples, float** out){
+	const uint* row;
+	float gain;
+
+	for(uint o = 0; o < out_channels; o++){
+		row = inputs + o * in_channels;
+
+		if(!counts[o]){
+			xe_zero(out[o], samples);
+
+			continue;
+		}
+
+		gain = matrix[o * in_channels + row[0]];
+
+		if(gain == 1)
+			xe_memcpy(out[o], (float*)in[row[0]] + offset, samples * sizeof(float));
+		else
+			scale(out[o], (float*)in[row[0]] + offset, gain, samples);
+		for(uint k = 1; k < counts[o]; k++)
+			madd(out[o], (float*)in[row[k]] + offset, matrix[o * in_channels + row[k]], samples);
+	}
+}
+
+int xe_remix_filter::filter(xe_bptr* data, uint samples){
+	uint count;
+
+	if(identity)
+		return 0;
+	for(uint o = 0; o < out_channels; o++)
+		rows[o] = scratch + o * CHUNK;
+	for(uint offset = 0; offset < samples; offset += count){
+		count = xe_min<uint>(CHUNK, samples - offset);
+
+		mix(data, offset, count, rows);
+
+		for(uint o = 0; o < out_channels; o++)
+			xe_memcpy((float*)data[o] + offset, rows[o], count * sizeof(float));
+	}
+
+	return 0;
+}
+
+int xe_remix_filter::filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written){
+	uint count;
+
+	for(uint offset = 0; offset < samples; offset += count){
+		count = xe_min<uint>(CHUNK, samples - offset);
+
+		for(uint o = 0; o < out_channels; o++)
+			rows[o] = (float*)out[o] + offset;
+		mix(in, offset, count, rows);
+	}
+
+	written = samples;
+
+	return 0;
+}
+
+xe_remix_filter::~xe_remix_filter(){
+	xe_dealloc(matrix);
+	xe_dealloc(inputs);
+	xe_dealloc(counts);
+	xe_dealloc(scratch);
+	xe_dealloc(rows);
+}
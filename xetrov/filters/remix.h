@@ -0,0 +1,49 @@
+#pragma once
+#include "../filter.h"
+
+namespace xetrov{
+
+typedef void (*xe_mix_fn)(float* out, const float* in, float gain, size_t count);
+
+/* maps planar floats to another channel layout through a mixing matrix,
+ * built from the layouts or given by the application */
+class xe_remix_filter : public xe_filter{
+private:
+	xe_audio_sample_fmt format;
+	ulong layout;
+	uint in_channels;
+	uint out_channels;
+
+	/* out_channels rows of in_channels gains */
+	float* matrix;
+	bool custom;
+	bool identity;
+
+	/* nonzero gains of each row */
+	uint* inputs;
+	uint* counts;
+
+	xe_mix_fn scale;
+	xe_mix_fn madd;
+
+	float* scratch;
+	float** rows;
+
+	int build(ulong in_layout);
+	void mix(xe_bptr* in, uint offset, uint samples, float** out);
+public:
+	xe_remix_filter(ulong channel_layout);
+
+	/* use a matrix of out channels by in channels, row major, instead of
+	 * the one built from the layouts. the input must have in_channels */
+	int set_matrix(const float* matrix, uint in_channels);
+
+	int configure(const xe_audio_format& input, xe_audio_format& output);
+
+	int filter(xe_bptr* data, uint samples);
+	int filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written);
+
+	~xe_remix_filter();
+};
+
+}
@@ -0,0 +1,356 @@
+#include <math.h>
+#include "resample.h"
+#include "../rational.h"
+#include "../error.h"
+#include "xe/mem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XE_RESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * the ratio of input to output rate is reduced to num / den, so an
+ * output sample falls on one of den phases between two input samples.
+ * when den is small enough, one row of the kaiser windowed sinc is
+ * precomputed for every phase at configure() and the inner loop is a
+ * single dot product per channel. otherwise rows are precomputed for a
+ * fixed number of phases and each output blends the two nearest rows.
+ * the position is always kept exactly, as an input sample plus phase
+ *
+ * each row is normalized to unity gain at dc. when downsampling the
+ * cutoff is lowered by the ratio and the kernel widened by it, so it
+ * keeps covering as many sinc lobes. the width is capped at MAX_TAPS,
+ * which holds the full quality down to 1/16 of the rate for the
+ * highest setting, past that the transition band widens
+ *
+ * half a kernel of silence is put in front of the input so output
+ * sample 0 lines up with input sample 0. draining feeds half a kernel
+ * of silence behind it and stops at ceil(input * den / num) samples
+ */
+
+enum{
+	MAX_EXACT_PHASES = 1024,
+	MAX_TAPS = 1024,
+	/* the widest step of the dot products */
+	TAP_ALIGN = 16
+};
+
+struct xe_resample_setting{
+	uint taps;
+	uint phases;
+	double beta;
+	double cutoff;
+};
+
+static const xe_resample_setting settings[] = {
+	{16, 128, 6.0, 0.88},
+	{32, 256, 8.5, 0.93},
+	{64, 512, 11.0, 0.96}
+};
+
+static double bessel_i0(double x){
+	double sum = 1, term = 1;
+
+	for(uint k = 1; k < 64; k++){
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+
+		if(term < sum * 1e-15)
+			break;
+	}
+
+	return sum;
+}
+
+static void build_row(float* row, uint taps, double offset, double cutoff, double beta){
+	double x, t, value, sum = 0, norm = bessel_i0(beta);
+	uint half = taps / 2;
+
+	for(uint k = 0; k < taps; k++){
+		x = (double)k - (half - 1) - offset;
+		t = x / half;
+		value = t <= -1 || t >= 1 ? 0 : bessel_i0(beta * sqrt(1 - t * t)) / norm;
+
+		if(x != 0)
+			value *= sin(M_PI * cutoff * x) / (M_PI * x);
+		else
+			value *= cutoff;
+		row[k] = value;
+		sum += value;
+	}
+
+	for(uint k = 0; k < taps; k++)
+		row[k] /= sum;
+}
+
+static float dot_scalar(const float* a, const float* b, uint count){
+	float sum[4] = {0, 0, 0, 0};
+
+	for(uint i = 0; i < count; i += 4){
+		sum[0] += a[i] * b[i];
+		sum[1] += a[i + 1] * b[i + 1];
+		sum[2] += a[i + 2] * b[i + 2];
+		sum[3] += a[i + 3] * b[i + 3];
+	}
+
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+#ifdef XE_RESAMPLE_X86
+__attribute__((target("sse2")))
+static float dot_sse(const float* a, const float* b, uint count){
+	__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+
+	for(uint i = 0; i < count; i += 8){
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+
+	sum0 = _mm_add_ps(sum0, sum1);
+	sum0 = _mm_add_ps(sum0, _mm_movehl_ps(sum0, sum0));
+	sum0 = _mm_add_ss(sum0, _mm_shuffle_ps(sum0, sum0, 1));
+
+	return _mm_cvtss_f32(sum0);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float* a, const float* b, uint count){
+	__m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+	__m128 sum;
+
+	for(uint i = 0; i < count; i += 16){
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+	}
+
+	sum0 = _mm256_add_ps(sum0, sum1);
+	sum = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+	return _mm_cvtss_f32(sum);
+}
+#endif
+
+static xe_dot_fn select_dot(){
+#ifdef XE_RESAMPLE_X86
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return dot_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return dot_sse;
+#endif
+
+	return dot_scalar;
+}
+
+xe_resample_filter::xe_resample_filter(uint sample_rate, xe_resample_quality quality_){
+	format = XE_SAMPLE_FMT_FLTP;
+	formats = xe_array<xe_audio_sample_fmt>(&format, 1);
+	rate = sample_rate;
+	quality = quality_;
+	table = null;
+	row = null;
+	history = null;
+	num = 1;
+	den = 1;
+	taps = 0;
+	phases = 0;
+	interpolate = false;
+	dot = null;
+	channels = 0;
+	capacity = 0;
+	avail = 0;
+	pos = 0;
+	phase = 0;
+	total_in = 0;
+	total_out = 0;
+	drained = false;
+}
+
+void xe_resample_filter::free(){
+	xe_dealloc(table);
+	xe_dealloc(row);
+	xe_dealloc(history);
+
+	table = null;
+	row = null;
+	history = null;
+	capacity = 0;
+	avail = 0;
+}
+
+uint xe_resample_filter::output_samples(uint samples) const{
+	/* what is still buffered can add up to a kernel's worth */
+	return ((ulong)samples + taps) * den / num + 2;
+}
+
+int xe_resample_filter::configure(const xe_audio_format& input, xe_audio_format& output){
+	const xe_resample_setting& setting = settings[quality];
+	xe_rational ratio;
+	double cutoff;
+
+	if(!rate)
+		return XE_EINVAL;
+	free();
+
+	output.sample_rate = rate;
+
+	if(input.sample_rate == rate)
+		return 0;
+	ratio.num = input.sample_rate;
+	ratio.den = rate;
+	ratio.reduce();
+
+	num = ratio.num;
+	den = ratio.den;
+	taps = setting.taps;
+
+	if(num > den)
+		taps = xe_min<ulong>(((ulong)taps * num / den + TAP_ALIGN - 1) & ~(ulong)(TAP_ALIGN - 1), MAX_TAPS);
+	channels = input.channels;
+	interpolate = den > MAX_EXACT_PHASES;
+	phases = interpolate ? setting.phases : den;
+	cutoff = setting.cutoff * xe_min(1.0, (double)den / num);
+	dot = select_dot();
+
+	/* one extra row when interpolating, for blending past the last phase */
+	table = xe_alloc<float>((size_t)(phases + interpolate) * taps);
+	row = xe_alloc<float>(taps);
+
+	if(!table || !row || !reserve(xe_filter_chain::XE_FILTER_MAX_BLOCK)){
+		free();
+
+		return XE_ENOMEM;
+	}
+
+	for(uint p = 0; p < phases + interpolate; p++)
+		build_row(table + (size_t)p * taps, taps, (double)p / phases, cutoff, setting.beta);
+	reset();
+
+	return 0;
+}
+
+bool xe_resample_filter::reserve(uint samples){
+	uint size = taps + samples;
+	float* buffer;
+
+	if(avail + samples <= capacity)
+		return true;
+	size = xe_max(size + avail, capacity * 2);
+	buffer = xe_alloc<float>((size_t)size * channels);
+
+	if(!buffer)
+		return false;
+	for(uint c = 0; c < channels && history; c++)
+		xe_memcpy(buffer + (size_t)c * size, history + (size_t)c * capacity, avail * sizeof(float));
+	xe_dealloc(history);
+
+	history = buffer;
+	capacity = size;
+
+	return true;
+}
+
+void xe_resample_filter::reset(){
+	if(!history)
+		return;
+	/* silence before the first sample, so its kernel is complete */
+	avail = taps / 2 - 1;
+	pos = avail;
+	phase = 0;
+	total_in = 0;
+	total_out = 0;
+	drained = false;
+
+	for(uint c = 0; c < channels; c++)
+		xe_zero(history + (size_t)c * capacity, avail);
+}
+
+uint xe_resample_filter::resample(xe_bptr* out, ulong limit){
+	const float* coefficients;
+	uint half = taps / 2, count = 0, drop;
+	ulong index, position;
+	float frac, *r0, *r1;
+
+	while(pos + half < avail && count < limit){
+		if(interpolate){
+			position = phase * phases;
+			index = position / den;
+			frac = (float)(position % den) / den;
+			r0 = table + index * taps;
+			r1 = r0 + taps;
+
+			for(uint k = 0; k < taps; k++)
+				row[k] = r0[k] + (r1[k] - r0[k]) * frac;
+			coefficients = row;
+		}else{
+			coefficients = table + phase * taps;
+		}
+
+		for(uint c = 0; c < channels; c++)
+			((float*)out[c])[count] = dot(history + (size_t)c * capacity + pos + 1 - half, coefficients, taps);
+		count++;
+		phase += num;
+		pos += phase / den;
+		phase %= den;
+	}
+
+	total_out += count;
+	/* keep what the next kernel starts at */
+	drop = xe_min<ulong>(pos + 1 - half, avail);
+
+	if(drop){
+		for(uint c = 0; c < channels; c++)
+			xe_memmove(history + (size_t)c * capacity, history + (size_t)c * capacity + drop, (avail - drop) * sizeof(float));
+		avail -= drop;
+		pos -= drop;
+	}
+
+	return count;
+}
+
+int xe_resample_filter::filter(xe_bptr* data, uint samples){
+	/* same rate in and out */
+	return 0;
+}
+
+int xe_resample_filter::filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written){
+	if(!reserve(samples))
+		return XE_ENOMEM;
+	for(uint c = 0; c < channels; c++)
+		xe_memcpy(history + (size_t)c * capacity + avail, in[c], (size_t)samples * sizeof(float));
+	avail += samples;
+	total_in += samples;
+	written = resample(out, ~0ul);
+
+	return 0;
+}
+
+int xe_resample_filter::drain(xe_bptr* out, uint& written){
+	uint half = taps / 2;
+	ulong expected;
+
+	written = 0;
+
+	if(drained)
+		return 0;
+	if(!reserve(half))
+		return XE_ENOMEM;
+	for(uint c = 0; c < channels; c++)
+		xe_zero(history + (size_t)c * capacity + avail, half);
+	avail += half;
+	drained = true;
+	expected = (total_in * den + num - 1) / num;
+
+	if(expected > total_out)
+		written = resample(out, expected - total_out);
+	return 0;
+}
+
+xe_resample_filter::~xe_resample_filter(){
+	free();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "../filter.h"
+
+namespace xetrov{
+
+enum xe_resample_quality{
+	XE_RESAMPLE_LOW = 0,
+	XE_RESAMPLE_MEDIUM,
+	XE_RESAMPLE_HIGH
+};
+
+typedef float (*xe_dot_fn)(const float* a, const float* b, uint count);
+
+/* windowed sinc polyphase resampler on planar floats */
+class xe_resample_filter : public xe_filter{
+private:
+	xe_audio_sample_fmt format;
+	uint rate;
+	xe_resample_quality quality;
+
+	float* table;
+	float* row;
+	uint taps;
+	uint phases;
+	bool interpolate;
+	xe_dot_fn dot;
+
+	/* input rate over output rate, reduced */
+	ulong num;
+	ulong den;
+
+	/* history of each channel, from pos - taps / 2 + 1 on */
+	float* history;
+	uint channels;
+	uint capacity;
+	uint avail;
+	ulong pos;
+	ulong phase;
+
+	ulong total_in;
+	ulong total_out;
+	bool drained;
+
+	uint resample(xe_bptr* out, ulong limit);
+	bool reserve(uint samples);
+	void free();
+public:
+	xe_resample_filter(uint sample_rate, xe_resample_quality quality = XE_RESAMPLE_MEDIUM);
+
+	uint output_samples(uint samples) const;
+	int configure(const xe_audio_format& input, xe_audio_format& output);
+
+	int filter(xe_bptr* data, uint samples);
+	int filter(xe_bptr* in, uint samples, xe_bptr* out, uint& written);
+	int drain(xe_bptr* out, uint& written);
+	void reset();
+
+	~xe_resample_filter();
+};
+
+}
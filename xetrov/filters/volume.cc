@@ -0,0 +1,440 @@
+#include <math.h>
+#include "volume.h"
+#include "../codec.h"
+#include "../error.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * gain changes ramp linearly, one step per sample, every channel
+ * getting the same gain for the same sample. unity gain with no ramp
+ * skips touching the samples at all
+ *
+ * the meter follows ITU-R BS.1770-4. each channel is k-weighted by a
+ * high shelf and a high pass biquad, squared and weighted (1.41 for
+ * the surrounds, 0 for lfe) into 100 ms blocks. four blocks make a
+ * 400 ms gating block, giving the momentary loudness, and thirty make
+ * the short term loudness. gating blocks above the -70 LUFS absolute
+ * gate go into a histogram of 0.1 LU bins keeping their count and
+ * energy, so memory stays fixed however long the stream is, and the
+ * relative gate 10 LU below their mean is applied on whole bins
+ *
+ * the true peak oversamples 4x below 96 kHz and 2x below 192 kHz
+ * through a polyphase windowed sinc, as BS.1770 annex 2 suggests
+ */
+
+enum{
+	PHASE_TAPS = 12,
+	PEAK_CHUNK = 256
+};
+
+static constexpr double ABSOLUTE_GATE = -70;
+static constexpr double RELATIVE_GATE = -10;
+
+static double energy_loudness(double energy){
+	return energy > 0 ? -0.691 + 10 * log10(energy) : -HUGE_VAL;
+}
+
+static double channel_weight(ulong channel){
+	switch(channel){
+		case XE_CH_LOW_FREQUENCY:
+		case XE_CH_LOW_FREQUENCY_2:
+			return 0;
+		case XE_CH_BACK_LEFT:
+		case XE_CH_BACK_RIGHT:
+		case XE_CH_SIDE_LEFT:
+		case XE_CH_SIDE_RIGHT:
+			return 1.41;
+		default:
+			return 1;
+	}
+}
+
+static double bessel_i0(double x){
+	double sum = 1, term = 1;
+
+	for(uint k = 1; k < 64; k++){
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+
+		if(term < sum * 1e-15)
+			break;
+	}
+
+	return sum;
+}
+
+xe_loudness_meter::xe_loudness_meter(){
+	channels = null;
+	channel_count = 0;
+	interpolator = null;
+	scratch = null;
+	block_size = 0;
+	oversample = 1;
+	phase_taps = PHASE_TAPS;
+}
+
+int xe_loudness_meter::init(uint sample_rate, uint channel_count_, ulong channel_layout){
+	double k, q, vh, vb, a0, t, x, beta = 8, norm, sum;
+	uint taps, center;
+	ulong channel;
+	int offset;
+
+	if(!sample_rate || !channel_count_)
+		return XE_EINVAL;
+	xe_dealloc(channels);
+	xe_dealloc(interpolator);
+	xe_dealloc(scratch);
+
+	channel_count = channel_count_;
+	oversample = sample_rate < 96000 ? 4 : sample_rate < 192000 ? 2 : 1;
+	taps = oversample * phase_taps;
+	channels = xe_zalloc<xe_meter_channel>(channel_count);
+	interpolator = xe_alloc<float>(taps);
+	scratch = xe_zalloc<float>((size_t)channel_count * (phase_taps - 1 + PEAK_CHUNK));
+
+	if(!channels || !interpolator || !scratch)
+		return XE_ENOMEM;
+	if(!channel_layout || (uint)__builtin_popcountl(channel_layout) != channel_count)
+		channel_layout = xe_default_channel_layout(channel_count);
+	for(uint c = 0; c < channel_count; c++){
+		channel = channel_layout & -channel_layout;
+		channel_layout &= channel_layout - 1;
+		channels[c].weight = channel_weight(channel);
+		channels[c].history = scratch + (size_t)c * (phase_taps - 1 + PEAK_CHUNK);
+	}
+
+	/* high shelf, +4 dB above about 1.5 kHz */
+	k = tan(M_PI * 1681.974450955533 / sample_rate);
+	q = 0.7071752369554196;
+	vh = pow(10, 3.999843853973347 / 20);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1 + k / q + k * k;
+	shelf_b[0] = (vh + vb * k / q + k * k) / a0;
+	shelf_b[1] = 2 * (k * k - vh) / a0;
+	shelf_b[2] = (vh - vb * k / q + k * k) / a0;
+	shelf_a[0] = 1;
+	shelf_a[1] = 2 * (k * k - 1) / a0;
+	shelf_a[2] = (1 - k / q + k * k) / a0;
+
+	/* high pass at about 38 Hz */
+	k = tan(M_PI * 38.13547087602444 / sample_rate);
+	q = 0.5003270373238773;
+	a0 = 1 + k / q + k * k;
+	pass_b[0] = 1;
+	pass_b[1] = -2;
+	pass_b[2] = 1;
+	pass_a[0] = 1;
+	pass_a[1] = 2 * (k * k - 1) / a0;
+	pass_a[2] = (1 - k / q + k * k) / a0;
+
+	/* rows are stored oldest sample first, each normalized to unity gain */
+	center = taps / 2;
+	norm = bessel_i0(beta);
+
+	for(uint p = 0; p < oversample; p++){
+		sum = 0;
+
+		for(uint j = 0; j < phase_taps; j++){
+			/* tap p + oversample * k of the kernel weighs the sample k back */
+			offset = (int)(p + oversample * (phase_taps - 1 - j)) - (int)center;
+			x = (double)offset / oversample;
+			t = (double)offset / center;
+			interpolator[p * phase_taps + j] = (t <= -1 || t >= 1 ? 0 : bessel_i0(beta * sqrt(1 - t * t)) / norm) *
+				(x != 0 ? sin(M_PI * x) / (M_PI * x) : 1);
+			sum += interpolator[p * phase_taps + j];
+		}
+
+		for(uint j = 0; j < phase_taps; j++)
+			interpolator[p * phase_taps + j] /= sum;
+	}
+
+	block_size = sample_rate / 10;
+	reset();
+
+	return 0;
+}
+
+void xe_loudness_meter::reset(){
+	for(uint c = 0; c < channel_count; c++){
+		xe_zero(channels[c].state, 4);
+		xe_zero(channels[c].history, phase_taps - 1);
+	}
+
+	block_samples = 0;
+	block_energy = 0;
+	block_count = 0;
+	momentary_loudness = -HUGE_VAL;
+	short_term_loudness = -HUGE_VAL;
+	peak = 0;
+	sample_peak_value = 0;
+
+	xe_zero(histogram_count, HISTOGRAM_BINS);
+	xe_zero(histogram_energy, HISTOGRAM_BINS);
+}
+
+void xe_loudness_meter::end_block(){
+	double energy = 0, loudness;
+	uint bin;
+
+	blocks[block_count % SHORT_TERM_BLOCKS] = block_energy / block_size;
+	block_count++;
+	block_energy = 0;
+	block_samples = 0;
+
+	if(block_count < 4)
+		return;
+	for(uint i = 1; i <= 4; i++)
+		energy += blocks[(block_count - i) % SHORT_TERM_BLOCKS];
+	energy /= 4;
+	loudness = energy_loudness(energy);
+	momentary_loudness = loudness;
+
+	if(loudness >= ABSOLUTE_GATE){
+		bin = xe_min<uint>((loudness - ABSOLUTE_GATE) * 10, HISTOGRAM_BINS - 1);
+		histogram_count[bin]++;
+		histogram_energy[bin] += energy;
+	}
+
+	if(block_count < SHORT_TERM_BLOCKS)
+		return;
+	energy = 0;
+
+	for(uint i = 0; i < SHORT_TERM_BLOCKS; i++)
+		energy += blocks[i];
+	short_term_loudness = energy_loudness(energy / (uint)SHORT_TERM_BLOCKS);
+}
+
+void xe_loudness_meter::measure_peak(xe_meter_channel& channel, const float* samples, uint count){
+	float* history = channel.history;
+	const float* row;
+	float value, max = peak, sample_max = sample_peak_value;
+	uint n;
+
+	for(uint offset = 0; offset < count; offset += n){
+		n = xe_min<uint>(PEAK_CHUNK, count - offset);
+
+		for(uint i = 0; i < n; i++)
+			sample_max = xe_max(sample_max, fabsf(samples[offset + i]));
+		if(oversample == 1)
+			continue;
+		xe_memcpy(history + phase_taps - 1, samples + offset, n * sizeof(float));
+
+		for(uint i = 0; i < n; i++){
+			for(uint p = 0; p < oversample; p++){
+				row = interpolator + p * phase_taps;
+				value = 0;
+
+				for(uint j = 0; j < phase_taps; j++)
+					value += row[j] * history[i + j];
+				max = xe_max(max, fabsf(value));
+			}
+		}
+
+		xe_memmove(history, history + n, (phase_taps - 1) * sizeof(float));
+	}
+
+	peak = xe_max(max, sample_max);
+	sample_peak_value = sample_max;
+}
+
+void xe_loudness_meter::add(xe_bptr* data, uint samples){
+	double b0, b1, b2, a1, a2, c0, c1, c2, d1, d2;
+	double s0, s1, s2, s3, x, y, z, sum;
+	const float* in;
+	uint n;
+
+	b0 = shelf_b[0];
+	b1 = shelf_b[1];
+	b2 = shelf_b[2];
+	a1 = shelf_a[1];
+	a2 = shelf_a[2];
+	c0 = pass_b[0];
+	c1 = pass_b[1];
+	c2 = pass_b[2];
+	d1 = pass_a[1];
+	d2 = pass_a[2];
+
+	for(uint c = 0; c < channel_count; c++)
+		measure_peak(channels[c], (const float*)data[c], samples);
+	for(uint offset = 0; offset < samples; offset += n){
+		n = xe_min(block_size - block_samples, samples - offset);
+
+		for(uint c = 0; c < channel_count; c++){
+			xe_meter_channel& channel = channels[c];
+
+			if(!channel.weight)
+				continue;
+			in = (const float*)data[c] + offset;
+			s0 = channel.state[0];
+			s1 = channel.state[1];
+			s2 = channel.state[2];
+			s3 = channel.state[3];
+			sum = 0;
+
+			for(uint i = 0; i < n; i++){
+				x = in[i];
+				y = b0 * x + s0;
+				s0 = b1 * x - a1 * y + s1;
+				s1 = b2 * x - a2 * y;
+				z = c0 * y + s2;
+				s2 = c1 * y - d1 * z + s3;
+				s3 = c2 * y - d2 * z;
+				sum += z * z;
+			}
+
+			channel.state[0] = s0;
+			channel.state[1] = s1;
+			channel.state[2] = s2;
+			channel.state[3] = s3;
+			block_energy += channel.weight * sum;
+		}
+
+		block_samples += n;
+
+		if(block_samples == block_size)
+			end_block();
+	}
+}
+
+double xe_loudness_meter::integrated() const{
+	double energy = 0, gate;
+	ulong count = 0;
+	uint first;
+
+	for(uint i = 0; i < HISTOGRAM_BINS; i++){
+		energy += histogram_energy[i];
+		count += histogram_count[i];
+	}
+
+	if(!count)
+		return -HUGE_VAL;
+	gate = energy_loudness(energy / count) + RELATIVE_GATE;
+	first = gate <= ABSOLUTE_GATE ? 0 : xe_min<uint>(ceil((gate - ABSOLUTE_GATE) * 10), HISTOGRAM_BINS - 1);
+	energy = 0;
+	count = 0;
+
+	for(uint i = first; i < HISTOGRAM_BINS; i++){
+		energy += histogram_energy[i];
+		count += histogram_count[i];
+	}
+
+	return count ? energy_loudness(energy / count) : -HUGE_VAL;
+}
+
+double xe_loudness_meter::momentary() const{
+	return momentary_loudness;
+}
+
+double xe_loudness_meter::short_term() const{
+	return short_term_loudness;
+}
+
+float xe_loudness_meter::true_peak() const{
+	return peak;
+}
+
+float xe_loudness_meter::sample_peak() const{
+	return sample_peak_value;
+}
+
+double xe_loudness_meter::gain(double target) const{
+	double loudness = integrated();
+
+	return isfinite(loudness) ? target - loudness : 0;
+}
+
+xe_loudness_meter::~xe_loudness_meter(){
+	xe_dealloc(channels);
+	xe_dealloc(interpolator);
+	xe_dealloc(scratch);
+}
+
+xe_volume_filter::xe_volume_filter(float gain){
+	format = XE_SAMPLE_FMT_FLTP;
+	formats = xe_array<xe_audio_sample_fmt>(&format, 1);
+	metering = false;
+	channels = 0;
+	current = gain;
+	target = gain;
+	step = 0;
+	ramp = 0;
+}
+
+void xe_volume_filter::set_gain(float gain, uint ramp_samples){
+	target = gain;
+	ramp = ramp_samples;
+
+	if(ramp)
+		step = (target - current) / ramp;
+	else
+		current = target;
+}
+
+void xe_volume_filter::set_gain_db(double db, uint ramp_samples){
+	set_gain(pow(10, db / 20), ramp_samples);
+}
+
+float xe_volume_filter::gain() const{
+	return target;
+}
+
+void xe_volume_filter::set_metering(bool enable){
+	metering = enable;
+}
+
+const xe_loudness_meter& xe_volume_filter::meter() const{
+	return loudness;
+}
+
+void xe_volume_filter::reset_meter(){
+	loudness.reset();
+}
+
+int xe_volume_filter::configure(const xe_audio_format& input, xe_audio_format& output){
+	channels = input.channels;
+
+	if(metering)
+		return loudness.init(input.sample_rate, input.channels, input.channel_layout);
+	return 0;
+}
+
+int xe_volume_filter::filter(xe_bptr* data, uint samples){
+	uint offset = 0;
+	float* x;
+
+	if(metering)
+		loudness.add(data, samples);
+	if(ramp){
+		offset = xe_min(ramp, samples);
+
+		for(uint c = 0; c < channels; c++){
+			x = (float*)data[c];
+
+			for(uint i = 0; i < offset; i++)
+				x[i] *= current + step * (i + 1);
+		}
+
+		ramp -= offset;
+		current = ramp ? current + step * offset : target;
+	}
+
+	if(current == 1 || offset == samples)
+		return 0;
+	for(uint c = 0; c < channels; c++){
+		x = (float*)data[c];
+
+		for(uint i = offset; i < samples; i++)
+			x[i] *= current;
+	}
+
+	return 0;
+}
+
+void xe_volume_filter::reset(){
+	/* a seek lands on the gain the ramp was heading for */
+	ramp = 0;
+	current = target;
+}
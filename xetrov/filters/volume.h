@@ -0,0 +1,109 @@
+#pragma once
+#include "../filter.h"
+
+namespace xetrov{
+
+/* EBU R128 / ITU-R BS.1770 loudness of planar floats */
+class xe_loudness_meter{
+private:
+	enum{
+		HISTOGRAM_BINS = 1000,
+		SHORT_TERM_BLOCKS = 30
+	};
+
+	struct xe_meter_channel{
+		double weight;
+		double state[4];
+		float* history;
+	};
+
+	xe_meter_channel* channels;
+	uint channel_count;
+
+	/* k-weighting, a high shelf then a high pass */
+	double shelf_b[3];
+	double shelf_a[3];
+	double pass_b[3];
+	double pass_a[3];
+
+	/* 100 ms blocks, gated over 400 ms and averaged over 3 s */
+	uint block_size;
+	uint block_samples;
+	double block_energy;
+	double blocks[SHORT_TERM_BLOCKS];
+	uint block_count;
+
+	/* gating blocks above the absolute gate, in 0.1 LU bins from -70 LUFS */
+	uint histogram_count[HISTOGRAM_BINS];
+	double histogram_energy[HISTOGRAM_BINS];
+
+	double momentary_loudness;
+	double short_term_loudness;
+
+	/* polyphase interpolator for the true peak */
+	float* interpolator;
+	float* scratch;
+	uint oversample;
+	uint phase_taps;
+	float peak;
+	float sample_peak_value;
+
+	void end_block();
+	void measure_peak(xe_meter_channel& channel, const float* samples, uint count);
+public:
+	xe_loudness_meter();
+
+	int init(uint sample_rate, uint channels, ulong channel_layout);
+	void add(xe_bptr* data, uint samples);
+	void reset();
+
+	/* LUFS, -HUGE_VAL when too short or silent */
+	double integrated() const;
+	double momentary() const;
+	double short_term() const;
+
+	/* linear, relative to full scale */
+	float true_peak() const;
+	float sample_peak() const;
+
+	/* dB to bring the integrated loudness to target LUFS */
+	double gain(double target) const;
+
+	~xe_loudness_meter();
+};
+
+/* gain with linear per sample ramps between changes, and optionally
+ * metering loudness on the way through. with unity gain the samples
+ * are left untouched, for a pure analysis stage */
+class xe_volume_filter : public xe_filter{
+private:
+	xe_audio_sample_fmt format;
+	xe_loudness_meter loudness;
+	bool metering;
+
+	uint channels;
+
+	float current;
+	float target;
+	float step;
+	uint ramp;
+public:
+	xe_volume_filter(float gain = 1);
+
+	/* ramps from the current gain over the given number of samples */
+	void set_gain(float gain, uint ramp_samples = 0);
+	void set_gain_db(double db, uint ramp_samples = 0);
+	float gain() const;
+
+	/* measures the input, before gain is applied. set before configure */
+	void set_metering(bool enable);
+	const xe_loudness_meter& meter() const;
+	/* starts a new measurement, flushing the chain keeps the current one */
+	void reset_meter();
+
+	int configure(const xe_audio_format& input, xe_audio_format& output);
+	int filter(xe_bptr* data, uint samples);
+	void reset();
+};
+
+}
@@ -4,22 +4,103 @@
 #include "common.h"
 #include "demuxers/isom.h"
 #include "demuxers/mkv.h"
+#include "demuxers/ogg.h"
+#include "demuxers/wav.h"
+#include "demuxers/adts.h"
+#include "demuxers/mpa.h"
+#include "codecs/opus.h"
+#include "xe/mem.h"
+#include <string.h>
+#include <strings.h>
 
 using namespace xetrov;
 
+/* Implementation details
+ * ==============================================================
+ * probing peeks one window from the start of the stream, which every
+ * probe scores without touching the reader, so startup costs a single
+ * read no matter how many formats are registered
+ *
+ * formats matching the content type or extension hint are scored
+ * first, then the rest in registry order. a maximum score ends probing
+ * early, otherwise the best score wins and ties go to the earlier format
+ */
+
+enum{
+	DEFAULT_RANGE_GAP = 0x20000, /* 128 KB */
+	PROBE_SIZE = 0x2000 /* 8 KB */
+};
+
 static xe_isom_class isom;
 static xe_matroska_class matroska;
+static xe_ogg_class ogg;
+static xe_wav_class wav;
+static xe_aiff_class aiff;
+static xe_adts_class adts;
+static xe_mpa_class mpa;
 
-static const xe_demuxer_class* formats[] = {
+struct xe_demuxer_entry{
+	const xe_demuxer_class* format;
+	int priority;
+};
+
+static const xe_demuxer_class* builtin_formats[] = {
 	&isom,
-	&matroska
+	&matroska,
+	&ogg,
+	&wav,
+	&aiff,
+	/* sync word based, so after the formats with a magic number.
+	 * mpa goes first as it is far more common behind a large id3 tag */
+	&mpa,
+	&adts
 };
 
+static xe_vector<xe_demuxer_entry> formats;
+static bool formats_registered;
+
+static int register_builtin_formats(){
+	if(formats_registered)
+		return 0;
+	/* inserted last to first, so the table's order is kept */
+	for(size_t i = xe_array_size(builtin_formats); i > 0; i--){
+		if(!xe_insert_by_priority(formats, {builtin_formats[i - 1], 0})){
+			formats.resize(0);
+
+			return XE_ENOMEM;
+		}
+	}
+
+	formats_registered = true;
+
+	return 0;
+}
+
+static bool list_contains(xe_cstr list, xe_cstr value, size_t length){
+	size_t len;
+
+	if(!length)
+		return false;
+	while(true){
+		for(len = 0; list[len] && list[len] != ','; len++);
+
+		if(len == length && !strncasecmp(list, value, length))
+			return true;
+		if(!list[len])
+			return false;
+		list += len + 1;
+	}
+}
+
 xe_format::xe_format(){
 	demuxer = null;
 	resource = null;
 	stream = null;
 	worker = null;
+	context.range_gap = DEFAULT_RANGE_GAP;
+	context.verify_checksums = true;
+	content_type = null;
+	extension = null;
 }
 
 void xe_format::init(xe_fiber_worker& worker_, xe_resource& resource_, xe_packet_buffer_pool& pool_){
@@ -40,27 +121,8 @@ int xe_format::open(){
 			return err;
 		if((err = context.reader.init(*worker, *stream)))
 			return err;
-		bool matches;
-
-		for(size_t i = 0; i < xe_array_size(formats); i++){
-			context.reader.peek_mode(true);
-			matches = formats[i] -> probe(context.reader);
-			context.reader.peek_mode(false);
-			err = context.reader.error();
-
-			if(err)
-				return err;
-			if(!matches)
-				continue;
-			demuxer = formats[i] -> create(context);
-
-			if(!demuxer)
-				return XE_ENOMEM;
-			break;
-		}
-
-		if(!demuxer)
-			return XE_UNKNOWN_FORMAT;
+		if((err = probe()))
+			return err;
 	}
 
 	err = demuxer -> open();
@@ -70,10 +132,137 @@ int xe_format::open(){
 	return err;
 }
 
+bool xe_format::hinted(const xe_demuxer_class& format){
+	size_t len;
+
+	if(content_type){
+		/* parameters such as "; codecs=opus" are ignored */
+		for(len = 0; content_type[len] && content_type[len] != ';' && content_type[len] != ' '; len++);
+
+		if(list_contains(format.mime_types(), content_type, len))
+			return true;
+	}
+
+	if(extension){
+		len = extension[0] == '.';
+
+		if(list_contains(format.extensions(), extension + len, strlen(extension + len)))
+			return true;
+	}
+
+	return false;
+}
+
+int xe_format::probe(){
+	const xe_demuxer_class** order;
+	const xe_demuxer_class* best = null;
+	xe_probe_data data;
+	xe_bptr window;
+	size_t count = 0, size;
+	uint score, best_score = XE_PROBE_SCORE_NONE;
+	int err;
+
+	if((err = register_builtin_formats()))
+		return err;
+	order = xe_alloc<const xe_demuxer_class*>(formats.size());
+
+	if(!order)
+		return XE_ENOMEM;
+	for(const xe_demuxer_entry& entry : formats){
+		if(hinted(*entry.format))
+			order[count++] = entry.format;
+	}
+
+	for(const xe_demuxer_entry& entry : formats){
+		if(!hinted(*entry.format))
+			order[count++] = entry.format;
+	}
+
+	window = xe_alloc<byte>((size_t)PROBE_SIZE + XE_BUFFER_PADDING);
+
+	if(!window){
+		xe_dealloc(order);
+
+		return XE_ENOMEM;
+	}
+	context.reader.peek_mode(true);
+	err = context.reader.read_partial(window, PROBE_SIZE, size);
+	context.reader.peek_mode(false);
+
+	/* streams shorter than the window are probed as they are */
+	if((err && err != XE_EOF) || !size){
+		xe_dealloc(window);
+		xe_dealloc(order);
+
+		return err;
+	}
+
+	xe_zero(window + size, XE_BUFFER_PADDING);
+
+	data.data = window;
+	data.size = size;
+
+	for(size_t i = 0; i < count && best_score < XE_PROBE_SCORE_MAX; i++){
+		score = order[i] -> probe(data);
+
+		if(score > best_score){
+			best = order[i];
+			best_score = score;
+		}
+	}
+
+	xe_dealloc(window);
+	xe_dealloc(order);
+
+	if(!best)
+		return XE_UNKNOWN_FORMAT;
+	demuxer = best -> create(context);
+
+	if(!demuxer)
+		return XE_ENOMEM;
+	return 0;
+}
+
 int xe_format::seek(uint stream, ulong pos){
+	xe_track* track;
+	ulong preroll, rate;
+
+	if(stream >= context.tracks.size())
+		return XE_EINVAL;
+	track = context.tracks[stream];
+	preroll = track -> codec.preroll;
+	rate = track -> codec.sample_rate;
+
+	if(track -> codec.id == XE_CODEC_OPUS){
+		/* rfc 7845, opus always decodes at 48 khz */
+		rate = XE_OPUS_SAMPLE_RATE;
+
+		if(!preroll)
+			preroll = XE_OPUS_DEFAULT_PREROLL;
+	}
+
+	for(xe_track* t : context.tracks){
+		t -> has_next = false;
+
+		if(t -> parser)
+			t -> parser -> reset();
+	}
+
+	/* start early enough for the decoder to converge, it trims up to pos */
+	if(preroll && rate && track -> timescale.num)
+		pos -= xe_min(pos, preroll * track -> timescale.den / (track -> timescale.num * rate));
 	return demuxer -> seek(stream, pos);
 }
 
+/* duration in the track's timescale, parsers give it in their own */
+static ulong track_duration(const xe_track& track, const xe_packet& packet){
+	if(!packet.timescale.num || !packet.timescale.den)
+		return packet.duration;
+	if(!track.timescale.num)
+		return 0;
+	return (ulong)((double)packet.duration * packet.timescale.num * track.timescale.den / ((double)packet.timescale.den * track.timescale.num));
+}
+
 int xe_format::read_packet(xe_packet& packet){
 	int err = demuxer -> read_packet(packet);
 
@@ -84,15 +273,54 @@ int xe_format::read_packet(xe_packet& packet){
 	if(track -> parse != XE_PARSE_NONE){
 		if(!track -> parser && (err = xe_codec_parser::open(&track -> parser, track -> codec)))
 			return err;
-		err = track -> parser -> parse(packet);
+		if((err = track -> parser -> parse(packet)))
+			return err;
 	}
 
-	return err;
+	/* time packets the container left untimed from the ones before them */
+	if((packet.flags & XE_PACKET_FLAG_NO_TIMESTAMP) && track -> has_next){
+		packet.timestamp = track -> next_timestamp;
+		packet.flags &= ~XE_PACKET_FLAG_NO_TIMESTAMP;
+	}
+
+	track -> has_next = packet.duration && !(packet.flags & XE_PACKET_FLAG_NO_TIMESTAMP);
+	track -> next_timestamp = packet.timestamp + track_duration(*track, packet);
+
+	return 0;
+}
+
+void xe_format::set_range_gap(ulong gap){
+	context.range_gap = gap;
+}
+
+void xe_format::set_verify_checksums(bool verify){
+	context.verify_checksums = verify;
+}
+
+void xe_format::set_content_type(xe_cstr content_type_){
+	content_type = content_type_;
+}
+
+void xe_format::set_extension(xe_cstr extension_){
+	extension = extension_;
+}
+
+int xe_format::register_demuxer(const xe_demuxer_class& format, int priority){
+	int err;
+
+	if((err = register_builtin_formats()))
+		return err;
+	return xe_insert_by_priority(formats, {&format, priority}) ? 0 : XE_ENOMEM;
 }
 
 void xe_format::close(){
 	context.reader.close();
 
+	for(xe_track* track : context.tracks){
+		if(track -> parser)
+			track -> parser -> close();
+	}
+
 	xe_delete(demuxer);
 }
 
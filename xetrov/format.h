@@ -41,9 +41,13 @@ struct xe_track{
 	/* private */
 	xe_parse parse;
 	xe_codec_parser* parser;
+	/* end of the last packet, when its duration was known */
+	ulong next_timestamp;
+	bool has_next;
 };
 
 class xe_demuxer;
+class xe_demuxer_class;
 class xe_format{
 public:
 	struct xe_context{
@@ -51,6 +55,12 @@ public:
 		xe_reader reader;
 		xe_reader scan_reader;
 		xe_vector<xe_track*> tracks;
+
+		/* gaps below this many bytes are read through instead of starting a new range */
+		ulong range_gap;
+
+		/* check container checksums, can be turned off for trusted sources */
+		bool verify_checksums;
 	};
 
 	xe_format();
@@ -63,13 +73,30 @@ public:
 	int read_packet(xe_packet& packet);
 	int seek(uint stream, ulong pos);
 
+	void set_range_gap(ulong gap);
+	void set_verify_checksums(bool verify);
+
+	/* hints for which demuxers to probe first, both must stay valid until open() */
+	void set_content_type(xe_cstr content_type);
+	void set_extension(xe_cstr extension);
+
 	const xe_vector<xe_track*> tracks() const;
+
+	/* higher priorities are probed first, ties go to the latest registration and
+	 * the built in demuxers have priority 0. not thread safe, register before opening */
+	static int register_demuxer(const xe_demuxer_class& format, int priority);
 private:
 	xe_context context;
 	xe_demuxer* demuxer;
 	xe_resource* resource;
 	xe_stream* stream;
 	xe_fiber_worker* worker;
+
+	xe_cstr content_type;
+	xe_cstr extension;
+
+	bool hinted(const xe_demuxer_class& format);
+	int probe();
 };
 
 }
\ No newline at end of file
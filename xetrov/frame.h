@@ -27,6 +27,70 @@ enum xe_audio_sample_fmt{
 	XE_SAMPLE_FMT_S64P = AV_SAMPLE_FMT_S64P
 };
 
+static inline bool xe_sample_fmt_planar(xe_audio_sample_fmt fmt){
+	switch(fmt){
+		case XE_SAMPLE_FMT_U8P:
+		case XE_SAMPLE_FMT_S16P:
+		case XE_SAMPLE_FMT_S32P:
+		case XE_SAMPLE_FMT_FLTP:
+		case XE_SAMPLE_FMT_DBLP:
+		case XE_SAMPLE_FMT_S64P:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* bytes per sample of one channel */
+static inline uint xe_sample_fmt_size(xe_audio_sample_fmt fmt){
+	switch(fmt){
+		case XE_SAMPLE_FMT_U8:
+		case XE_SAMPLE_FMT_U8P:
+			return 1;
+		case XE_SAMPLE_FMT_S16:
+		case XE_SAMPLE_FMT_S16P:
+			return 2;
+		case XE_SAMPLE_FMT_S32:
+		case XE_SAMPLE_FMT_S32P:
+		case XE_SAMPLE_FMT_FLT:
+		case XE_SAMPLE_FMT_FLTP:
+			return 4;
+		case XE_SAMPLE_FMT_DBL:
+		case XE_SAMPLE_FMT_DBLP:
+		case XE_SAMPLE_FMT_S64:
+		case XE_SAMPLE_FMT_S64P:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+struct xe_audio_format{
+	xe_audio_sample_fmt format;
+	uint sample_rate;
+	uint channels;
+	ulong channel_layout;
+
+	/* number of data pointers */
+	uint planes() const{
+		return xe_sample_fmt_planar(format) ? channels : 1;
+	}
+
+	/* bytes per sample in each plane */
+	uint stride() const{
+		return xe_sample_fmt_planar(format) ? xe_sample_fmt_size(format) : xe_sample_fmt_size(format) * channels;
+	}
+
+	bool operator==(const xe_audio_format& other) const{
+		return format == other.format && sample_rate == other.sample_rate &&
+			channels == other.channels && channel_layout == other.channel_layout;
+	}
+
+	bool operator!=(const xe_audio_format& other) const{
+		return !(*this == other);
+	}
+};
+
 class xe_frame{
 public:
 	struct{
@@ -42,7 +106,7 @@ public:
 	uint samples;
 	uint channels;
 	uint sample_rate;
-	uint channel_layout;
+	ulong channel_layout;
 	uint flags;
 
 	union{
@@ -50,10 +114,25 @@ public:
 		uint format;
 	};
 
+	xe_frame(){
+		data = internal.data;
+		duration = 0;
+		timestamp = 0;
+		samples = 0;
+		channels = 0;
+		sample_rate = 0;
+		channel_layout = 0;
+		flags = 0;
+		format = XE_SAMPLE_FMT_NONE;
+
+		xe_zero(&internal.bufs);
+	}
+
 	xe_frame& operator=(xe_frame&& other){
 		unref();
 
-		data = other.data;
+		/* data may point into other's own internal fields */
+		data = other.data == other.internal.data ? internal.data : other.data;
 		duration = other.duration;
 		timestamp = other.timestamp;
 		samples = other.samples;
@@ -61,6 +140,7 @@ public:
 		sample_rate = other.sample_rate;
 		channel_layout = other.channel_layout;
 		flags = other.flags;
+		format = other.format;
 
 		xe_tmemcpy(&internal, &other.internal);
 
@@ -72,6 +152,7 @@ public:
 		other.sample_rate = 0;
 		other.channel_layout = 0;
 		other.flags = 0;
+		other.format = XE_SAMPLE_FMT_NONE;
 
 		xe_zero(&other.internal.bufs);
 
@@ -89,6 +170,7 @@ public:
 
 		if(data != internal.data)
 			xe_dealloc(data);
+		data = internal.data;
 		for(uint i = 0; i < internal.extended_buf.size(); i++)
 			xe_delete(internal.extended_buf[i]);
 		internal.extended_buf.free();
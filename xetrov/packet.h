@@ -8,7 +8,10 @@ namespace xetrov{
 
 enum xe_packet_flags{
 	XE_PACKET_FLAG_NONE = 0x0,
-	XE_PACKET_FLAG_KEY = 0x1
+	XE_PACKET_FLAG_KEY = 0x1,
+	/* the container gives no timestamp, the packet follows the previous one of
+	 * its track. xe_format fills it in when the previous duration is known */
+	XE_PACKET_FLAG_NO_TIMESTAMP = 0x2
 };
 
 struct xe_packet{
@@ -26,6 +26,12 @@ public:
 		return left > size + XE_BUFFER_PADDING;
 	}
 
+	/* where the next allocation starts, writable up to a size has() allows
+	 * so output of unknown size can be produced in place before alloc() */
+	xe_bptr tail() const{
+		return head;
+	}
+
 	void alloc(xe_packet& packet, size_t size){
 		packet.ref.ref(buf);
 
@@ -112,4 +118,94 @@ public:
 	}
 };
 
+/* fixed size buffers for decoded frames. frames may outlive their decoder,
+ * so the pool is heap allocated and close() defers freeing it until every
+ * buffer has been returned */
+class xe_frame_buffer_pool{
+private:
+	struct xe_frame_buffer_node{
+		xe_frame_buffer_node* next;
+		xe_frame_buffer_pool* pool;
+		xe_buffer* buffer;
+	};
+
+	xe_frame_buffer_node* head;
+	size_t size;
+	size_t outstanding;
+	bool closed;
+
+	static void restore(xe_ptr ptr, xe_buffer* buffer){
+		xe_frame_buffer_node& node = *(xe_frame_buffer_node*)ptr;
+		xe_frame_buffer_pool& pool = *node.pool;
+
+		pool.outstanding--;
+
+		if(pool.closed){
+			xe_dealloc(buffer);
+			xe_dealloc(&node);
+
+			if(!pool.outstanding)
+				xe_delete(&pool);
+			return;
+		}
+
+		node.next = pool.head;
+		node.buffer = buffer;
+		pool.head = &node;
+	}
+public:
+	xe_frame_buffer_pool(size_t size_){
+		head = null;
+		size = size_;
+		outstanding = 0;
+		closed = false;
+	}
+
+	bool get_buffer(xe_buffer_ref& ref){
+		xe_frame_buffer_node* node = head;
+
+		if(node){
+			ref.ref(node -> buffer);
+			head = node -> next;
+		}else{
+			node = xe_alloc<xe_frame_buffer_node>();
+
+			if(!node)
+				return false;
+			if(!ref.create(size, restore, node)){
+				xe_dealloc(node);
+
+				return false;
+			}
+
+			node -> pool = this;
+		}
+
+		outstanding++;
+
+		return true;
+	}
+
+	/* use instead of deleting the pool */
+	void close(){
+		closed = true;
+
+		if(!outstanding)
+			xe_delete(this);
+	}
+
+	~xe_frame_buffer_pool(){
+		xe_frame_buffer_node* next;
+
+		while(head){
+			next = head -> next;
+
+			xe_dealloc(head -> buffer);
+			xe_dealloc(head);
+
+			head = next;
+		}
+	}
+};
+
 }
\ No newline at end of file
@@ -1,67 +1,185 @@
 #pragma once
+#include <byteswap.h>
 #include "../types.h"
 #include "xe/assert.h"
+#include "xe/arch.h"
+#include "xe/mem.h"
 
 namespace xetrov{
 
+/* Implementation details
+ * ==============================================================
+ * bits are served from a 64 bit cache that holds at least 56 bits
+ * after every refill. a refill is a single unaligned big endian load
+ * with no branches, which relies on the XE_BUFFER_PADDING bytes that
+ * follow every packet and codec config being readable
+ *
+ * reads past the end return zero bits from the padding, and has_bits
+ * reports whether everything read so far was inside the buffer
+ */
+
 class xe_bit_reader{
 private:
-	xe_bptr buf;
-	size_t offset;
+	xe_cbptr ptr;
+	xe_cbptr end;
+	ulong cache;
+	size_t pos;
 	size_t bits;
+	uint left;
+
+	void refill(){
+		ulong word;
+
+		xe_memcpy(&word, ptr, sizeof(word));
+
+		cache |= bswap_64(word) >> left;
+		ptr += (63 - left) >> 3;
+		ptr = ptr < end ? ptr : end;
+		left |= 56;
+	}
+
+	void consume(uint len){
+		cache <<= len;
+		left -= len;
+		pos += len;
+	}
 public:
-	xe_bit_reader(xe_bptr buf_, size_t offset_, size_t total_){
-		buf = buf_;
-		offset = offset_;
-		bits = total_;
+	xe_bit_reader(xe_cbptr buf, size_t offset, size_t total){
+		ptr = buf + (offset >> 3);
+		end = buf + ((total + 7) >> 3);
+		cache = 0;
+		left = 0;
+		pos = offset & ~(size_t)0x7;
+		bits = total;
+
+		refill();
+		consume(offset & 0x7);
 	}
 
-	byte read(){
-		if(offset < bits)
-			return (buf[offset >> 3] >> (7 - (offset++ & 0x7))) & 0x1;
-		offset++;
+	/* len must be between 1 and 56 */
+	ulong peek(uint len){
+		xe_assert(len && len <= 56);
+
+		refill();
 
-		return 0;
+		return cache >> (64 - len);
 	}
 
-	ulong read(size_t len){
-		xe_assert(len);
+	void skip(size_t len){
+		if(len <= left){
+			consume(len);
 
-		ulong value = 0;
-		uint byte;
-		uint read;
+			return;
+		}
 
-		if(!has_bits(len)){
-			offset += len;
+		len -= left;
+		pos += left;
+		cache = 0;
+		left = 0;
 
-			return 0;
+		/* whole bytes are skipped without touching the cache */
+		ptr += len >> 3;
+		pos += len & ~(size_t)0x7;
+		ptr = ptr < end ? ptr : end;
+
+		refill();
+		consume(len & 0x7);
+	}
+
+	uint read(){
+		ulong value;
+
+		refill();
+
+		value = cache >> 63;
+
+		consume(1);
+
+		return value;
+	}
+
+	/* len must be between 1 and 64 */
+	ulong read(uint len){
+		ulong value;
+
+		xe_assert(len && len <= 64);
+
+		if(len > 56){
+			value = read(len - 32) << 32;
+
+			return value | read(32);
 		}
 
-		while(len){ // TODO optimize read more than one byte at a time
-			read = 8 - (offset & 0x7);
-			byte = buf[offset >> 3];
-
-			if(read > len){
-				byte >>= (read - len);
-				byte &= (1 << len) - 1;
-				offset += len;
-				value = (value << len) | byte;
-
-				break;
-			}else{
-				byte &= (1 << read) - 1;
-				offset += read;
-				len -= read;
-				value = (value << read) | byte;
+		value = peek(len);
+
+		consume(len);
+
+		return value;
+	}
+
+	long read_signed(uint len){
+		return (long)(read(len) << (64 - len)) >> (64 - len);
+	}
+
+	/* number of zero bits before the next one bit, which is consumed */
+	uint read_unary(){
+		uint count = 0, zeros;
+
+		while(true){
+			refill();
+
+			zeros = cache ? xe_arch_clzl(cache) : 64;
+
+			if(zeros < left){
+				consume(zeros + 1);
+
+				return count + zeros;
 			}
+
+			count += left;
+
+			consume(left);
+
+			if(pos > bits)
+				return count;
 		}
+	}
 
-		return value;
+	/* exp-golomb, lengths over 32 bits are treated as corrupt and read as 0 */
+	ulong read_ue(){
+		uint zeros = read_unary();
+
+		if(zeros > 32){
+			pos = bits + 1;
+
+			return 0;
+		}
+
+		return ((1ul << zeros) | (zeros ? read(zeros) : 0)) - 1;
+	}
+
+	long read_se(){
+		ulong value = read_ue();
+
+		return value & 1 ? (long)((value + 1) >> 1) : -(long)(value >> 1);
+	}
+
+	void align(){
+		refill();
+		consume(-pos & 0x7);
+	}
+
+	size_t offset() const{
+		return pos;
+	}
+
+	size_t bits_left() const{
+		return pos < bits ? bits - pos : 0;
 	}
 
 	bool has_bits(ulong len){
-		return len + offset <= bits;
+		return len + pos <= bits;
 	}
 };
 
-}
\ No newline at end of file
+}
@@ -251,6 +251,7 @@ xe_reader::xe_reader(){
 	peek.off = 0;
 
 	off = 0;
+	range_end = 0;
 
 	stream_status = 0;
 	err = 0;
@@ -339,14 +340,15 @@ void xe_reader::peek_mode(bool enable){
 	}
 }
 
-int xe_reader::seek(ulong offset){
+int xe_reader::seek(ulong offset, ulong end){
 	int res;
 
 	xe_assertm(!peeking, "cannot seek in peek mode");
 
-	if((res = stream -> seek(offset)))
+	if((res = stream -> seek(offset, end)))
 		return stream_status = res;
 	off = offset;
+	range_end = end;
 	buffer_length = 0;
 	input_length = 0;
 	stream_status = 0;
@@ -366,7 +368,7 @@ int xe_reader::skip(ulong len){
 	size_t available = length + input_length, min;
 
 	if(!peeking && len > available + HARD_SEEK_THRESHOLD && stream -> seekable())
-		return err = seek(off);
+		return err = seek(off, off < range_end ? range_end : 0);
 	min = xe_min(len, length);
 	len -= min;
 	length -= min;
@@ -444,6 +446,29 @@ int xe_reader::read(xe_ptr buf, size_t len){
 	return err;
 }
 
+int xe_reader::read_partial(xe_ptr buf, size_t len, size_t& count){
+	int res;
+
+	count = 0;
+
+	if(err)
+		return err;
+	res = read(buf, len);
+
+	if(!res){
+		count = len;
+
+		return 0;
+	}
+
+	/* whatever was not delivered is still in read_length */
+	count = len - read_length;
+	off -= read_length;
+	read_length = 0;
+
+	return res;
+}
+
 ulong xe_reader::r64le(){
 	return read<8>();
 }
@@ -520,6 +545,10 @@ ulong xe_reader::offset(){
 	return off;
 }
 
+ulong xe_reader::size(){
+	return stream -> length();
+}
+
 int xe_reader::error(){
 	return err;
 }
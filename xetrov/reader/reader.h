@@ -30,6 +30,7 @@ private:
 	} peek;
 
 	ulong off;
+	ulong range_end;
 
 	int stream_status;
 	int err;
@@ -60,9 +61,12 @@ public:
 
 	void peek_mode(bool enable);
 
-	int seek(ulong offset);
+	/* end bounds the stream to [offset, end), 0 reads to the end */
+	int seek(ulong offset, ulong end = 0);
 	int skip(ulong len);
 	int read(xe_ptr buf, size_t len);
+	/* count is set to the bytes read even when the stream ends first */
+	int read_partial(xe_ptr buf, size_t len, size_t& count);
 
 	ulong r64le();
 	ulong r64be();
@@ -85,6 +89,8 @@ public:
 	double f64le();
 
 	ulong offset();
+	/* size of the stream, 0 if unknown */
+	ulong size();
 
 	int error();
 
@@ -0,0 +1,324 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "file.h"
+#include "../common.h"
+#include "../error.h"
+#include "xe/loop.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * the file is mapped once on the first open and the reader is
+ * handed pointers straight into the mapping, so no data is copied
+ * unless the worker suspends with input left over
+ *
+ * chunks end on XE_LOOP_IOBUF_SIZE boundaries of the file so every
+ * write after the first (or after a seek) is page aligned and never
+ * exceeds the reader's buffer limit
+ *
+ * streams that are open and not paused are linked into the ctx,
+ * which delivers a bounded number of chunks per stream on each poll
+ */
+
+enum{
+	CHUNK_SIZE = XE_LOOP_IOBUF_SIZE,
+	POLL_CHUNKS = 16,
+	DEFAULT_READAHEAD = 0x200000 /* 2 MB */
+};
+
+class xetrov::xe_file_stream : public xe_stream{
+public:
+	xe_file_ctx* ctx;
+	xe_file_resource* resource;
+
+	xe_file_stream* next;
+	xe_file_stream* prev;
+
+	xe_bptr map;
+	ulong size;
+
+	ulong current_start;
+	ulong current_end;
+	ulong advised;
+
+	int fd;
+
+	bool opened: 1;
+	bool active: 1;
+	bool paused: 1;
+	bool callback: 1;
+	bool seeked: 1;
+	bool stop: 1;
+	bool closing: 1;
+
+	xe_file_stream(xe_file_ctx* ctx_, xe_file_resource* resource_){
+		ctx = ctx_;
+		resource = resource_;
+		fd = -1;
+		seekable_ = true;
+	}
+
+	void activate(){
+		if(active || paused)
+			return;
+		active = true;
+		prev = null;
+		next = ctx -> head;
+
+		if(next)
+			next -> prev = this;
+		ctx -> head = this;
+	}
+
+	void deactivate(){
+		if(!active)
+			return;
+		active = false;
+
+		/* keep a walk in poll() off streams leaving the list */
+		if(ctx -> cursor == this)
+			ctx -> cursor = next;
+		if(prev)
+			prev -> next = next;
+		else
+			ctx -> head = next;
+		if(next)
+			next -> prev = prev;
+	}
+
+	void advise(){
+		ulong start, end;
+
+		/* hint the kernel to fault in the next window ahead of the reader */
+		if(current_start < advised && advised - current_start >= resource -> readahead / 2)
+			return;
+		start = current_start & ~((ulong)CHUNK_SIZE - 1);
+		end = xe_min<ulong>(start + resource -> readahead, current_end);
+
+		if(end > start)
+			madvise(map + start, end - start, MADV_WILLNEED);
+		advised = end;
+	}
+
+	int map_file(){
+		struct stat st;
+		char path[resource -> path.length() + 1];
+
+		xe_memcpy(path, resource -> path.data(), resource -> path.length());
+
+		path[resource -> path.length()] = 0;
+		fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+		if(fd < 0)
+			return -errno;
+		if(fstat(fd, &st))
+			return -errno;
+		size = st.st_size;
+		length_ = size;
+
+		if(!size)
+			return 0;
+		map = (xe_bptr)mmap(null, size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if(map == MAP_FAILED){
+			map = null;
+
+			return -errno;
+		}
+
+		madvise(map, size, MADV_SEQUENTIAL);
+
+		return 0;
+	}
+
+	void unmap_file(){
+		if(map)
+			munmap(map, size);
+		if(fd >= 0)
+			::close(fd);
+		map = null;
+		fd = -1;
+	}
+
+	void finish(int error){
+		deactivate();
+
+		if(callbacks.done){
+			callback = true;
+			callbacks.done(*this, error);
+			callback = false;
+		}
+
+		if(closing)
+			destroy();
+	}
+
+	void destroy(){
+		deactivate();
+		unmap_file();
+
+		xe_delete(this);
+	}
+
+	void run(){
+		size_t len;
+		int err;
+
+		for(uint i = 0; i < POLL_CHUNKS && active; i++){
+			if(stop){
+				finish(XE_ABORTED);
+
+				return;
+			}
+
+			if(current_start >= current_end){
+				finish(0);
+
+				return;
+			}
+
+			len = CHUNK_SIZE - (current_start & (CHUNK_SIZE - 1));
+			len = xe_min<ulong>(len, current_end - current_start);
+
+			advise();
+
+			err = 0;
+			seeked = false;
+
+			if(callbacks.write){
+				callback = true;
+				err = callbacks.write(*this, map + current_start, len);
+				callback = false;
+			}
+
+			if(closing){
+				destroy();
+
+				return;
+			}
+
+			if(err){
+				finish(err);
+
+				return;
+			}
+
+			/* a seek from within the callback already moved the cursor */
+			if(!seeked)
+				current_start += len;
+		}
+	}
+
+	int open(ulong start, ulong end){
+		int err;
+
+		if(!opened){
+			if((err = map_file())){
+				unmap_file();
+
+				return err;
+			}
+
+			opened = true;
+		}
+
+		current_start = xe_min(start, size);
+		current_end = end ? xe_min(end, size) : size;
+		advised = 0;
+		stop = false;
+
+		activate();
+
+		return 0;
+	}
+
+	int seek(ulong offset, ulong end){
+		if(!opened)
+			return XE_EINVAL;
+		current_end = end ? xe_min(end, size) : size;
+		current_start = xe_min(offset, current_end);
+		advised = 0;
+		seeked = true;
+		stop = false;
+
+		activate();
+
+		return 0;
+	}
+
+	void pause(bool paused_){
+		paused = paused_;
+
+		if(paused)
+			deactivate();
+		else
+			activate();
+	}
+
+	void abort(){
+		stop = true;
+
+		/* finish on the next poll so the done callback
+		 * never runs from inside the caller's stack */
+		paused = false;
+
+		activate();
+	}
+
+	void close(){
+		if(callback)
+			closing = true;
+		else
+			destroy();
+	}
+};
+
+xe_file_ctx::xe_file_ctx(){
+	head = null;
+	cursor = null;
+}
+
+bool xe_file_ctx::poll(){
+	xe_file_stream* stream = head;
+
+	/* a callback may close or pause any stream, so the
+	 * next one is read back from the cursor after each run */
+	while(stream){
+		cursor = stream -> next;
+		stream -> run();
+		stream = cursor;
+	}
+
+	return head != null;
+}
+
+bool xe_file_ctx::pending() const{
+	return head != null;
+}
+
+xe_file_resource::xe_file_resource(){
+
+}
+
+int xe_file_resource::init(xe_file_ctx& ctx_, xe_string path_){
+	ctx = &ctx_;
+	path = path_;
+	readahead = DEFAULT_READAHEAD;
+
+	return 0;
+}
+
+void xe_file_resource::set_readahead(size_t size){
+	readahead = xe_max<size_t>(size, CHUNK_SIZE);
+}
+
+xe_stream* xe_file_resource::create(){
+	return xe_znew<xe_file_stream>(ctx, this);
+}
+
+void xe_file_resource::close(){}
\ No newline at end of file
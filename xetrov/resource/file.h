@@ -0,0 +1,44 @@
+#pragma once
+#include "resource.h"
+#include "xe/string.h"
+
+namespace xetrov{
+
+class xe_file_stream;
+class xe_file_ctx{
+private:
+	xe_file_stream* head;
+	/* the next stream of the walk in poll() */
+	xe_file_stream* cursor;
+
+	friend class xe_file_stream;
+public:
+	xe_file_ctx();
+
+	/* deliver pending data to every running stream,
+	 * returns true if any stream still has data to deliver */
+	bool poll();
+	bool pending() const;
+};
+
+class xe_file_resource : public xe_resource{
+private:
+	xe_file_ctx* ctx;
+	xe_string path;
+
+	size_t readahead;
+
+	friend class xe_file_stream;
+public:
+	xe_file_resource();
+
+	int init(xe_file_ctx& ctx, xe_string path);
+
+	void set_readahead(size_t size);
+
+	xe_stream* create();
+
+	void close();
+};
+
+}
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <strings.h>
 #include "net.h"
 #include "xurl/request.h"
 #include "../common.h"
@@ -5,6 +6,25 @@
 using namespace xurl;
 using namespace xetrov;
 
+static bool header_is(const xe_string_view& key, xe_cstr name, size_t length){
+	return key.length() == length && !strncasecmp(key.data(), name, length);
+}
+
+/* 0 if it isn't a number */
+static ulong header_number(const char* data, size_t length){
+	ulong value = 0;
+
+	if(!length)
+		return 0;
+	for(size_t i = 0; i < length; i++){
+		if(data[i] < '0' || data[i] > '9')
+			return 0;
+		value = value * 10 + (data[i] - '0');
+	}
+
+	return value;
+}
+
 class xetrov::xe_net_stream : public xe_stream{
 public:
 	static int write_cb(xe_request& request, xe_ptr buf, size_t len){
@@ -25,9 +45,32 @@ public:
 		return 0;
 	}
 
+	static int header_cb(xe_request& request, xe_string_view& key, xe_string_view& value){
+		xe_net_stream& stream = xe_containerof(request, &xe_net_stream::request);
+		size_t slash;
+
+		if(stream.length_)
+			return 0;
+		/* the total size, for reading from the end of the resource */
+		if(header_is(key, "Content-Range", 13)){
+			/* bytes start-end/total, the total may be * */
+			for(slash = 0; slash < value.length() && value.data()[slash] != '/'; slash++);
+
+			if(slash < value.length())
+				stream.length_ = header_number(value.data() + slash + 1, value.length() - slash - 1);
+		}else if(header_is(key, "Content-Length", 14) && !stream.ranged){
+			/* only the whole resource when no range was asked for */
+			stream.length_ = header_number(value.data(), value.length());
+		}
+
+		return 0;
+	}
+
 	static void done_cb(xe_request& request, int error){
 		xe_net_stream& stream = xe_containerof(request, &xe_net_stream::request);
 
+		stream.active = false;
+
 		if(stream.reopen && error == XE_ABORTED){
 			error = stream.open(stream.current_start, stream.current_end);
 
@@ -51,6 +94,8 @@ public:
 	ulong current_start;
 
 	bool opened: 1;
+	bool active: 1;
+	bool ranged: 1;
 	bool callback: 1;
 	bool reopen: 1;
 	bool stop: 1;
@@ -59,6 +104,7 @@ public:
 	xe_net_stream(xurl_ctx* ctx_, xe_net_resource* resource_){
 		ctx = ctx_;
 		resource = resource_;
+		request.set_header_cb(header_cb);
 		request.set_write_cb(write_cb);
 		request.set_done_cb(done_cb);
 		seekable_ = true;
@@ -79,15 +125,19 @@ public:
 			opened = true;
 		}
 
+		current_start = start;
 		current_end = end;
 		stop = false;
 		reopen = false;
 
 		if(!request.set_http_header("Accept", "*/*"))
 			return XE_ENOMEM;
-		if(start || end){
+		/* once a range was requested the header sticks, so always replace it */
+		if(start || end || ranged){
 			char range[60];
 
+			ranged = true;
+
 			if(end)
 				snprintf(range, sizeof(range), "bytes=%lu-%lu", start, end - 1);
 			else
@@ -96,11 +146,20 @@ public:
 				return XE_ENOMEM;
 		}
 
-		return ctx -> start(request);
+		if((err = ctx -> start(request)))
+			return err;
+		active = true;
+
+		return 0;
 	}
 
-	int seek(ulong offset){
+	int seek(ulong offset, ulong end){
 		current_start = offset;
+		current_end = end;
+
+		/* the last range already finished, start a new request */
+		if(!active)
+			return open(offset, end);
 		reopen = true;
 
 		if(!callback)
@@ -15,11 +15,14 @@ protected:
 	} callbacks;
 
 	bool seekable_;
+	/* 0 when the size isn't known */
+	ulong length_;
 public:
 	xe_stream(){}
 
 	virtual int open(ulong start = 0, ulong end = 0) = 0;
-	virtual int seek(ulong offset) = 0;
+	/* end bounds the new range, 0 reads to the end of the resource */
+	virtual int seek(ulong offset, ulong end = 0) = 0;
 	virtual void pause(bool paused) = 0;
 	virtual void abort() = 0;
 	virtual void close() = 0;
@@ -28,6 +31,11 @@ public:
 		return seekable_;
 	}
 
+	/* total size of the resource, known once opened */
+	ulong length() const{
+		return length_;
+	}
+
 	void set_write_cb(write_cb cb){
 		callbacks.write = cb;
 	}
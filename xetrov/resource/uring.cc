@@ -0,0 +1,577 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "uring.h"
+#include "../common.h"
+#include "../error.h"
+#include "xe/loop.h"
+#include "xe/mem.h"
+
+using namespace xetrov;
+
+/* Implementation details
+ * ==============================================================
+ * each stream owns a fixed set of read slots backed by buffers
+ * registered with the ring, and keeps as many of them in flight
+ * ahead of the reader as it can
+ *
+ * reads are queued in file order and delivered strictly in that
+ * order, straight from the registered buffer, so the reader gets the
+ * same zero-copy path it gets from a socket's io buffer
+ *
+ * a seek bumps the stream's generation and cancels everything in
+ * flight. slots from an older generation are only reused once their
+ * completion has been reaped, since the kernel may still be writing
+ * into the buffer until then
+ *
+ * a paused stream may be left with every read complete and nothing in
+ * flight, in which case the ring's fd has nothing to fire for. resuming
+ * queues a nop so the next poll() runs and delivers what is waiting
+ */
+
+enum{
+	CHUNK_SIZE = XE_LOOP_IOBUF_SIZE,
+	BUFFER_ALIGN = 4096,
+	DEFAULT_DEPTH = 4
+};
+
+struct xe_uring_read{
+	xe_uring_stream* stream;
+	ulong offset;
+	uint length;
+	uint buffer;
+	uint generation;
+	int result;
+
+	bool inflight: 1;
+	bool queued: 1;
+	bool complete: 1;
+};
+
+static int uring_error(int err){
+	switch(err){
+		case -ENOMEM:
+			return XE_ENOMEM;
+		case -EINVAL:
+			return XE_EINVAL;
+		case -ENOSYS:
+		case -EPERM:
+			/* no io_uring in this kernel, or disabled for this process */
+			return XE_ENOSYS;
+	}
+
+	return XE_EXTERNAL;
+}
+
+class xetrov::xe_uring_stream : public xe_stream{
+public:
+	xe_uring_ctx* ctx;
+	xe_uring_resource* resource;
+
+	xe_uring_stream* next;
+	xe_uring_stream* prev;
+
+	xe_uring_read* reads;
+	uint* queue;
+	uint depth;
+	uint queue_head;
+	uint queue_size;
+	uint inflight;
+	uint generation;
+
+	ulong size;
+	ulong current_end;
+	ulong submit_offset;
+
+	int fd;
+
+	bool opened: 1;
+	bool paused: 1;
+	bool callback: 1;
+	bool seeked: 1;
+	bool stop: 1;
+	bool finished: 1;
+	bool closing: 1;
+
+	xe_uring_stream(xe_uring_ctx* ctx_, xe_uring_resource* resource_){
+		ctx = ctx_;
+		resource = resource_;
+		fd = -1;
+		finished = true;
+		seekable_ = true;
+		prev = null;
+		next = ctx -> head;
+
+		if(next)
+			next -> prev = this;
+		ctx -> head = this;
+	}
+
+	int open_file(){
+		struct stat st;
+		char path[resource -> path.length() + 1];
+		int index;
+
+		xe_memcpy(path, resource -> path.data(), resource -> path.length());
+
+		path[resource -> path.length()] = 0;
+		fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+		if(fd < 0)
+			return -errno;
+		if(fstat(fd, &st))
+			return -errno;
+		size = st.st_size;
+		length_ = size;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		reads = xe_zalloc<xe_uring_read>(resource -> depth);
+		queue = xe_alloc<uint>(resource -> depth);
+
+		if(!reads || !queue)
+			return XE_ENOMEM;
+		for(depth = 0; depth < resource -> depth; depth++){
+			index = ctx -> acquire_buffer();
+
+			if(index < 0)
+				break;
+			reads[depth].stream = this;
+			reads[depth].buffer = index;
+		}
+
+		return depth ? 0 : XE_ENOMEM;
+	}
+
+	void close_file(){
+		for(uint i = 0; i < depth; i++)
+			ctx -> release_buffer(reads[i].buffer);
+		if(fd >= 0)
+			::close(fd);
+		xe_dealloc(reads);
+		xe_dealloc(queue);
+
+		reads = null;
+		queue = null;
+		depth = 0;
+		fd = -1;
+	}
+
+	xe_uring_read* free_slot(){
+		for(uint i = 0; i < depth; i++){
+			if(!reads[i].inflight && !reads[i].queued)
+				return &reads[i];
+		}
+
+		return null;
+	}
+
+	void prime(){
+		xe_uring_read* read;
+		io_uring_sqe* sqe;
+		uint length;
+
+		while(!stop && queue_size < depth && submit_offset < current_end){
+			read = free_slot();
+
+			if(!read)
+				break;
+			sqe = io_uring_get_sqe(&ctx -> ring);
+
+			if(!sqe){
+				/* submission queue is full, flush it and try again */
+				io_uring_submit(&ctx -> ring);
+				sqe = io_uring_get_sqe(&ctx -> ring);
+
+				if(!sqe)
+					break;
+			}
+
+			length = CHUNK_SIZE - (submit_offset & (CHUNK_SIZE - 1));
+			length = xe_min<ulong>(length, current_end - submit_offset);
+
+			io_uring_prep_read_fixed(sqe, fd, ctx -> buffer(read -> buffer), length, submit_offset, read -> buffer);
+			io_uring_sqe_set_data(sqe, read);
+
+			read -> offset = submit_offset;
+			read -> length = length;
+			read -> generation = generation;
+			read -> inflight = true;
+			read -> queued = true;
+			read -> complete = false;
+
+			queue[(queue_head + queue_size) % depth] = read - reads;
+			queue_size++;
+			inflight++;
+			submit_offset += length;
+		}
+	}
+
+	void cancel(){
+		xe_uring_read* read;
+		io_uring_sqe* sqe;
+
+		generation++;
+
+		for(uint i = 0; i < queue_size; i++){
+			read = &reads[queue[(queue_head + i) % depth]];
+			read -> queued = false;
+
+			if(!read -> inflight)
+				continue;
+			sqe = io_uring_get_sqe(&ctx -> ring);
+
+			if(!sqe)
+				continue; /* the stale read will still be discarded on completion */
+			io_uring_prep_cancel(sqe, read, 0);
+			io_uring_sqe_set_data(sqe, null);
+		}
+
+		queue_head = 0;
+		queue_size = 0;
+	}
+
+	void complete(xe_uring_read& read, int result){
+		read.inflight = false;
+		inflight--;
+
+		if(read.generation == generation && read.queued){
+			read.complete = true;
+			read.result = result;
+		}
+
+		if(closing && !inflight)
+			destroy();
+	}
+
+	void finish(int error){
+		finished = true;
+
+		if(callbacks.done){
+			callback = true;
+			callbacks.done(*this, error);
+			callback = false;
+		}
+
+		/* closed from the callback, destroyed now or once the reads in flight complete */
+		if(closing)
+			close();
+	}
+
+	void run(){
+		xe_uring_read* read;
+		int err;
+
+		if(finished || closing)
+			return;
+		if(stop){
+			cancel();
+			finish(XE_ABORTED);
+
+			return;
+		}
+
+		while(queue_size && !paused){
+			read = &reads[queue[queue_head]];
+
+			if(!read -> complete)
+				break;
+			if(read -> result < 0){
+				cancel();
+				finish(uring_error(read -> result));
+
+				return;
+			}
+
+			queue_head = (queue_head + 1) % depth;
+			queue_size--;
+			read -> queued = false;
+			read -> complete = false;
+
+			if(!read -> result){
+				/* file was truncated under us */
+				cancel();
+				finish(0);
+
+				return;
+			}
+
+			err = 0;
+			seeked = false;
+
+			if(callbacks.write){
+				callback = true;
+				err = callbacks.write(*this, ctx -> buffer(read -> buffer), read -> result);
+				callback = false;
+			}
+
+			if(closing){
+				close();
+
+				return;
+			}
+
+			if(err){
+				cancel();
+				finish(err);
+
+				return;
+			}
+
+			if(!seeked && (uint)read -> result < read -> length){
+				/* short read, restart readahead where the data ended */
+				cancel();
+
+				submit_offset = read -> offset + read -> result;
+			}
+
+			prime();
+		}
+
+		if(!queue_size && submit_offset >= current_end)
+			finish(0);
+	}
+
+	void destroy(){
+		if(ctx -> cursor == this)
+			ctx -> cursor = next;
+		if(prev)
+			prev -> next = next;
+		else
+			ctx -> head = next;
+		if(next)
+			next -> prev = prev;
+		close_file();
+
+		xe_delete(this);
+	}
+
+	int open(ulong start, ulong end){
+		int err;
+
+		if(!opened){
+			if((err = open_file())){
+				close_file();
+
+				return err;
+			}
+
+			opened = true;
+		}
+
+		cancel();
+
+		current_end = end ? xe_min(end, size) : size;
+		submit_offset = xe_min(start, current_end);
+		stop = false;
+		finished = false;
+
+		prime();
+
+		return 0;
+	}
+
+	int seek(ulong offset, ulong end){
+		if(!opened)
+			return XE_EINVAL;
+		cancel();
+
+		current_end = end ? xe_min(end, size) : size;
+		submit_offset = xe_min(offset, current_end);
+		seeked = true;
+		stop = false;
+		finished = false;
+
+		prime();
+
+		return 0;
+	}
+
+	void wake(){
+		io_uring_sqe* sqe = io_uring_get_sqe(&ctx -> ring);
+
+		if(!sqe){
+			io_uring_submit(&ctx -> ring);
+			sqe = io_uring_get_sqe(&ctx -> ring);
+
+			if(!sqe)
+				return;
+		}
+
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, null);
+		io_uring_submit(&ctx -> ring);
+	}
+
+	void pause(bool paused_){
+		bool resumed = paused && !paused_;
+
+		/* reads already in flight keep filling the readahead window */
+		paused = paused_;
+
+		if(!resumed || finished || closing)
+			return;
+		prime();
+		wake();
+	}
+
+	void abort(){
+		stop = true;
+	}
+
+	void close(){
+		closing = true;
+
+		if(callback)
+			return;
+		cancel();
+
+		if(!inflight)
+			destroy();
+	}
+};
+
+xe_uring_ctx::xe_uring_ctx(){
+	buffers = null;
+	free_buffers = null;
+	free_count = 0;
+	buffer_count = 0;
+	head = null;
+	cursor = null;
+	initialized = false;
+}
+
+int xe_uring_ctx::init(uint entries, uint count){
+	struct iovec* iovecs;
+	int err;
+
+	if(!count)
+		return XE_EINVAL;
+	if((err = io_uring_queue_init(entries, &ring, 0)))
+		return uring_error(err);
+	initialized = true;
+	buffers = xe_alloc_aligned<byte>(BUFFER_ALIGN, (size_t)count * CHUNK_SIZE);
+	free_buffers = xe_alloc<uint>(count);
+	iovecs = xe_alloc<struct iovec>(count);
+
+	if(!buffers || !free_buffers || !iovecs){
+		xe_dealloc(iovecs);
+
+		return XE_ENOMEM;
+	}
+
+	for(uint i = 0; i < count; i++){
+		iovecs[i].iov_base = buffers + (size_t)i * CHUNK_SIZE;
+		iovecs[i].iov_len = CHUNK_SIZE;
+		free_buffers[i] = count - i - 1;
+	}
+
+	err = io_uring_register_buffers(&ring, iovecs, count);
+
+	xe_dealloc(iovecs);
+
+	if(err)
+		return uring_error(err);
+	buffer_count = count;
+	free_count = count;
+
+	return 0;
+}
+
+int xe_uring_ctx::acquire_buffer(){
+	if(!free_count)
+		return -1;
+	return free_buffers[--free_count];
+}
+
+void xe_uring_ctx::release_buffer(uint index){
+	free_buffers[free_count++] = index;
+}
+
+xe_bptr xe_uring_ctx::buffer(uint index){
+	return buffers + (size_t)index * CHUNK_SIZE;
+}
+
+int xe_uring_ctx::fd() const{
+	return ring.ring_fd;
+}
+
+bool xe_uring_ctx::poll(){
+	io_uring_cqe* cqe;
+	xe_uring_read* read;
+	xe_uring_stream* stream;
+	bool pending = false;
+	int result;
+
+	io_uring_submit(&ring);
+
+	while(!io_uring_peek_cqe(&ring, &cqe)){
+		read = (xe_uring_read*)io_uring_cqe_get_data(cqe);
+		result = cqe -> res;
+
+		io_uring_cqe_seen(&ring, cqe);
+
+		/* cancel and wake up requests carry no data */
+		if(read)
+			read -> stream -> complete(*read, result);
+	}
+
+	stream = head;
+
+	/* a callback may close any stream, so the
+	 * next one is read back from the cursor after each run */
+	while(stream){
+		cursor = stream -> next;
+		stream -> run();
+		stream = cursor;
+	}
+
+	io_uring_submit(&ring);
+
+	for(stream = head; stream; stream = stream -> next){
+		if(stream -> inflight || (!stream -> finished && !stream -> paused)){
+			pending = true;
+
+			break;
+		}
+	}
+
+	return pending;
+}
+
+void xe_uring_ctx::close(){
+	if(!initialized)
+		return;
+	io_uring_queue_exit(&ring);
+
+	xe_dealloc(buffers);
+	xe_dealloc(free_buffers);
+
+	buffers = null;
+	free_buffers = null;
+	initialized = false;
+}
+
+xe_uring_resource::xe_uring_resource(){
+
+}
+
+int xe_uring_resource::init(xe_uring_ctx& ctx_, xe_string path_){
+	ctx = &ctx_;
+	path = path_;
+	depth = DEFAULT_DEPTH;
+
+	return 0;
+}
+
+void xe_uring_resource::set_readahead(uint depth_){
+	depth = xe_max<uint>(depth_, 1);
+}
+
+xe_stream* xe_uring_resource::create(){
+	return xe_znew<xe_uring_stream>(ctx, this);
+}
+
+void xe_uring_resource::close(){}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include <liburing.h>
+#include "resource.h"
+#include "xe/string.h"
+
+namespace xetrov{
+
+class xe_uring_stream;
+class xe_uring_ctx{
+private:
+	struct io_uring ring;
+
+	xe_bptr buffers;
+	uint* free_buffers;
+	uint free_count;
+	uint buffer_count;
+
+	xe_uring_stream* head;
+	/* the next stream of the walk in poll() */
+	xe_uring_stream* cursor;
+
+	bool initialized;
+
+	int acquire_buffer();
+	void release_buffer(uint index);
+	xe_bptr buffer(uint index);
+
+	friend class xe_uring_stream;
+public:
+	xe_uring_ctx();
+
+	/* buffers are XE_LOOP_IOBUF_SIZE each and shared between all streams */
+	int init(uint entries = 64, uint buffers = 64);
+
+	/* the ring's fd becomes readable when completions are available */
+	int fd() const;
+
+	/* submit queued reads, reap completions and deliver data to streams,
+	 * returns true if any stream still has reads in flight or data to deliver */
+	bool poll();
+
+	void close();
+};
+
+class xe_uring_resource : public xe_resource{
+private:
+	xe_uring_ctx* ctx;
+	xe_string path;
+
+	uint depth;
+
+	friend class xe_uring_stream;
+public:
+	xe_uring_resource();
+
+	int init(xe_uring_ctx& ctx, xe_string path);
+
+	/* number of reads kept in flight ahead of the reader */
+	void set_readahead(uint depth);
+
+	xe_stream* create();
+
+	void close();
+};
+
+}
\ No newline at end of file